@@ -0,0 +1,268 @@
+/* bench.cpp
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+/* Local transport benchmark: shared-memory ring vs. Unix datagram socket vs.
+   loopback UDP, with a producer and a consumer thread in one process.
+
+	g++ -O2 -std=c++11 -pthread bench.cpp -o bench
+	./bench [count] [size] [rate]
+
+   For each transport, the producer first sends count messages of size bytes 
+   as fast as it can (throughput and loss), then count messages paced at rate 
+   per second (one-way latency percentiles). The ring consumer polls without 
+   system calls (yielding when idle); the socket consumers block in recv(). 
+   The ring writer never waits, so a consumer that falls behind in the flood 
+   phase loses records rather than slowing the producer. Numbers on a single 
+   core mostly measure the scheduler. */
+
+#include "dslbridge.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#define RING_PATH "/tmp/dslbridge_bench.ring"
+#define SOCKET_PATH "/tmp/dslbridge_bench.sock"
+#define UDP_PORT 47999
+#define RING_CAPACITY (1 << 22)
+
+static uint64_t now_ns() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// One transport: producer side send(), consumer side receive()
+class Transport {
+
+public:
+
+	virtual ~Transport() {}
+	virtual const char *name() = 0;
+	virtual bool open() = 0;
+	virtual bool send(const uint8_t *data, size_t len) = 0;
+	virtual int receive(uint8_t *buffer, size_t size, int timeout_ms) = 0;
+	virtual uint64_t lost() { return 0; }
+};
+
+class RingTransport : public Transport {
+
+public:
+
+	const char *name() { return "shm ring"; }
+
+	bool open() {
+		return writer.open(RING_PATH, RING_CAPACITY) && reader.open(RING_PATH);
+	}
+
+	bool send(const uint8_t *data, size_t len) {
+		return writer.write(data, len);
+	}
+
+	int receive(uint8_t *buffer, size_t size, int timeout_ms) {
+		uint64_t deadline = now_ns() + (uint64_t)timeout_ms * 1000000;
+		for (;;) {
+			int n = reader.read(buffer, size);
+			if (n >= 0)
+				return n;
+			if (now_ns() > deadline)
+				return -1;
+			std::this_thread::yield();
+		}
+	}
+
+	uint64_t lost() { return reader.get_num_lost(); }
+
+	~RingTransport() { unlink(RING_PATH); }
+
+protected:
+
+	BridgeRingWriter writer;
+	BridgeRingReader reader;
+};
+
+class UnixTransport : public Transport {
+
+public:
+
+	UnixTransport() : fd(-1) {}
+	~UnixTransport() { if (fd >= 0) ::close(fd); }
+
+	const char *name() { return "unix dgram"; }
+
+	bool open() {
+		int rcvbuf = 1 << 22;
+		fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+		if (!consumer.open("/nonexistent", SOCKET_PATH) && consumer.get_fd() < 0)
+			return false;
+		setsockopt(consumer.get_fd(), SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+		memset(&dest, 0, sizeof(dest));
+		dest.sun_family = AF_UNIX;
+		strcpy(dest.sun_path, SOCKET_PATH);
+		return fd >= 0;
+	}
+
+	bool send(const uint8_t *data, size_t len) {
+		return sendto(fd, data, len, MSG_DONTWAIT, (struct sockaddr *)&dest, sizeof(dest)) == (ssize_t)len;
+	}
+
+	int receive(uint8_t *buffer, size_t size, int timeout_ms) {
+		return consumer.receive(buffer, size, timeout_ms);
+	}
+
+protected:
+
+	int fd;
+	struct sockaddr_un dest;
+	BridgeSocket consumer;
+};
+
+class UDPTransport : public Transport {
+
+public:
+
+	UDPTransport() : tx(-1), rx(-1) {}
+	~UDPTransport() { ::close(tx); ::close(rx); }
+
+	const char *name() { return "udp loopback"; }
+
+	bool open() {
+		int rcvbuf = 1 << 22;
+		memset(&dest, 0, sizeof(dest));
+		dest.sin_family = AF_INET;
+		dest.sin_port = htons(UDP_PORT);
+		dest.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		tx = socket(AF_INET, SOCK_DGRAM, 0);
+		rx = socket(AF_INET, SOCK_DGRAM, 0);
+		setsockopt(rx, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+		return tx >= 0 && rx >= 0 && bind(rx, (struct sockaddr *)&dest, sizeof(dest)) == 0;
+	}
+
+	bool send(const uint8_t *data, size_t len) {
+		return sendto(tx, data, len, 0, (struct sockaddr *)&dest, sizeof(dest)) == (ssize_t)len;
+	}
+
+	int receive(uint8_t *buffer, size_t size, int timeout_ms) {
+		struct pollfd pfd = { rx, POLLIN, 0 };
+		if (poll(&pfd, 1, timeout_ms) <= 0)
+			return -1;
+		return (int)recv(rx, buffer, size, 0);
+	}
+
+protected:
+
+	int tx;
+	int rx;
+	struct sockaddr_in dest;
+};
+
+struct Result {
+	uint64_t received;
+	double seconds;
+	std::vector<uint64_t> latency_ns;
+};
+
+// Producer sends count messages (paced at rate/s, or flat out if rate is 0)
+// carrying their send time; the consumer records one-way latency
+static Result run(Transport &t, int count, size_t size, double rate) {
+
+	Result result = { 0, 0.0, std::vector<uint64_t>() };
+	result.latency_ns.reserve(count);
+	std::atomic<bool> done(false);
+
+	std::thread consumer([&]() {
+		std::vector<uint8_t> buffer(size + 64);
+		uint64_t t0 = 0, t1 = 0;
+		for (;;) {
+			int n = t.receive(buffer.data(), buffer.size(), 200);
+			if (n < 0) {
+				if (done)
+					break;
+				continue;
+			}
+			uint64_t now = now_ns(), sent;
+			memcpy(&sent, buffer.data(), sizeof(sent));
+			if (!t0)
+				t0 = sent;
+			t1 = now;
+			result.latency_ns.push_back(now - sent);
+			result.received++;
+		}
+		result.seconds = (t1 - t0) * 1e-9;
+	});
+
+	std::vector<uint8_t> msg(size < 8 ? 8 : size, 0x55);
+	uint64_t start = now_ns();
+	for (int i = 0; i < count; i++) {
+		if (rate > 0) {
+			uint64_t due = start + (uint64_t)(i * 1e9 / rate);
+			while (now_ns() < due)
+				std::this_thread::yield();
+		}
+		uint64_t now = now_ns();
+		memcpy(msg.data(), &now, sizeof(now));
+		t.send(msg.data(), msg.size());
+	}
+	done = true;
+	consumer.join();
+	return result;
+}
+
+static double percentile(std::vector<uint64_t> &v, double p) {
+	if (v.empty())
+		return 0.0;
+	size_t idx = std::min(v.size() - 1, (size_t)(p / 100.0 * v.size()));
+	std::nth_element(v.begin(), v.begin() + idx, v.end());
+	return v[idx] * 1e-3;
+}
+
+int main(int argc, char **argv) {
+
+	int count = argc > 1 ? atoi(argv[1]) : 200000;
+	size_t size = argc > 2 ? atoi(argv[2]) : 32;
+	double rate = argc > 3 ? atof(argv[3]) : 20000;
+
+	printf("%d messages of %zu bytes; latency paced at %.0f/s\n\n", count, size, rate);
+	printf("%-14s %12s %8s %10s %10s %10s\n", "transport", "msgs/s", "lost", "p50 us", "p99 us", "p99.9 us");
+
+	RingTransport ring;
+	UnixTransport unix_dgram;
+	UDPTransport udp;
+	Transport *transports[] = { &ring, &unix_dgram, &udp };
+
+	for (Transport *t : transports) {
+		if (!t->open()) {
+			printf("%-14s failed to open\n", t->name());
+			continue;
+		}
+		Result flood = run(*t, count, size, 0);
+		Result paced = run(*t, count, size, rate);
+		printf("%-14s %12.0f %8llu %10.2f %10.2f %10.2f\n", t->name(), 
+			flood.received / (flood.seconds > 0 ? flood.seconds : 1), 
+			(unsigned long long)(count - flood.received),
+			percentile(paced.latency_ns, 50), percentile(paced.latency_ns, 99), 
+			percentile(paced.latency_ns, 99.9));
+	}
+	return 0;
+}
@@ -0,0 +1,323 @@
+/* dslbridge.h
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+/* Local fast paths to the UDP<->TCP bridge (tcp.py) for consumers on the same
+   machine:
+
+   BridgeRingReader maps the shared-memory ring written by `tcp.py --shm` and
+   reads device messages without a system call per message (the layout is 
+   documented in shmring.py). BridgeSocket talks to `tcp.py --unix`: it 
+   receives the same messages over a Unix datagram socket, and sends OSC 
+   packets (/tcp, /group) to the bridge. BridgeRingWriter produces a ring, 
+   for benchmarks and native producers.
+
+   Header-only; POSIX (Linux, macOS). */
+
+#ifndef DSLBRIDGE_H
+#define DSLBRIDGE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define BRIDGE_RING_MAGIC "DSLR"
+#define BRIDGE_RING_VERSION 1
+#define BRIDGE_RING_RECORD_HEADER 8
+#define BRIDGE_RING_PAD 0xFFFFFFFFu
+
+struct BridgeRingHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t capacity;			// Data bytes (a power of two)
+	uint32_t epoch;				// Changes when the writer recreates the ring
+	uint64_t write_pos;			// Bytes written; published after each record
+	uint8_t reserved[40];
+};
+
+static inline size_t bridge_ring_record_size(size_t len) {
+	return BRIDGE_RING_RECORD_HEADER + ((len + 7) & ~(size_t)7);
+}
+
+// Common mapping code
+class BridgeRing {
+
+public:
+
+	BridgeRing() : fd(-1), header(NULL), data(NULL), map_size(0), mask(0) {}
+	~BridgeRing() { close(); }
+
+	void close() {
+		if (header)
+			munmap(header, map_size);
+		if (fd >= 0)
+			::close(fd);
+		fd = -1;
+		header = NULL;
+		data = NULL;
+	}
+
+	bool is_open() const { return header != NULL; }
+
+protected:
+
+	bool map(int prot) {
+		header = (BridgeRingHeader *)mmap(NULL, map_size, prot, MAP_SHARED, fd, 0);
+		if (header == MAP_FAILED) {
+			header = NULL;
+			return false;
+		}
+		data = (uint8_t *)header + sizeof(BridgeRingHeader);
+		return true;
+	}
+
+	uint64_t load_write_pos() const {
+		return __atomic_load_n(&header->write_pos, __ATOMIC_ACQUIRE);
+	}
+
+	int fd;
+	BridgeRingHeader *header;
+	uint8_t *data;
+	size_t map_size;
+	uint64_t mask;
+};
+
+class BridgeRingReader : public BridgeRing {
+
+public:
+
+	BridgeRingReader() : pos(0), pending(0), num_lost(0) {}
+
+	// Map the ring; start with the next record written, or with the first 
+	// record if the ring has not wrapped yet
+	bool open(const char *path, bool from_start = false) {
+		struct stat st;
+		close();
+		fd = ::open(path, O_RDONLY);
+		if (fd < 0 || fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(BridgeRingHeader)) {
+			close();
+			return false;
+		}
+		map_size = st.st_size;
+		if (!map(PROT_READ) || memcmp(header->magic, BRIDGE_RING_MAGIC, 4) || 
+			header->version != BRIDGE_RING_VERSION ||
+			map_size != sizeof(BridgeRingHeader) + header->capacity) {
+			close();
+			return false;
+		}
+		mask = header->capacity - 1;
+		uint64_t wp = load_write_pos();
+		pos = (from_start && wp <= header->capacity) ? 0 : wp;
+		return true;
+	}
+
+	// Zero-copy read: point at the next record in the ring. The record stays
+	// valid until release(), which returns false if the writer overwrote it 
+	// in the meantime (discard anything read from it). Return false if no 
+	// record is available.
+	bool peek(const uint8_t **record, size_t *len) {
+		for (;;) {
+			uint64_t wp = load_write_pos();
+			if (wp == pos)
+				return false;
+			if (wp < pos || !within_slack(wp)) {
+				if (wp > pos)
+					num_lost++;
+				pos = wp;			// Overrun, or the writer restarted
+				return false;
+			}
+			uint64_t offset = pos & mask;
+			uint32_t n;
+			memcpy(&n, data + offset, 4);
+			if (n == BRIDGE_RING_PAD) {
+				pos += header->capacity - offset;
+				continue;
+			}
+			*record = data + offset + BRIDGE_RING_RECORD_HEADER;
+			*len = n;
+			pending = bridge_ring_record_size(n);
+			return true;
+		}
+	}
+
+	bool release() {
+		// The record's bytes must be read before write_pos is checked again 
+		// (as in a seqlock); the acquire load alone doesn't hold them back
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		uint64_t wp = load_write_pos();
+		bool intact = wp >= pos && within_slack(wp);
+		pos += pending;
+		pending = 0;
+		if (!intact) {
+			num_lost++;
+			pos = wp;
+		}
+		return intact;
+	}
+
+	// Copying read: return the record length, or -1 if there is none (records 
+	// longer than size are truncated)
+	int read(uint8_t *buffer, size_t size) {
+		const uint8_t *record;
+		size_t len;
+		while (peek(&record, &len)) {
+			size_t n = len < size ? len : size;
+			memcpy(buffer, record, n);
+			if (release())
+				return (int)n;
+		}
+		return -1;
+	}
+
+	uint64_t get_num_lost() const { return num_lost; }
+
+protected:
+
+	// Records are at most a quarter of the capacity, so the writer never 
+	// touches more than half the capacity past write_pos (wrap padding 
+	// included); only data within that slack is safe
+	bool within_slack(uint64_t wp) const {
+		return wp - pos <= header->capacity / 2;
+	}
+
+	uint64_t pos;
+	uint64_t pending;
+	uint64_t num_lost;
+};
+
+class BridgeRingWriter : public BridgeRing {
+
+public:
+
+	BridgeRingWriter() : pos(0) {}
+
+	bool open(const char *path, uint32_t capacity) {
+		close();
+		if (capacity & (capacity - 1))
+			return false;
+		map_size = sizeof(BridgeRingHeader) + capacity;
+		fd = ::open(path, O_RDWR | O_CREAT, 0644);
+		if (fd < 0 || ftruncate(fd, map_size) < 0 || !map(PROT_READ | PROT_WRITE)) {
+			close();
+			return false;
+		}
+		memset(header, 0, sizeof(BridgeRingHeader));
+		memcpy(header->magic, BRIDGE_RING_MAGIC, 4);
+		header->version = BRIDGE_RING_VERSION;
+		header->capacity = capacity;
+		header->epoch = (uint32_t)getpid();
+		mask = capacity - 1;
+		pos = 0;
+		return true;
+	}
+
+	bool write(const void *record, size_t len) {
+		size_t size = bridge_ring_record_size(len);
+		if (size > header->capacity / 4)
+			return false;
+		uint64_t offset = pos & mask;
+		if (offset + size > header->capacity) {
+			uint32_t pad = BRIDGE_RING_PAD;
+			memcpy(data + offset, &pad, 4);
+			pos += header->capacity - offset;
+			offset = 0;
+		}
+		uint32_t hdr[2] = { (uint32_t)len, 0 };
+		memcpy(data + offset, hdr, sizeof(hdr));
+		memcpy(data + offset + BRIDGE_RING_RECORD_HEADER, record, len);
+		pos += size;
+		__atomic_store_n(&header->write_pos, pos, __ATOMIC_RELEASE);
+		return true;
+	}
+
+protected:
+
+	uint64_t pos;
+};
+
+class BridgeSocket {
+
+public:
+
+	BridgeSocket() : fd(-1) { local.sun_path[0] = '\0'; }
+	~BridgeSocket() { close(); }
+
+	// Bind local_path and register with the bridge socket at bridge_path
+	bool open(const char *bridge_path, const char *local_path) {
+		close();
+		if (strlen(bridge_path) >= sizeof(bridge.sun_path) || 
+			strlen(local_path) >= sizeof(local.sun_path))
+			return false;
+		memset(&bridge, 0, sizeof(bridge));
+		memset(&local, 0, sizeof(local));
+		bridge.sun_family = local.sun_family = AF_UNIX;
+		strcpy(bridge.sun_path, bridge_path);
+		strcpy(local.sun_path, local_path);
+		unlink(local_path);
+		fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+		if (fd < 0 || bind(fd, (struct sockaddr *)&local, sizeof(local)) < 0) {
+			close();
+			return false;
+		}
+		return subscribe();
+	}
+
+	void close() {
+		if (fd >= 0) {
+			::close(fd);
+			unlink(local.sun_path);
+		}
+		fd = -1;
+	}
+
+	// (Re-)register for messages, e.g. after the bridge restarts
+	bool subscribe() {
+		return sendto(fd, "", 0, 0, (struct sockaddr *)&bridge, sizeof(bridge)) == 0;
+	}
+
+	// Receive one message; return its length, or -1 on timeout (-1: wait 
+	// forever)
+	int receive(uint8_t *buffer, size_t size, int timeout_ms = -1) {
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		if (timeout_ms >= 0 && poll(&pfd, 1, timeout_ms) <= 0)
+			return -1;
+		return (int)recv(fd, buffer, size, 0);
+	}
+
+	// Send an OSC packet to the bridge (/tcp or /group)
+	bool send(const void *packet, size_t len) {
+		return sendto(fd, packet, len, 0, (struct sockaddr *)&bridge, sizeof(bridge)) == (ssize_t)len;
+	}
+
+	int get_fd() const { return fd; }
+
+protected:
+
+	int fd;
+	struct sockaddr_un bridge;
+	struct sockaddr_un local;
+};
+
+#endif
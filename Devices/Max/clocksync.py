@@ -0,0 +1,89 @@
+import struct
+import time
+
+# Device clock sync (libiot SyncClock) and timetagged bundles. Devices send
+#
+#	/clock/req ,i <seq>
+#
+# over TCP and the bridge answers with the NTP times it received the request
+# and replied:
+#
+#	/clock/resp ,iiiii <seq> <t2_sec> <t2_frac> <t3_sec> <t3_frac>
+#
+# Devices then run bundles at their timetag (NTP time on the bridge's clock)
+# and report how far off they were with
+#
+#	/clock/error ,iiii <node_id> <timetag_sec> <timetag_frac> <error_us>
+
+REQUEST_HEADER = b'/clock/req\x00\x00,i\x00\x00'
+RESPONSE_HEADER = b'/clock/resp\x00,iiiii\x00\x00'
+ERROR_HEADER = b'/clock/error\x00\x00\x00\x00,iiii\x00\x00\x00'
+BUNDLE_TAG = b'#bundle\x00'
+
+# Seconds from the NTP epoch (1900) to the Unix epoch (1970)
+NTP_UNIX_OFFSET = 2208988800
+
+
+def timetag(t):
+	"""64-bit NTP timetag of a time.time() value"""
+	t += NTP_UNIX_OFFSET
+	sec = int(t)
+	return (sec << 32) | int((t - sec) * (1 << 32))
+
+
+def parse_request(data):
+	"""The sequence number of a /clock/req, or None"""
+	if not data.startswith(REQUEST_HEADER) or len(data) < len(REQUEST_HEADER) + 4:
+		return None
+	return struct.unpack_from('>i', data, len(REQUEST_HEADER))[0]
+
+
+def make_response(seq, received):
+	"""/clock/resp for a request received at time.time() value received;
+	stamped as late as possible"""
+	t2 = timetag(received)
+	t3 = timetag(time.time())
+	return RESPONSE_HEADER + struct.pack('>iIIII', seq, t2 >> 32, t2 & 0xFFFFFFFF,
+		t3 >> 32, t3 & 0xFFFFFFFF)
+
+
+def make_bundle(at, *elements):
+	"""Bundle of OSC packets to run at time.time() value at"""
+	data = BUNDLE_TAG + struct.pack('>Q', timetag(at))
+	for element in elements:
+		data += struct.pack('>i', len(element)) + element
+	return data
+
+
+def parse_error(data):
+	"""(node_id, timetag, error_us) of a /clock/error, or None"""
+	if not data.startswith(ERROR_HEADER) or len(data) < len(ERROR_HEADER) + 16:
+		return None
+	node, sec, frac, error = struct.unpack_from('>iIIi', data, len(ERROR_HEADER))
+	return node, (sec << 32) | frac, error
+
+
+class ErrorReport:
+	"""Collects the nodes' scheduling errors per bundle (timetag), so the
+	spread across the fleet can be checked as reports arrive"""
+
+	def __init__(self, keep=16):
+		self._keep = keep
+		self._bundles = {}			# timetag -> {node_id: error_us}
+		self.stats = {'bundles': 0, 'reports': 0, 'max_error_us': 0, 'max_spread_us': 0}
+		return
+
+	def add(self, node, tag, error):
+		"""Record a report; return the bundle's (nodes, min_error, max_error)"""
+		errors = self._bundles.get(tag)
+		if errors is None:
+			errors = self._bundles[tag] = {}
+			self.stats['bundles'] += 1
+			if len(self._bundles) > self._keep:
+				del self._bundles[min(self._bundles)]
+		errors[node] = error
+		lo, hi = min(errors.values()), max(errors.values())
+		self.stats['reports'] += 1
+		self.stats['max_error_us'] = max(self.stats['max_error_us'], abs(error))
+		self.stats['max_spread_us'] = max(self.stats['max_spread_us'], hi - lo)
+		return len(errors), lo, hi
@@ -0,0 +1,163 @@
+import collections
+import struct
+import time
+
+from oscstream import _string_end
+
+
+def osc_key(data):
+	"""(address, index) of an OSC message, the index being its first argument
+	if that is an int (the statemachine's '/path index value' convention) and
+	None otherwise; None for bundles and anything else that isn't a message"""
+	if data[0:1] != b'/':
+		return None
+	j = _string_end(data, 0)
+	if j is None:
+		return None
+	address = data[:data.index(b'\x00')]
+	index = None
+	if data[j:j+2] == b',i':
+		k = _string_end(data, j)
+		if k is not None and k + 4 <= len(data):
+			index = struct.unpack_from('>i', data, k)[0]
+	return address, index
+
+
+def path_matches(pattern, path):
+	"""Exact match, or prefix match for patterns ending in '*'"""
+	if pattern.endswith(b'*'):
+		return path.startswith(pattern[:-1])
+	return path == pattern
+
+
+class TokenBucket:
+
+	def __init__(self, rate, burst, now):
+		self._rate = rate
+		self._burst = burst
+		self._tokens = float(burst)
+		self._t = now
+		return
+
+	def _refill(self, now):
+		self._tokens = min(self._burst, self._tokens + (now - self._t) * self._rate)
+		self._t = now
+		return
+
+	def take(self, now):
+		self._refill(now)
+		if self._tokens < 1.0:
+			return False
+		self._tokens -= 1.0
+		return True
+
+	def wait(self, now):
+		"""Seconds until a token is available"""
+		self._refill(now)
+		return max(0.0, (1.0 - self._tokens) / self._rate)
+
+
+class Coalescer:
+	"""Latest-value-wins coalescing and rate shaping of device messages.
+
+	Messages are keyed by (source, address, index). Within a frame of interval
+	seconds, a newer message replaces a pending one with the same key, so a
+	chattering sensor costs the consumer one message per frame and key, sent
+	in order of first arrival when the frame ends. Paths with a rate limit
+	(messages/s per device, with a burst allowance) wait for a token, still
+	coalescing meanwhile; with no frame interval they go straight out while
+	tokens last. Priority paths, bundles and messages whose path is neither
+	coalesced nor limited bypass the coalescer entirely.
+
+	Drive it with submit() per message and poll() from the event loop, waiting
+	at most poll_interval() in between; both return the messages to send.
+	"""
+
+	def __init__(self, interval=0.0, limits=(), priority=(), clock=time.monotonic):
+		self._interval = interval
+		self._limits = [(p.encode() if isinstance(p, str) else p, rate, burst) for p, rate, burst in limits]
+		self._priority = [p.encode() if isinstance(p, str) else p for p in priority]
+		self._clock = clock
+		self._pending = collections.OrderedDict()		# key -> data
+		self._buckets = {}			# (source, address) -> TokenBucket, None if unlimited
+		self._frame_end = None
+		self.stats = {'in': 0, 'out': 0, 'bypass': 0, 'coalesced': 0}
+		return
+
+	def enabled(self):
+		return self._interval > 0 or bool(self._limits)
+
+	def _bucket(self, source, address, now):
+		key = (source, address)
+		if key not in self._buckets:
+			bucket = None
+			for pattern, rate, burst in self._limits:
+				if path_matches(pattern, address):
+					bucket = TokenBucket(rate, burst, now)
+					break
+			self._buckets[key] = bucket
+		return self._buckets[key]
+
+	def submit(self, source, data):
+		self.stats['in'] += 1
+		osc = osc_key(data)
+		if osc is None or any(path_matches(p, osc[0]) for p in self._priority):
+			self.stats['bypass'] += 1
+			return [data]
+		now = self._clock()
+		bucket = self._bucket(source, osc[0], now)
+		if bucket is None and self._interval <= 0:
+			self.stats['bypass'] += 1
+			return [data]
+
+		key = (source,) + osc
+		if key in self._pending:
+			self._pending[key] = data
+			self.stats['coalesced'] += 1
+			return []
+
+		# Unframed, rate-limited paths go straight out while tokens last
+		if self._interval <= 0 and bucket.take(now):
+			self.stats['out'] += 1
+			return [data]
+		self._pending[key] = data
+		if self._interval > 0 and self._frame_end is None:
+			self._frame_end = now + self._interval
+		return []
+
+	def poll(self):
+		"""Return the messages due now"""
+		if not self._pending:
+			return []
+		now = self._clock()
+		if self._frame_end is not None and now < self._frame_end:
+			return []
+		out = []
+		for key in list(self._pending):
+			bucket = self._buckets.get(key[:2])
+			if bucket is None or bucket.take(now):
+				out.append(self._pending.pop(key))
+		self._frame_end = now + self._interval if self._pending and self._interval > 0 else None
+		self.stats['out'] += len(out)
+		return out
+
+	def poll_interval(self, max_wait=0.05):
+		if not self._pending:
+			return max_wait
+		now = self._clock()
+		if self._frame_end is not None:
+			return min(max_wait, max(0.0, self._frame_end - now))
+		waits = [self._buckets[key[:2]].wait(now) for key in self._pending]
+		return min(max_wait, min(waits))
+
+
+def parse_limit(spec):
+	"""PATH=RATE[:BURST], e.g. '/accel=20' or '/sensor/*=50:10'"""
+	path, _, rate = spec.rpartition('=')
+	if not path.startswith('/'):
+		raise ValueError("Rate limit '%s' is not PATH=RATE[:BURST]" % spec)
+	rate, _, burst = rate.partition(':')
+	rate = float(rate)
+	if rate <= 0:
+		raise ValueError("Rate must be positive in '%s'" % spec)
+	return path, rate, float(burst) if burst else max(1.0, rate / 10.0)
@@ -30,6 +30,79 @@ function config() {
 	outlet(0, '/config');
 }
 
+// Change configuration parameters in place on devices matching the device and
+// node IDs ('*' matches any), e.g. 'config_set mykey * * IoTPort 8001'
+function config_set() {
+	send_udp(addr_broadcast, '/config/set', arrayfromargs(arguments));
+}
+
+// Query configuration parameters, e.g. 'config_get mykey gate *'
+function config_get() {
+	send_udp(addr_broadcast, '/config/get', arrayfromargs(arguments));
+}
+
+// Send an OSC message to device groups with one broadcast (via the bridge), 
+// e.g. 'group 2 /open' or 'group 2,5 /open' ('all' reaches every device), 
+// or to nodes by ID, e.g. 'group node:3,4 /open'
+function group() {
+	if (!use_tcp) {
+		post("group: requires the UDP->TCP bridge (tcp.py)\n");
+		return;
+	}
+	outlet(0, 'host', '127.0.0.1');
+	outlet(0, 'port', pyport);
+	outlet(0, '/group', arrayfromargs(arguments));
+}
+
+// Run an OSC message on device groups at the same moment, delay_ms from now
+// on the devices' synchronized clocks (one timetagged bundle, via the bridge),
+// e.g. 'at 200 all /open'
+function at() {
+	if (!use_tcp) {
+		post("at: requires the UDP->TCP bridge (tcp.py)\n");
+		return;
+	}
+	send_bridge('/at', arrayfromargs(arguments));
+}
+
+// Learn devices from the bridge's directory on load, so a Max restart needs
+// no ping (the bridge then keeps us updated as devices come and go)
+function loadbang() {
+	if (use_tcp)
+		send_bridge('/dir/subscribe', [1]);
+}
+
+// List the bridge's device directory (device, node, address, transport and
+// seconds since last seen)
+function directory() {
+	if (!use_tcp) {
+		post("directory: requires the UDP->TCP bridge (tcp.py)\n");
+		return;
+	}
+	send_bridge('/dir/list', []);
+}
+
+// Ask the bridge for the last value of every device path (e.g. after the
+// state machine reloaded), so current sensor states are known without waiting
+// for the next edge
+function resync() {
+	if (!use_tcp) {
+		post("resync: requires the UDP->TCP bridge (tcp.py)\n");
+		return;
+	}
+	send_bridge('/resync', []);
+}
+
+// List the devices the bridge is metering for flow control (address, 
+// messages/s and rate cap, 0 if not capped); requires tcp.py --flow-limit
+function flow() {
+	if (!use_tcp) {
+		post("flow: requires the UDP->TCP bridge (tcp.py)\n");
+		return;
+	}
+	send_bridge('/flow/list', []);
+}
+
 // Main message handler
 function anything() {
 	// Treat any string start with a slash as an OSC message
@@ -44,27 +117,143 @@ function anything() {
 function incoming_osc(oscpath, args) {
 
 	// Handle creation of new devices on response to /marco
-	if (oscpath == '/pong' && args.length == 3) {
+	if (oscpath == '/pong' && args.length >= 3) {
 		
-		var devID = args[0];
-		var nodeID = args[1];
-		var nodeAddr = args[2];
-
-		// Create main dict entry for this device type if not seen yet
-		if (!dev_dict.hasOwnProperty(devID)) 
-			dev_dict[devID] = {};
-
-		// Create a sub-dict entry for this node ID
-		if (!dev_dict[devID].hasOwnProperty(nodeID)) {
-			
-			dev_dict[devID][nodeID] = nodeAddr;
-
-			post("================================\n");
-			post('New device ID \'' + devID + ' ' + nodeID + '\'\n');
-			post('at address ' + nodeAddr + '\n');
-			post("================================\n");
+		add_device(args[0], args[1], args[2]);
+
+		// Tell the bridge, which only sees /pong from TCP connections
+		if (use_tcp)
+			send_bridge('/dir/seen', [args[0], args[1], args[2]]);
+	}
+
+	// Directory deltas from the bridge
+	else if ((oscpath == '/dir/add' || oscpath == '/dir/update') && args.length >= 3) {
+		add_device(args[0], args[1], args[2]);
+	}
+	else if (oscpath == '/dir/expire' && args.length >= 2) {
+		if (dev_dict.hasOwnProperty(args[0]) && dev_dict[args[0]].hasOwnProperty(args[1])) {
+			delete dev_dict[args[0]][args[1]];
+			post('Device \'' + args[0] + ' ' + args[1] + '\' expired\n');
 		}
 	}
+
+	// Reply to /dir/list
+	else if (oscpath == '/dir/entry' && args.length >= 5) {
+		post(args[0] + ' ' + args[1] + ' at ' + args[2] + ' (' + args[3] + ', seen ' + 
+			Math.round(args[4]) + ' s ago)\n');
+	}
+	else if (oscpath == '/dir/end') {
+		post(args[0] + ' devices in directory\n');
+	}
+
+	// End of the values replayed by the bridge in reply to /resync
+	else if (oscpath == '/resync/end') {
+		post('Resynced ' + args[0] + ' values\n');
+	}
+
+	// Flow control: devices report when they start and stop holding back 
+	// messages, and reply to /flow/status; the bridge replies to /flow/list
+	else if (oscpath == '/flow/throttle' && args.length >= 4) {
+		post('Node ' + args[0] + (args[1] ? ' throttled' : ' unthrottled') + ' (' + 
+			args[2] + ' held back, ' + args[3] + ' coalesced)\n');
+	}
+	else if (oscpath == '/flow/status' && args.length >= 11) {
+		post('Node ' + args[0] + ' flow ' + args[1] + ': ' + args[2] + ' credits, ' + 
+			args[3] + '/s, ' + args[6] + ' sent, ' + args[7] + ' held back, ' + 
+			args[8] + ' dropped, ' + args[9] + ' coalesced, ' + args[10] + ' throttles\n');
+	}
+	else if (oscpath == '/flow/entry' && args.length >= 3) {
+		post(args[0] + ': ' + args[1] + '/s' + (args[2] > 0 ? ', capped at ' + args[2] + '/s' : '') + '\n');
+	}
+	else if (oscpath == '/flow/end') {
+		post(args[0] + ' devices metered\n');
+	}
+
+	// Loop profiler: devices report the longest stall yet per call site, and 
+	// reply to /profile/stats
+	else if (oscpath == '/profile/stall' && args.length >= 4) {
+		post('Node ' + args[0] + ' stalled ' + (args[2] / 1000).toFixed(1) + ' ms in ' + 
+			args[1] + ' (' + args[3] + ' stalls)\n');
+	}
+	else if (oscpath == '/profile/stats' && args.length >= 6) {
+		post('Node ' + args[0] + ' profile' + (args[1] ? '' : ' (stopped)') + ': ' + args[2] + 
+			' iterations, ' + args[3] + ' stalls >= ' + args[5] / 1000 + ' ms, longest ' + 
+			(args[4] / 1000).toFixed(1) + ' ms\n');
+	}
+	else if (oscpath == '/profile/hist' && args.length >= 2) {
+		post('Node ' + args[0] + ' loop times (128 us, 256 us, ...): ' + args.slice(1).join(' ') + '\n');
+	}
+	else if (oscpath == '/profile/site' && args.length >= 6) {
+		post('Node ' + args[0] + ' ' + args[1] + ': ' + args[2] + ' calls, ' + args[3] + 
+			' stalls, ' + args[5] + ' ms stalled, longest ' + (args[4] / 1000).toFixed(1) + ' ms\n');
+	}
+
+	// Packet and error counts per transport (udp, tcp, wired)
+	else if (oscpath == '/transport/stats' && args.length >= 9) {
+		post('Node ' + args[0] + ' ' + args[1] + (args[2] ? '' : ' (down)') + ': ' + args[3] + ' sent (' + 
+			args[4] + ' bytes), ' + args[5] + ' failed, ' + args[6] + ' received (' + args[7] + 
+			' bytes), ' + args[8] + ' errors\n');
+	}
+
+	// Link measurements and where events went (score -1: unusable)
+	else if (oscpath == '/link/stats' && args.length >= 12) {
+		post('Node ' + args[0] + ' ' + args[1] + (args[2] ? ' (events)' : '') + ': score ' + args[3] + 
+			' us, srtt ' + args[4] + ' us, tail ' + args[5] + ' us, loss ' + (args[6] / 10).toFixed(1) + 
+			'%, queue ' + args[7] + ' ms, ' + args[8] + ' probes (' + args[9] + ' lost), ' + args[10] + 
+			' events, ' + args[11] + ' switches\n');
+	}
+
+	// Battery nodes: wake reason, wake-to-send time (this wake, worst) and 
+	// awake time (previous wake)
+	else if (oscpath == '/sleep/stats' && args.length >= 10) {
+		post('Node ' + args[0] + ' woke (' + args[1] + '): sent at ' + (args[6] / 1000).toFixed(1) + 
+			' ms (max ' + (args[7] / 1000).toFixed(1) + ' ms), awake ' + args[8] + ' ms; ' + args[2] + 
+			' wakes, ' + args[3] + ' cold, ' + args[4] + ' fallbacks, ' + args[5] + ' over budget\n');
+	}
+
+	// Actuator channels: mode, current value and how many commands were 
+	// coalesced away
+	else if (oscpath == '/act/stats' && args.length >= 7) {
+		post('Node ' + args[0] + ' actuator ' + args[1] + ' (' + args[2] + '): ' + args[3] + ', ' + 
+			args[4] + ' commands, ' + args[5] + ' applied, ' + args[6] + ' coalesced\n');
+	}
+
+	// Scheduled bundles: devices report how far from its timetag each ran, 
+	// and reply to /clock/stats
+	else if (oscpath == '/clock/error' && args.length >= 4) {
+		post('Node ' + args[0] + ' ran bundle ' + (args[3] >= 0 ? '+' : '') + args[3] + ' us from its time\n');
+	}
+	else if (oscpath == '/clock/stats' && args.length >= 14) {
+		post('Node ' + args[0] + ' clock' + (args[1] ? '' : ' (unsynced)') + ': rtt ' + args[2] + 
+			' us, skew ' + args[3].toFixed(1) + ' ppm, ' + args[4] + ' samples; ' + args[8] + 
+			' bundles run, ' + args[9] + ' late, ' + args[10] + ' dropped, max error ' + args[13] + ' us\n');
+	}
+
+	// Reply to /config/get: device ID, node ID, then name/value pairs
+	else if (oscpath == '/config/value' && args.length >= 2) {
+		var line = 'Config \'' + args[0] + ' ' + args[1] + '\':';
+		for (var i = 2; i + 1 < args.length; i += 2)
+			line += ' ' + args[i] + '=' + args[i+1];
+		post(line + '\n');
+	}
+}
+
+// Add or move a device in dev_dict
+function add_device(devID, nodeID, nodeAddr) {
+
+	// Create main dict entry for this device type if not seen yet
+	if (!dev_dict.hasOwnProperty(devID)) 
+		dev_dict[devID] = {};
+
+	// Create a sub-dict entry for this node ID
+	if (!dev_dict[devID].hasOwnProperty(nodeID)) {
+
+		post("================================\n");
+		post('New device ID \'' + devID + ' ' + nodeID + '\'\n');
+		post('at address ' + nodeAddr + '\n');
+		post("================================\n");
+	}
+	dev_dict[devID][nodeID] = nodeAddr;
 }
 
 function osc_to_device(devID, args) {
@@ -118,6 +307,13 @@ function send_udp(addr, path, args) {
 	outlet(0, path, args)
 }
 
+// Send to the UDP->TCP bridge itself
+function send_bridge(path, args) {
+	outlet(0, 'host', '127.0.0.1');
+	outlet(0, 'port', pyport);
+	outlet(0, path, args);
+}
+
 // Send TCP (actually sent to udp-tcp-bridge.py via UDP, which relays the
 // message to the IoT device via reliable TCP connection)
 function send_tcp(addr, path, args) {
@@ -0,0 +1,194 @@
+import json
+import os
+import threading
+import time
+
+
+class DeviceEntry:
+
+	__slots__ = ('dev_id', 'node_id', 'addr', 'transport', 'last_seen')
+
+	def __init__(self, dev_id, node_id, addr, transport, last_seen):
+		self.dev_id = dev_id
+		self.node_id = node_id
+		self.addr = addr
+		self.transport = transport		# 'tcp' or 'serial' while connected, else 'udp'
+		self.last_seen = last_seen
+		return
+
+	def key(self):
+		return (self.dev_id, self.node_id)
+
+	def row(self):
+		return [self.dev_id, self.node_id, self.addr, self.transport, round(self.last_seen, 1)]
+
+
+class DeviceDirectory:
+	"""Devices known to the bridge, indexed by (device ID, node ID) and by
+	address, with lease expiry.
+
+	Devices are added or refreshed by observe() (a /pong) and refreshed by
+	touch() (any traffic from a known address). A device not seen for the
+	lease period is expired. Changes are reported to subscribers as
+	(kind, entry) deltas, kind being 'add', 'update' or 'expire'. The
+	directory is saved to a snapshot file at most every save_interval
+	seconds, so a restarted bridge knows its devices without a ping.
+
+	Methods are thread-safe; subscribers are called with the lock released.
+	"""
+
+	VERSION = 1
+
+	def __init__(self, lease=600.0, path=None, save_interval=10.0, clock=time.time):
+		self._lease = lease
+		self._path = path
+		self._save_interval = save_interval
+		self._clock = clock
+		self._lock = threading.Lock()
+		self._entries = {}			# (dev_id, node_id) -> DeviceEntry
+		self._by_addr = {}			# addr -> (dev_id, node_id)
+		self._subscribers = []
+		self._dirty = False
+		self._last_save = 0.0
+		return
+
+	def subscribe(self, handler):
+		with self._lock:
+			self._subscribers.append(handler)
+		return
+
+	def unsubscribe(self, handler):
+		with self._lock:
+			if handler in self._subscribers:
+				self._subscribers.remove(handler)
+		return
+
+	def __len__(self):
+		return len(self._entries)
+
+	def entries(self):
+		with self._lock:
+			return sorted(self._entries.values(), key=lambda e: (str(e.dev_id), e.node_id))
+
+	def lookup(self, dev_id, node_id):
+		return self._entries.get((dev_id, node_id))
+
+	def age(self, entry):
+		return self._clock() - entry.last_seen
+
+	def by_addr(self, addr):
+		key = self._by_addr.get(addr)
+		return self._entries.get(key) if key else None
+
+	def observe(self, dev_id, node_id, addr, transport):
+		"""Record a device announcing itself; return the delta kind, or None
+		if nothing but the lease changed"""
+		now = self._clock()
+		with self._lock:
+			key = (dev_id, node_id)
+			entry = self._entries.get(key)
+			if entry is None:
+				kind = 'add'
+				entry = DeviceEntry(dev_id, node_id, addr, transport, now)
+				self._entries[key] = entry
+			else:
+				kind = None
+				if entry.addr != addr or entry.transport != transport:
+					kind = 'update'
+					if self._by_addr.get(entry.addr) == key:
+						del self._by_addr[entry.addr]
+				entry.addr, entry.transport, entry.last_seen = addr, transport, now
+
+			# An address belongs to one device; a node that changed its IDs
+			# replaces its old entry
+			old = self._by_addr.get(addr)
+			stale = self._entries.pop(old, None) if old and old != key else None
+			self._by_addr[addr] = key
+			self._dirty = True
+		if stale:
+			self._notify('expire', stale)
+		if kind:
+			self._notify(kind, entry)
+		return kind
+
+	def touch(self, addr, transport=None):
+		"""Refresh the lease of the device at addr; return its entry"""
+		with self._lock:
+			entry = self.by_addr(addr)
+			if entry is None:
+				return None
+			entry.last_seen = self._clock()
+			self._dirty = True
+			changed = transport is not None and entry.transport != transport
+			if changed:
+				entry.transport = transport
+		if changed:
+			self._notify('update', entry)
+		return entry
+
+	def expire(self):
+		"""Drop devices whose lease ran out; return the expired entries"""
+		now = self._clock()
+		with self._lock:
+			expired = [e for e in self._entries.values() if now - e.last_seen > self._lease]
+			for e in expired:
+				del self._entries[e.key()]
+				if self._by_addr.get(e.addr) == e.key():
+					del self._by_addr[e.addr]
+			if expired:
+				self._dirty = True
+		for e in expired:
+			self._notify('expire', e)
+		return expired
+
+	def tick(self):
+		"""Expire leases and save the snapshot if due; call periodically"""
+		self.expire()
+		if self._path and self._dirty and self._clock() - self._last_save >= self._save_interval:
+			self.save()
+		return
+
+	def save(self, path=None):
+		"""Write the snapshot atomically (write, then rename)"""
+		path = path or self._path
+		with self._lock:
+			snapshot = {'v': DeviceDirectory.VERSION, 'lease': self._lease,
+				'devices': [e.row() for e in self._entries.values()]}
+			self._dirty = False
+			self._last_save = self._clock()
+		tmp = path + '.tmp'
+		with open(tmp, 'w') as f:
+			json.dump(snapshot, f, separators=(',', ':'))
+		os.replace(tmp, path)
+		return
+
+	def load(self, path=None):
+		"""Load a snapshot, skipping leases that ran out while the bridge was
+		down; return the number of devices loaded"""
+		path = path or self._path
+		try:
+			with open(path) as f:
+				snapshot = json.load(f)
+		except (OSError, ValueError):
+			return 0
+		if snapshot.get('v') != DeviceDirectory.VERSION:
+			return 0
+		now = self._clock()
+		with self._lock:
+			for dev_id, node_id, addr, transport, last_seen in snapshot.get('devices', []):
+				if now - last_seen > self._lease:
+					continue
+				# Connections did not survive the restart
+				entry = DeviceEntry(dev_id, node_id, addr, 'udp', last_seen)
+				self._entries[entry.key()] = entry
+				self._by_addr[addr] = entry.key()
+			self._last_save = now
+		return len(self._entries)
+
+	def _notify(self, kind, entry):
+		# (Handlers run outside the lock; they may call back in)
+		with self._lock:
+			handlers = list(self._subscribers)
+		for handler in handlers:
+			handler(kind, entry)
+		return
@@ -0,0 +1,123 @@
+import threading
+import time
+
+
+def fair_share(rates, limit):
+	"""Max-min fair share of limit among senders with these rates, or None if
+	they all fit: senders under the share keep their rate, the rest are capped
+	at the share"""
+	remaining, n = float(limit), len(rates)
+	for i, rate in enumerate(sorted(rates)):
+		share = remaining / (n - i)
+		if rate > share:
+			return share
+		remaining -= rate
+	return None
+
+
+class FlowManager:
+	"""Automatic flow control of devices (libiot FlowControl).
+
+	Counts the messages each device sends and, once every interval, compares
+	their total rate with what the consumer can take (limit, messages/s). When
+	over the limit, devices sending more than their max-min fair share are
+	capped at it with '/flow rate <cap> <burst> <ttl_ms>'. Once the total drops
+	below low_water * limit, caps grow by the increase factor each interval,
+	and are lifted ('/flow open') when they reach the limit. Caps are renewed
+	before their TTL runs out, while the device keeps sending (a device that
+	goes quiet lets its cap lapse).
+
+	send(source, args) delivers a /flow message with the given arguments.
+	count() and tick() run on the bridge's network thread, and rows() on the
+	OSC server's; a lock guards the tables, and /flow messages go out after
+	it is released.
+	"""
+
+	def __init__(self, limit, send, interval=1.0, ttl=5.0, low_water=0.8, increase=1.5,
+		clock=time.monotonic):
+		self._limit = float(limit)
+		self._send = send
+		self._interval = interval
+		self._ttl = ttl
+		self._low_water = low_water
+		self._increase = increase
+		self._clock = clock
+		self._lock = threading.Lock()
+		self._t = clock()
+		self._counts = {}			# source -> messages this interval
+		self._rates = {}			# source -> messages/s last interval
+		self._caps = {}				# source -> [cap, time sent]
+		self.stats = {'throttles': 0, 'releases': 0, 'renewals': 0}
+		return
+
+	def count(self, source):
+		with self._lock:
+			self._counts[source] = self._counts.get(source, 0) + 1
+		return
+
+	def caps(self):
+		with self._lock:
+			return dict((s, c[0]) for s, c in self._caps.items())
+
+	def rows(self):
+		"""[source, rate, cap or 0] per device seen in the last interval or capped"""
+		with self._lock:
+			sources = sorted(set(self._rates) | set(self._caps))
+			return [[s, round(self._rates.get(s, 0.0), 1), round(self._caps[s][0], 1) if s in self._caps else 0.0]
+				for s in sources]
+
+	def tick(self):
+		"""Re-evaluate caps if the interval has passed; call periodically"""
+		with self._lock:
+			sends = self._evaluate()
+		for source, args in sends:
+			self._send(source, args)
+		return
+
+	def _evaluate(self):
+		"""The /flow messages (source, args) to send for this tick"""
+		sends = []
+		now = self._clock()
+		elapsed = now - self._t
+		if elapsed < self._interval:
+			return sends
+		self._t = now
+		self._rates = dict((s, n / elapsed) for s, n in self._counts.items())
+		self._counts = {}
+		total = sum(self._rates.values())
+
+		if total > self._limit:
+			share = fair_share(list(self._rates.values()), self._limit)
+			for source, rate in self._rates.items():
+				cap = self._caps.get(source)
+				if rate >= share and (cap is None or cap[0] > share):
+					self._set_cap(source, share, now, sends)
+		elif total < self._low_water * self._limit:
+			for source, cap in list(self._caps.items()):
+				if cap[0] * self._increase >= self._limit:
+					del self._caps[source]
+					self.stats['releases'] += 1
+					print("Flow: %s open" % source)
+					sends.append((source, ['open']))
+				else:
+					self._set_cap(source, cap[0] * self._increase, now, sends)
+
+		# Renew caps of devices still sending
+		for source, cap in self._caps.items():
+			if source in self._rates and now - cap[1] >= self._ttl / 2:
+				self.stats['renewals'] += 1
+				self._send_cap(source, cap, now, sends)
+		return sends
+
+	def _set_cap(self, source, rate, now, sends):
+		if source not in self._caps:
+			self.stats['throttles'] += 1
+		cap = self._caps[source] = [rate, now]
+		print("Flow: %s capped at %.1f/s" % (source, rate))
+		self._send_cap(source, cap, now, sends)
+		return
+
+	def _send_cap(self, source, cap, now, sends):
+		cap[1] = now
+		sends.append((source, ['rate', float(cap[0]), float(max(1.0, cap[0] / 2)), int(self._ttl * 1000)]))
+		return
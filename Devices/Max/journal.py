@@ -0,0 +1,119 @@
+import struct
+
+# Device event journal (libiot EventJournal): each event travels as
+#
+#	/ev ,iiib <epoch> <seq> <age_ms> <OSC message>
+#
+# alone or several to a bundle, and is acknowledged cumulatively with
+#
+#	/ev/ack ,ii <epoch> <seq>
+#
+# The epoch changes whenever the device restarts its journal (a reboot), and
+# seq counts events within it.
+
+EVENT_HEADER = b'/ev\x00,iiib\x00\x00\x00'
+ACK_HEADER = b'/ev/ack\x00,ii\x00'
+BUNDLE_TAG = b'#bundle\x00'
+
+
+def parse_event(data):
+	"""(epoch, seq, age_ms, message) of an /ev message, or None"""
+	if not data.startswith(EVENT_HEADER) or len(data) < 28:
+		return None
+	epoch, seq, age, n = struct.unpack_from('>IIII', data, 12)
+	if 28 + n > len(data):
+		return None
+	return epoch, seq, age, data[28:28 + n]
+
+
+def bundle_elements(data):
+	"""The elements of an OSC bundle, or None if it is malformed"""
+	elements, i = [], 16
+	while i < len(data):
+		if i + 4 > len(data):
+			return None
+		n = struct.unpack_from('>i', data, i)[0]
+		if n <= 0 or i + 4 + n > len(data):
+			return None
+		elements.append(data[i + 4:i + 4 + n])
+		i += 4 + n
+	return elements
+
+
+def make_event(epoch, seq, age_ms, message):
+	"""The /ev message a device journals message as"""
+	blob = message + b'\0' * (-len(message) % 4)
+	return EVENT_HEADER + struct.pack('>IIII', epoch, seq, age_ms, len(message)) + blob
+
+
+def make_ack(epoch, seq):
+	return ACK_HEADER + struct.pack('>II', epoch, seq)
+
+
+class JournalReceiver:
+	"""Unwraps journaled events from devices, dropping the ones already
+	delivered (a device resends everything unacknowledged when it reconnects),
+	and builds the acknowledgements.
+
+	unwrap(source, data) returns the OSC messages to deliver and the /ev/ack
+	to send back to the device, or None; anything that isn't journal traffic
+	is returned as is. With copy set, data is a copy of a journaled event
+	that the device also sent over UDP, which may overtake the journal's own
+	stream: it is delivered if it is new, and never acknowledged.
+	"""
+
+	def __init__(self):
+		self._last = {}				# source -> (epoch, last seq delivered)
+		self._ahead = {}			# source -> seqs past it delivered by copies
+		self.stats = {'events': 0, 'duplicates': 0, 'lost': 0, 'max_age_ms': 0}
+		return
+
+	def unwrap(self, source, data, copy=False):
+		if data.startswith(EVENT_HEADER):
+			events = [data]
+		elif data.startswith(BUNDLE_TAG):
+			events = bundle_elements(data)
+			if not events or not all(e.startswith(EVENT_HEADER) for e in events):
+				return [data], None
+		else:
+			return [data], None
+
+		packets, ack = [], None
+		for element in events:
+			event = parse_event(element)
+			if event is None:
+				print("Malformed journal event from %s" % source)
+				continue
+			epoch, seq, age, message = event
+			last_epoch, last = self._last.get(source, (None, 0))
+			ahead = self._ahead.setdefault(source, set())
+			if epoch != last_epoch:
+				last = 0
+				ahead.clear()
+				self._last[source] = (epoch, 0)
+			if seq <= last or (copy and seq in ahead):
+				self.stats['duplicates'] += 1
+				if not copy:
+					ack = (epoch, last)
+				continue
+
+			if copy:
+				ahead.add(seq)
+			else:
+				# Dropped or expired on the device while the link was down
+				# (unless a copy got through)
+				passed = set(s for s in ahead if s <= seq)
+				ahead -= passed
+				missing = seq - last - 1 - len(passed - {seq})
+				if last and missing:
+					self.stats['lost'] += missing
+					print("Journal: %s lost %d events" % (source, missing))
+				self._last[source] = (epoch, seq)
+				ack = (epoch, seq)
+				if seq in passed:
+					self.stats['duplicates'] += 1
+					continue
+			self.stats['events'] += 1
+			self.stats['max_age_ms'] = max(self.stats['max_age_ms'], age)
+			packets.append(message)
+		return packets, make_ack(*ack) if ack else None
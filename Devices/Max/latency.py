@@ -0,0 +1,410 @@
+import argparse
+import json
+import os
+import random
+import socket
+import struct
+import subprocess
+import sys
+import threading
+import time
+
+import intern
+import linkprobe
+from journal import ACK_HEADER, make_event
+from netsim import percentiles
+from oscstream import KEEPALIVE, OSCStream, frame
+
+# /gate <node_id> <state> <seq>: the firmware's /gate message plus a sequence
+# number (the bridge forwards packets unchanged) to match edges at the sink
+GATE_PREFIX = b'/gate\0\0\0,iii\0\0\0\0'
+GATE_LENGTH = len(GATE_PREFIX) + 12
+
+INTERN_HEADER = b'/intern\0,i\0\0'
+
+
+def gate_packet(node_id, state, seq):
+	return GATE_PREFIX + struct.pack('>iii', node_id, state, seq)
+
+
+def pong_packet(node_id, addr, intern_version=None):
+	"""/pong gate <node_id> <addr> [<intern_version>]"""
+	addr = addr.encode() + b'\0'
+	addr += b'\0' * (-len(addr) % 4)
+	if intern_version is None:
+		return b'/pong\0\0\0,sis\0\0\0\0' + b'gate\0\0\0\0' + struct.pack('>i', node_id) + addr
+	return (b'/pong\0\0\0,sisi\0\0\0' + b'gate\0\0\0\0' + struct.pack('>i', node_id) + addr +
+		struct.pack('>i', intern_version))
+
+
+def free_port(kind=socket.SOCK_STREAM):
+	s = socket.socket(socket.AF_INET, kind)
+	s.bind(('127.0.0.1', 0))
+	port = s.getsockname()[1]
+	s.close()
+	return port
+
+
+class Sink:
+	"""Stub UDP consumer standing in for Max's [udpreceive]"""
+
+	def __init__(self, port):
+		self._sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+		self._sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1 << 20)
+		self._sock.bind(('127.0.0.1', port))
+		self._sock.settimeout(0.1)
+		self._running = True
+		self.arrivals = {}			# seq -> arrival time
+		self.duplicates = 0
+		self._thread = threading.Thread(target=self._run, daemon=True)
+		self._thread.start()
+		return
+
+	def _run(self):
+		while self._running:
+			try:
+				data = self._sock.recv(2048)
+			except socket.timeout:
+				continue
+			t = time.perf_counter()
+			if len(data) == GATE_LENGTH and data.startswith(GATE_PREFIX):
+				seq = struct.unpack('>i', data[-4:])[0]
+				if seq in self.arrivals:
+					self.duplicates += 1
+				else:
+					self.arrivals[seq] = t
+		return
+
+	def close(self):
+		self._running = False
+		self._thread.join()
+		self._sock.close()
+		return
+
+
+class SimGate:
+	"""Gate node speaking the firmware's wire protocol: connect, /pong (offering
+	interning), then each sensor edge journaled (journal.py) and sent over TCP
+	as /ev <epoch> <seq> <age_ms> <message>, and /ka when idle. Events stay in
+	the journal until the bridge acknowledges them, and everything unacked is
+	resent after a reconnect (with backoff, as TCPClient::set_reconnect()).
+	With copies, each edge also goes as the same /ev over UDP to the bridge's
+	probe port once /link/port has announced it, as while the link monitor
+	prefers UDP.
+
+	The bridge knows devices by address, so each node connects from its own
+	loopback address (127.0.0.<node_id + 1>; Linux routes all of 127/8).
+	"""
+
+	BACKOFF = (0.25, 8.0)		# The gate example's reconnect backoff (s)
+
+	def __init__(self, node_id, bridge_port, sink_port, keepalive=1.0, copies=False):
+		self.node_id = node_id
+		self.addr = '127.0.0.%d' % (node_id + 1)
+		self._bridge = ('127.0.0.1', bridge_port)
+		self._udp = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+		self._udp.bind((self.addr, 0))
+		self._keepalive = keepalive
+		self._copies = copies
+		self._rng = random.Random(node_id)
+		self._state = 0
+		self._epoch = self._rng.getrandbits(31)
+		self._seq = 1
+		self._journal = []			# (seq, time recorded, message), oldest first
+		self._stream = OSCStream()
+		self._interning = False
+		self._probe = None
+		self._tcp = None
+		self._backoff = self.BACKOFF[0]
+		self._t_reconnect = 0.0
+		self._last_tx = time.perf_counter()
+		self.held = 0				# Edges journaled while disconnected
+		self.resent = 0
+		self.reconnects = 0
+		self.connect()
+		return
+
+	def connect(self):
+		try:
+			self._tcp = socket.create_connection(self._bridge, timeout=1.0, source_address=(self.addr, 0))
+		except OSError:
+			self._schedule_reconnect()
+			return False
+		self._tcp.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+		self._tcp.setblocking(False)
+		self._stream = OSCStream()
+		self._interning = False		# Until the bridge answers /intern
+		self._backoff = self.BACKOFF[0]
+		self._send_tcp(pong_packet(self.node_id, self.addr, intern.VERSION))
+
+		# Resend everything unacknowledged, after the /pong
+		now = time.perf_counter()
+		for seq, t, message in self._journal:
+			self.resent += 1
+			self._send_tcp(make_event(self._epoch, seq, int((now - t) * 1e3), message))
+		return True
+
+	def _schedule_reconnect(self):
+		# "Equal jitter": between half and all of the current backoff
+		self._t_reconnect = time.perf_counter() + self._backoff / 2 + self._rng.uniform(0, self._backoff / 2)
+		self._backoff = min(2 * self._backoff, self.BACKOFF[1])
+		return
+
+	def _closed(self):
+		self._tcp.close()
+		self._tcp = None
+		self._schedule_reconnect()
+		return
+
+	def _send_tcp(self, data):
+		if self._tcp is None:
+			return False
+		try:
+			self._tcp.sendall(frame(data))
+		except (BlockingIOError, OSError):
+			self._closed()
+			return False
+		self._last_tx = time.perf_counter()
+		return True
+
+	def edge(self, seq):
+		self._state ^= 1
+		message = gate_packet(self.node_id, self._state, seq)
+		if self._interning:
+			message = intern.encode(message)
+		event = make_event(self._epoch, self._seq, 0, message)
+		self._journal.append((self._seq, time.perf_counter(), message))
+		self._seq += 1
+		if self._copies and self._probe:
+			self._udp.sendto(event, self._probe)
+		if not self._send_tcp(event):
+			self.held += 1
+		return
+
+	def handle_packet(self, data):
+		data = intern.decode(data)
+		if data is None:
+			return
+		if data.startswith(ACK_HEADER):
+			epoch, seq = struct.unpack_from('>II', data, len(ACK_HEADER))
+			if epoch == self._epoch:
+				while self._journal and self._journal[0][0] <= seq:
+					self._journal.pop(0)
+		elif data.startswith(INTERN_HEADER):
+			self._interning = struct.unpack_from('>i', data, len(INTERN_HEADER))[0] == intern.VERSION
+		elif data.startswith(linkprobe.PORT_HEADER):
+			self._probe = ('127.0.0.1', struct.unpack_from('>i', data, len(linkprobe.PORT_HEADER))[0])
+		return
+
+	def poll(self, now):
+		# Reconnect when due; take acknowledgements and the like; send a
+		# keepalive when idle
+		if self._tcp is None:
+			if now >= self._t_reconnect:
+				self.reconnects += 1
+				self.connect()
+			return
+		try:
+			while True:
+				data = self._tcp.recv(4096)
+				if not data:
+					self._closed()
+					return
+				for packet in self._stream.feed(data):
+					self.handle_packet(packet)
+		except BlockingIOError:
+			pass
+		except OSError:
+			self._closed()
+			return
+		if self._keepalive and now - self._last_tx > self._keepalive:
+			self._send_tcp(KEEPALIVE)
+		return
+
+	def unacked(self):
+		return len(self._journal)
+
+	def close(self):
+		if self._tcp:
+			self._tcp.close()
+		self._udp.close()
+		return
+
+
+class Harness:
+	"""Runs the real bridge (tcp.py) between simulated gate nodes and a stub
+	consumer, and measures edge-to-consumer latency at controlled rates"""
+
+	def __init__(self, args):
+		self._args = args
+		self._rng = random.Random(args.seed)
+		self.iot_port = free_port()
+		self.local_port = free_port(socket.SOCK_DGRAM)
+		return
+
+	def start_bridge(self):
+		here = os.path.dirname(os.path.abspath(__file__))
+		cmd = [sys.executable, os.path.join(here, 'tcp.py'), str(self.iot_port), str(self.local_port)]
+		if self._args.impair:
+			cmd += ['--impair', self._args.impair]
+		self._bridge = subprocess.Popen(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+
+		# Ready once it accepts connections
+		deadline = time.monotonic() + 10.0
+		while time.monotonic() < deadline:
+			if self._bridge.poll() is not None:
+				raise RuntimeError("Bridge exited: %s" % self._bridge.stderr.read().decode())
+			try:
+				socket.create_connection(('127.0.0.1', self.iot_port), timeout=0.5).close()
+				return
+			except OSError:
+				time.sleep(0.1)
+		raise RuntimeError("Bridge did not start")
+
+	def stop_bridge(self):
+		self._bridge.terminate()
+		self._bridge.wait()
+		return
+
+	def run_stage(self, rate, nodes, sink, seq0):
+		"""Poisson edges at rate (total edges/s) spread over the nodes"""
+		a = self._args
+		sent = {}
+		t_start = time.perf_counter()
+		t_end = t_start + a.duration
+		t_next = t_start + self._rng.expovariate(rate)
+		seq = seq0
+		while True:
+			now = time.perf_counter()
+			if now >= t_end:
+				break
+			if now >= t_next:
+				node = nodes[self._rng.randrange(len(nodes))]
+				sent[seq] = time.perf_counter()
+				node.edge(seq)
+				seq += 1
+				t_next += self._rng.expovariate(rate)
+				continue
+			for node in nodes:
+				node.poll(now)
+			time.sleep(min(max(0.0, t_next - time.perf_counter()), 0.001))
+
+		# Late arrivals count until the drain timeout
+		deadline = time.perf_counter() + a.drain
+		while time.perf_counter() < deadline and any(s not in sink.arrivals for s in sent):
+			for node in nodes:
+				node.poll(time.perf_counter())
+			time.sleep(0.01)
+
+		latency = [sink.arrivals[s] - t for s, t in sent.items() if s in sink.arrivals]
+		delivered = len(latency)
+		pct = percentiles(latency)
+		return {
+			'rate': rate,
+			'sent': len(sent),
+			'delivered': delivered,
+			'loss': 1.0 - delivered / float(len(sent)) if sent else 0.0,
+			'throughput': delivered / a.duration,
+			'latency_ms': dict(('p%g' % p, v * 1e3) for p, v in pct.items()),
+			'latency_max_ms': max(latency) * 1e3 if latency else float('nan'),
+		}, seq
+
+	def run(self):
+		a = self._args
+		self.start_bridge()
+		sink = Sink(self.iot_port)
+		nodes = [SimGate(i + 1, self.iot_port, self.iot_port, a.keepalive, a.copies) for i in range(a.nodes)]
+		try:
+			time.sleep(a.warmup)
+			stages, seq = [], 0
+			for rate in a.rates:
+				stage, seq = self.run_stage(rate, nodes, sink, seq)
+				stages.append(stage)
+		finally:
+			for node in nodes:
+				node.close()
+			sink.close()
+			self.stop_bridge()
+		return {'nodes': a.nodes, 'duration': a.duration, 'stages': stages,
+			'held': sum(n.held for n in nodes), 'resent': sum(n.resent for n in nodes),
+			'reconnects': sum(n.reconnects for n in nodes), 'unacked': sum(n.unacked() for n in nodes),
+			'duplicates': sink.duplicates}
+
+
+def check(report, args, baseline=None):
+	"""Return a list of threshold violations"""
+	failures = []
+	base = dict((s['rate'], s) for s in baseline['stages']) if baseline else {}
+	for s in report['stages']:
+		p99 = s['latency_ms']['p99']
+		if args.max_p99 is not None and not p99 <= args.max_p99:
+			failures.append("%g/s: p99 %.2f ms > %.2f ms" % (s['rate'], p99, args.max_p99))
+		if s['loss'] > args.max_loss:
+			failures.append("%g/s: loss %.3f%% > %.3f%%" % (s['rate'], 100 * s['loss'], 100 * args.max_loss))
+		b = base.get(s['rate'])
+		if b:
+			limit = b['latency_ms']['p99'] * (1.0 + args.tolerance) + args.slack
+			if not p99 <= limit:
+				failures.append("%g/s: p99 %.2f ms regressed from %.2f ms (limit %.2f ms)" %
+					(s['rate'], p99, b['latency_ms']['p99'], limit))
+			floor = b['throughput'] * (1.0 - args.tolerance)
+			if s['throughput'] < floor:
+				failures.append("%g/s: throughput %.1f/s regressed from %.1f/s" %
+					(s['rate'], s['throughput'], b['throughput']))
+	return failures
+
+
+def print_report(r):
+	print("%d nodes, %g s per stage, %d reconnects, %d duplicates" %
+		(r['nodes'], r['duration'], r['reconnects'], r['duplicates']))
+	print("Journal: %d edges held while disconnected, %d resent, %d unacknowledged at the end" %
+		(r['held'], r['resent'], r['unacked']))
+	print("%9s %8s %8s %8s %10s %8s %8s %8s %8s" %
+		('rate/s', 'sent', 'deliv', 'loss%', 'thru/s', 'p50', 'p90', 'p99', 'max'))
+	for s in r['stages']:
+		l = s['latency_ms']
+		print("%9g %8d %8d %8.3f %10.1f %8.2f %8.2f %8.2f %8.2f" %
+			(s['rate'], s['sent'], s['delivered'], 100 * s['loss'], s['throughput'],
+			l['p50'], l['p90'], l['p99'], s['latency_max_ms']))
+	return
+
+
+if __name__ == "__main__":
+
+	parser = argparse.ArgumentParser(description='End-to-end latency regression test: simulated gate nodes -> tcp.py -> stub consumer')
+	parser.add_argument('--nodes', type=int, default=8, help='Simulated gate nodes (TCP connections, at most 253)')
+	parser.add_argument('--rates', default='50,200,1000', help='Comma-separated total edge rates (edges/s), one stage each')
+	parser.add_argument('--duration', type=float, default=5.0, help='Seconds per stage')
+	parser.add_argument('--warmup', type=float, default=0.5, help='Seconds between connecting and the first edge')
+	parser.add_argument('--drain', type=float, default=2.0, help='Seconds to wait for late arrivals after each stage')
+	parser.add_argument('--keepalive', type=float, default=1.0, help='Node keepalive interval (s), 0 to disable')
+	parser.add_argument('--copies', action='store_true', help="Also send each edge's /ev over UDP to the bridge's probe port")
+	parser.add_argument('--impair', metavar='PROFILE', help='Run the bridge with this link profile (see netsim.py)')
+	parser.add_argument('--max-p99', type=float, help='Fail if any stage p99 exceeds this many ms')
+	parser.add_argument('--max-loss', type=float, default=0.0, help='Fail if any stage loses more than this fraction')
+	parser.add_argument('--baseline', metavar='FILE', help='Fail on regressions against this saved report')
+	parser.add_argument('--tolerance', type=float, default=0.25, help='Allowed relative regression against the baseline')
+	parser.add_argument('--slack', type=float, default=1.0, help='Allowed absolute p99 regression (ms) against the baseline')
+	parser.add_argument('--save', metavar='FILE', help='Save the report (e.g. as a new baseline)')
+	parser.add_argument('--seed', type=int, default=1)
+	parser.add_argument('--json', action='store_true', help='Print the report as JSON')
+	args = parser.parse_args()
+	args.rates = [float(r) for r in args.rates.split(',')]
+
+	report = Harness(args).run()
+	if args.json:
+		print(json.dumps(report, indent=2))
+	else:
+		print_report(report)
+	if args.save:
+		with open(args.save, 'w') as f:
+			json.dump(report, f, indent=2)
+
+	baseline = None
+	if args.baseline:
+		with open(args.baseline) as f:
+			baseline = json.load(f)
+	failures = check(report, args, baseline)
+	for failure in failures:
+		print("FAIL: " + failure)
+	sys.exit(1 if failures else 0)
@@ -0,0 +1,23 @@
+import struct
+
+# Link probes (libiot LinkMonitor). Devices measure each link to the bridge
+# with
+#
+#	/link/probe ,ii <seq> <link>
+#
+# which the bridge echoes unchanged: over TCP on the same connection, and
+# over UDP from its probe port, which it announces after a device's /pong:
+#
+#	/link/port ,i <port>
+
+PROBE_PREFIX = b'/link/probe\x00'
+PORT_HEADER = b'/link/port\x00\x00,i\x00\x00'
+
+
+def is_probe(data):
+	return data.startswith(PROBE_PREFIX)
+
+
+def port_message(port):
+	"""/link/port <port>"""
+	return PORT_HEADER + struct.pack('>i', port)
@@ -0,0 +1,77 @@
+import collections
+import struct
+import threading
+
+from coalesce import osc_key, path_matches
+
+BUNDLE_HEADER = b'#bundle\x00' + struct.pack('>Q', 1)		# Timetag 'immediately'
+
+# Device state (the gate example's sensor); everything else devices send is
+# a reply, a statistic or a stream
+DEFAULT_INCLUDE = ('/gate',)
+
+
+def make_bundles(packets, max_size=1400):
+	"""Pack OSC messages into as few bundles of at most max_size bytes as
+	possible (a larger message gets a bundle of its own)"""
+	bundles, parts, size = [], [BUNDLE_HEADER], len(BUNDLE_HEADER)
+	for packet in packets:
+		n = 4 + len(packet)
+		if len(parts) > 1 and size + n > max_size:
+			bundles.append(b''.join(parts))
+			parts, size = [BUNDLE_HEADER], len(BUNDLE_HEADER)
+		parts += [struct.pack('>i', len(packet)), packet]
+		size += n
+	if len(parts) > 1:
+		bundles.append(b''.join(parts))
+	return bundles
+
+
+class LastValueCache:
+	"""Latest message per (device, address, index) seen from devices, the index
+	being the first int argument (see coalesce.osc_key), so that a consumer
+	that restarts can be brought up to date without polling devices.
+
+	Only messages under the included paths (trailing * for a prefix) are
+	cached. The cache holds at most max_entries messages, dropping the least
+	recently updated; snapshot() returns them oldest first. Updates come from
+	the bridge's main loop and snapshots from the OSC server's threads, so
+	every access holds the lock.
+	"""
+
+	def __init__(self, include=DEFAULT_INCLUDE, max_entries=4096):
+		self._include = [p.encode() for p in include]
+		self._max_entries = max_entries
+		self._entries = collections.OrderedDict()		# (source, address, index) -> data
+		self._lock = threading.Lock()
+		return
+
+	def __len__(self):
+		with self._lock:
+			return len(self._entries)
+
+	def update(self, source, data):
+		"""Cache a device message; return whether it was cached"""
+		key = osc_key(data)
+		if key is None or not any(path_matches(p, key[0]) for p in self._include):
+			return False
+		key = (source,) + key
+		with self._lock:
+			self._entries.pop(key, None)
+			self._entries[key] = data
+			if len(self._entries) > self._max_entries:
+				self._entries.popitem(last=False)
+		return True
+
+	def forget(self, source):
+		"""Drop the values of a device (e.g. when it leaves the directory)"""
+		with self._lock:
+			for key in [k for k in self._entries if k[0] == source]:
+				del self._entries[key]
+		return
+
+	def snapshot(self, max_size=1400):
+		"""All cached values as OSC bundles of at most max_size bytes"""
+		with self._lock:
+			values = list(self._entries.values())
+		return make_bundles(values, max_size)
@@ -0,0 +1,222 @@
+import heapq
+import json
+import math
+import random
+import time
+
+
+class EventQueue:
+	"""Time-ordered callback queue.
+
+	With clock=None the queue runs in simulated time (run_until() advances the
+	clock); otherwise it is polled from a real event loop with run_pending().
+	"""
+
+	def __init__(self, clock=None):
+		self._clock = clock
+		self._sim_time = 0.0
+		self._heap = []
+		self._seq = 0
+		return
+
+	def now(self):
+		return self._clock() if self._clock else self._sim_time
+
+	def call_at(self, t, fn, *args):
+		heapq.heappush(self._heap, (t, self._seq, fn, args))
+		self._seq += 1
+		return
+
+	def call_later(self, dt, fn, *args):
+		self.call_at(self.now() + dt, fn, *args)
+		return
+
+	def next_time(self):
+		return self._heap[0][0] if self._heap else None
+
+	def run_pending(self):
+		now = self.now()
+		while self._heap and self._heap[0][0] <= now:
+			_, _, fn, args = heapq.heappop(self._heap)
+			fn(*args)
+		return
+
+	def run_until(self, t_end):
+		while self._heap and self._heap[0][0] <= t_end:
+			t, _, fn, args = heapq.heappop(self._heap)
+			self._sim_time = max(self._sim_time, t)
+			fn(*args)
+		self._sim_time = max(self._sim_time, t_end)
+		return
+
+
+class LinkProfile:
+	"""Impairment parameters for one direction of a link.
+
+	Times are in seconds, rates are probabilities per packet. Disconnects are
+	[start, duration] pairs relative to the start of the run.
+	"""
+
+	FIELDS = {
+		'loss': 0.0,
+		'latency': 0.0,
+		'jitter': 0.0,
+		'distribution': 'normal',	# 'uniform', 'normal' or 'pareto'
+		'reorder': 0.0,
+		'reorder_delay': 0.010,
+		'duplicate': 0.0,
+		'bandwidth': 0,				# bytes/s, 0 for unlimited
+		'rto': 0.200,				# TCP retransmit penalty applied on loss
+		'disconnects': [],
+	}
+
+	def __init__(self, **kwargs):
+		for key, default in LinkProfile.FIELDS.items():
+			setattr(self, key, kwargs.pop(key, default))
+		if kwargs:
+			raise ValueError("Unknown link profile fields: %s" % ', '.join(kwargs))
+		if self.distribution not in ('uniform', 'normal', 'pareto'):
+			raise ValueError("Unknown latency distribution '%s'" % self.distribution)
+		return
+
+	@classmethod
+	def from_dict(cls, d):
+		return cls(**d) if d else cls()
+
+	def sample_latency(self, rng):
+		if not self.jitter:
+			return self.latency
+		if self.distribution == 'uniform':
+			dt = rng.uniform(-self.jitter, self.jitter)
+		elif self.distribution == 'normal':
+			dt = rng.gauss(0.0, self.jitter)
+		else:
+			# Heavy-tailed: jitter is the scale of the Pareto excess
+			dt = self.jitter * (rng.paretovariate(2.5) - 1.0)
+		return max(0.0, self.latency + dt)
+
+	def is_down(self, t):
+		for start, duration in self.disconnects:
+			if start <= t < start + duration:
+				return True
+		return False
+
+
+class ImpairedLink:
+	"""One direction of an impaired link.
+
+	send() schedules deliver(data) on the event queue according to the
+	profile. Reliable links (TCP) never lose or reorder data; a loss costs a
+	retransmit timeout instead, and everything behind it waits (head-of-line
+	blocking). Unreliable links (UDP) drop, duplicate and reorder.
+	"""
+
+	def __init__(self, profile, deliver, queue, reliable=False, rng=None, t0=None):
+		self._profile = profile
+		self._deliver = deliver
+		self._queue = queue
+		self._reliable = reliable
+		self._rng = rng if rng else random.Random()
+		self._t0 = queue.now() if t0 is None else t0
+		self._tx_free = 0.0			# Time at which the bandwidth cap frees up
+		self._last_arrival = 0.0	# In-order delivery for reliable links
+		self.stats = {'sent': 0, 'delivered': 0, 'lost': 0, 'duplicated': 0,
+			'reordered': 0, 'refused': 0, 'retransmits': 0}
+		return
+
+	def is_down(self):
+		return self._profile.is_down(self._queue.now() - self._t0)
+
+	def send(self, data):
+		"""Return False if the link is down (the data is refused)"""
+		now = self._queue.now()
+		p = self._profile
+		if self.is_down():
+			self.stats['refused'] += 1
+			return False
+		self.stats['sent'] += 1
+
+		# Serialization delay under the bandwidth cap
+		t = now
+		if p.bandwidth:
+			t = max(t, self._tx_free) + len(data) / float(p.bandwidth)
+			self._tx_free = t
+
+		if self._reliable:
+			while self._rng.random() < p.loss:
+				t += p.rto
+				self.stats['retransmits'] += 1
+			t = max(t + p.sample_latency(self._rng), self._last_arrival)
+			self._last_arrival = t
+			self._queue.call_at(t, self._arrive, data)
+			return True
+
+		if self._rng.random() < p.loss:
+			self.stats['lost'] += 1
+			return True
+		t += p.sample_latency(self._rng)
+		if self._rng.random() < p.reorder:
+			t += p.reorder_delay
+			self.stats['reordered'] += 1
+		self._queue.call_at(t, self._arrive, data)
+		if self._rng.random() < p.duplicate:
+			self.stats['duplicated'] += 1
+			self._queue.call_at(t + p.sample_latency(self._rng), self._arrive, data)
+		return True
+
+	def _arrive(self, data):
+		# Data in flight when a disconnect starts is lost, even on TCP
+		if self.is_down():
+			self.stats['lost'] += 1
+			return
+		self.stats['delivered'] += 1
+		self._deliver(data)
+		return
+
+
+class Impairments:
+	"""Per-peer link profiles loaded from a JSON file of the form
+
+		{"seed": 1,
+		 "default": {"loss": 0.01, "latency": 0.005, "jitter": 0.002},
+		 "links": {"10.0.1.19": {"loss": 0.2, "disconnects": [[30, 5]]}}}
+
+	and the real-time event queue used to deliver impaired traffic.
+	"""
+
+	def __init__(self, config=None):
+		config = config or {}
+		self.queue = EventQueue(clock=time.monotonic)
+		self._rng = random.Random(config.get('seed'))
+		self._default = config.get('default', {})
+		self._links = config.get('links', {})
+		self._t0 = self.queue.now()
+		return
+
+	@classmethod
+	def load(cls, path):
+		with open(path) as f:
+			return cls(json.load(f))
+
+	def profile(self, peer):
+		d = dict(self._default)
+		d.update(self._links.get(peer, {}))
+		return LinkProfile.from_dict(d)
+
+	def link(self, peer, deliver, reliable=False):
+		return ImpairedLink(self.profile(peer), deliver, self.queue,
+			reliable=reliable, rng=self._rng, t0=self._t0)
+
+	def poll_interval(self, max_wait=0.05):
+		t = self.queue.next_time()
+		if t is None:
+			return max_wait
+		return min(max_wait, max(0.0, t - self.queue.now()))
+
+
+def percentiles(values, ps=(50, 90, 99, 99.9)):
+	"""Nearest-rank percentiles of an unsorted list"""
+	if not values:
+		return dict((p, float('nan')) for p in ps)
+	s = sorted(values)
+	return dict((p, s[min(len(s) - 1, max(0, int(math.ceil(p / 100.0 * len(s))) - 1))]) for p in ps)
@@ -0,0 +1,53 @@
+import struct
+
+# Keepalive sent by libiot TCPClient; echoed back by the bridge
+KEEPALIVE = b'/ka\x00,\x00\x00\x00'
+
+# Big-endian length ahead of each packet on the stream; bundles carry no 
+# length of their own, so packets can't be told apart by parsing alone
+_PREFIX = struct.Struct('>I')
+
+
+def _string_end(data, i):
+	"""Index just past the padded OSC string at i, or None if incomplete"""
+	end = data.find(b'\x00', i)
+	if end < 0:
+		return None
+	end = (end + 4) & ~3
+	return end if end <= len(data) else None
+
+
+def frame(packet):
+	"""Prefix a packet with its length (OSC 1.0 stream framing)"""
+	return _PREFIX.pack(len(packet)) + packet
+
+
+class OSCStream:
+	"""Splits a TCP byte stream into OSC packets. Each packet is preceded by its 
+	length (frame(); libiot's OSCStream does the same), and partial packets are 
+	held until the rest arrives."""
+
+	def __init__(self):
+		self._buf = b''
+		self.errors = 0
+		return
+
+	def feed(self, data):
+		"""Return the list of complete packets"""
+		self._buf += data
+		packets = []
+		i = 0
+		while i + _PREFIX.size <= len(self._buf):
+			n = _PREFIX.unpack_from(self._buf, i)[0]
+			if not n or n & 3:
+				# Lost sync; drop what we have and start over
+				self.errors += 1
+				self._buf = b''
+				return packets
+			if i + _PREFIX.size + n > len(self._buf):
+				break
+			i += _PREFIX.size
+			packets.append(self._buf[i:i+n])
+			i += n
+		self._buf = self._buf[i:]
+		return packets
@@ -0,0 +1,235 @@
+import mmap
+import os
+import random
+import socket
+import struct
+import time
+
+# Shared-memory broadcast ring (layout shared with client/dslbridge.h)
+#
+#	 0	char magic[4]		"DSLR"
+#	 4	u32 version
+#	 8	u32 capacity		data bytes, a power of two
+#	12	u32 epoch			changes whenever a writer (re)creates the ring
+#	16	u64 write_pos		bytes written since creation; published last
+#	64	data[capacity]
+#
+# Records are [u32 length][u32 reserved][payload], padded to 8 bytes, and
+# never wrap; a length of PAD_RECORD skips to the start of the data. There is
+# one writer and any number of readers, each with its own read position. The
+# writer never waits: a reader that falls more than half the capacity behind
+# loses records (and finds out by checking write_pos again after reading;
+# records are at most a quarter of the capacity, so the writer never touches
+# more than half the capacity past write_pos, wrap padding included). A writer
+# that restarts reuses the file, so readers keep their mapping and resync
+# when write_pos goes backwards.
+#
+# Python has no memory fences, so ordering rests on the CPU: the writer's
+# record stores must become visible before the write_pos store that publishes
+# them, and ShmRingReader's record loads must happen before its second
+# write_pos load. x86 (total store order) guarantees both; on weakly ordered
+# CPUs such as ARM a reader could take a torn record as intact, and the writer
+# would need a native release store. BridgeRingReader fences its own side.
+
+MAGIC = b'DSLR'
+VERSION = 1
+HEADER_SIZE = 64
+RECORD_HEADER = 8
+PAD_RECORD = 0xFFFFFFFF
+WRITE_POS = 16
+
+
+def write_pos_view(mm):
+	# Native 8-byte item, so stores and loads are single aligned accesses
+	# (struct.pack_into('<Q') would write byte by byte and could be torn)
+	return memoryview(mm)[WRITE_POS:WRITE_POS + 8].cast('Q')
+
+
+def record_size(length):
+	return RECORD_HEADER + ((length + 7) & ~7)
+
+
+class ShmRingWriter:
+
+	def __init__(self, path, capacity=1 << 20):
+		if capacity & (capacity - 1):
+			raise ValueError("Capacity must be a power of two")
+		self.path = path
+		self._capacity = capacity
+		self._mask = capacity - 1
+		self._fd = os.open(path, os.O_RDWR | os.O_CREAT, 0o644)
+		if os.fstat(self._fd).st_size not in (0, HEADER_SIZE + capacity):
+			raise ValueError("%s exists with a different capacity" % path)
+		os.ftruncate(self._fd, HEADER_SIZE + capacity)
+		self._mm = mmap.mmap(self._fd, HEADER_SIZE + capacity)
+		self._pos = 0
+		self._mm[0:HEADER_SIZE] = bytes(HEADER_SIZE)
+		struct.pack_into('<4sIII', self._mm, 0, MAGIC, VERSION, capacity, random.getrandbits(32))
+		self._write_pos = write_pos_view(self._mm)
+		self.records = 0
+		return
+
+	def write(self, data):
+		n = len(data)
+		size = record_size(n)
+		if size > self._capacity // 4:
+			raise ValueError("Record of %d bytes too large for the ring" % n)
+		mm, pos = self._mm, self._pos
+
+		# Records don't wrap; pad out the end of the data instead
+		offset = pos & self._mask
+		if offset + size > self._capacity:
+			struct.pack_into('<I', mm, HEADER_SIZE + offset, PAD_RECORD)
+			pos += self._capacity - offset
+			offset = 0
+
+		base = HEADER_SIZE + offset
+		struct.pack_into('<II', mm, base, n, 0)
+		mm[base + RECORD_HEADER:base + RECORD_HEADER + n] = data
+
+		# Publish
+		self._pos = pos + size
+		self._write_pos[0] = self._pos
+		self.records += 1
+		return
+
+	def close(self, unlink=False):
+		self._write_pos.release()
+		self._mm.close()
+		os.close(self._fd)
+		if unlink:
+			os.unlink(self.path)
+		return
+
+
+class ShmRingReader:
+
+	def __init__(self, path, from_start=False):
+		self._fd = os.open(path, os.O_RDONLY)
+		size = os.fstat(self._fd).st_size
+		self._mm = mmap.mmap(self._fd, size, prot=mmap.PROT_READ)
+		magic, version, capacity, self._epoch = struct.unpack_from('<4sIII', self._mm, 0)
+		if magic != MAGIC or version != VERSION:
+			raise ValueError("%s is not a bridge ring" % path)
+		self._capacity = capacity
+		self._mask = capacity - 1
+		self._wp = write_pos_view(self._mm)
+		wp = self._write_pos()
+		self._pos = 0 if from_start and wp <= capacity else wp
+		self.lost = 0
+		return
+
+	def _write_pos(self):
+		return self._wp[0]
+
+	def read(self):
+		"""Return the next record, or None if there is none yet"""
+		mm = self._mm
+		while True:
+			wp = self._write_pos()
+			if self._pos == wp:
+				return None
+			if wp < self._pos:
+				self._pos = wp			# Writer restarted
+				return None
+			if wp - self._pos > self._capacity // 2:
+				self.lost += 1
+				self._pos = wp
+				return None
+			offset = self._pos & self._mask
+			n = struct.unpack_from('<I', mm, HEADER_SIZE + offset)[0]
+			if n == PAD_RECORD:
+				self._pos += self._capacity - offset
+				continue
+			base = HEADER_SIZE + offset + RECORD_HEADER
+			data = mm[base:base + n]
+
+			# Overwritten while we copied it?
+			if self._write_pos() - self._pos > self._capacity // 2:
+				self.lost += 1
+				self._pos = self._write_pos()
+				return None
+			self._pos += record_size(n)
+			return data
+
+	def close(self):
+		self._wp.release()
+		self._mm.close()
+		os.close(self._fd)
+		return
+
+
+class UnixFanout:
+	"""Unix-domain datagram socket for local consumers that can't map the ring.
+
+	A consumer binds its own datagram socket and sends an empty datagram to
+	register (again to renew); it then receives every packet. Non-empty
+	datagrams from consumers are OSC packets for the bridge, returned by
+	receive() along with their sender. Consumers whose sockets go away are
+	dropped.
+	"""
+
+	def __init__(self, path):
+		self.path = path
+		if os.path.exists(path):
+			os.unlink(path)
+		self._sock = socket.socket(socket.AF_UNIX, socket.SOCK_DGRAM)
+		self._sock.bind(path)
+		self._sock.setblocking(False)
+		self._peers = set()
+		return
+
+	def fileno(self):
+		return self._sock.fileno()
+
+	def receive(self):
+		"""Drain pending datagrams; return the (peer, packet) pairs for the
+		OSC packets among them, and the consumers that newly registered"""
+		packets, attached = [], []
+		while True:
+			try:
+				data, peer = self._sock.recvfrom(65536)
+			except BlockingIOError:
+				return packets, attached
+			if not data:
+				if peer and peer not in self._peers:
+					self._peers.add(peer)
+					attached.append(peer)
+			else:
+				packets.append((peer, data))
+
+	def send(self, data):
+		for peer in list(self._peers):
+			self.send_to(data, peer)
+		return
+
+	def send_to(self, data, peer):
+		try:
+			self._sock.sendto(data, peer)
+		except BlockingIOError:
+			pass			# Consumer is behind; drop rather than block
+		except OSError:
+			self._peers.discard(peer)
+		return
+
+	def close(self):
+		self._sock.close()
+		os.unlink(self.path)
+		return
+
+
+if __name__ == "__main__":
+
+	import argparse
+
+	parser = argparse.ArgumentParser(description='Bridge ring reader (prints records as they arrive)')
+	parser.add_argument('path', help='Ring file (tcp.py --shm)')
+	args = parser.parse_args()
+
+	reader = ShmRingReader(args.path)
+	while True:
+		data = reader.read()
+		if data is None:
+			time.sleep(0.001)
+		else:
+			print(data)
@@ -0,0 +1,278 @@
+import argparse
+import json
+import random
+import socket
+import struct
+import sys
+import time
+
+from journal import ACK_HEADER, make_event
+from latency import Harness, Sink, gate_packet, pong_packet
+from netsim import percentiles
+from oscstream import OSCStream, frame
+
+# Battery gate nodes (libiot SleepManager, the gate example with SLEEP set):
+# a sensor edge resets the node out of deep sleep, it rejoins WiFi from its
+# RTC snapshot, journals the edge and sends a copy over UDP to the bridge's
+# probe port, then connects to the bridge to deliver the journal (the bridge
+# forwards whichever copy comes first), and sleeps once it's acknowledged.
+#
+# This harness replays that wake cycle against the real bridge. What the host
+# can't do (boot, rejoining the access point) takes the time in the profile,
+# jittered from the seed; the rest is measured. Energy per event is the
+# profile's current in each phase times its duration. The same profile and
+# seed give the same figures, and the defaults below are typical ESP8266
+# figures: replace them with a board's measurements (the bridge logs each
+# wake's send and awake times from /sleep/stats) to predict its battery life.
+
+DEFAULT_PROFILE = {
+	'voltage': 3.3,
+	'sleep_ua': 20.0,			# Deep sleep, including the wake circuit
+	'jitter': 0.2,				# Phase durations vary by up to this fraction
+	# Phase: [ms, mA]
+	'phases': {
+		'boot': [60, 70],		# Reset to setup(), with RF calibration
+		'init': [5, 70],		# EEPROM load and WifiManager::init()
+		'rejoin': [120, 75],	# Known access point and channel, static IP
+		'scan': [1500, 75],		# Cold boots: find the access point,
+		'associate': [120, 75],	# join it,
+		'dhcp': [800, 75],		# get an address,
+		'poll': [250, 75],		# and notice (connect() checks every 500 ms)
+		'send': [1, 170],		# The wake edge's copy over UDP
+		'awake': [0, 75],		# Radio on while TCP delivers (measured)
+	},
+}
+
+RESUME_PHASES = ('boot', 'init', 'rejoin')
+COLD_PHASES = ('boot', 'init', 'scan', 'associate', 'dhcp', 'poll')
+
+
+def load_profile(path):
+	"""The default profile, updated from a JSON file's entries"""
+	profile = json.loads(json.dumps(DEFAULT_PROFILE))
+	if path:
+		with open(path) as f:
+			override = json.load(f)
+		profile['phases'].update(override.pop('phases', {}))
+		profile.update(override)
+	return profile
+
+
+def sleep_stats_packet(node_id, send_us, awake_ms, wakes):
+	"""/sleep/stats as the firmware reports it on each wake's connect"""
+	return (b'/sleep/stats\0\0\0\0,isiiiiiiii\0' + struct.pack('>i', node_id) + b'sensor\0\0' +
+		struct.pack('>iiiiiiii', wakes, 1, 0, 0, send_us, send_us, awake_ms, 0))
+
+
+class SimSleeper:
+	"""Gate node in sleep mode: every edge is a wake from deep sleep. Each wake
+	connects anew from the node's own loopback address, leaving the previous
+	connection half-open as a sleeping node does (the bridge replaces it)."""
+
+	def __init__(self, node_id, bridge_port, probe_port):
+		self.node_id = node_id
+		self.addr = '127.0.0.%d' % (node_id + 1)
+		self._bridge = ('127.0.0.1', bridge_port)
+		self._probe = ('127.0.0.1', probe_port)
+		self._udp = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+		self._udp.bind((self.addr, 0))
+		self._tcp = None
+		self._state = 0
+		self._epoch = random.Random(node_id).getrandbits(31)	# Kept across wakes
+		self._seq = 1
+		self.wakes = 0
+		return
+
+	def wake(self, seq, boot_s, timeout):
+		"""Run one wake; return (wake-to-send, awake, delivered) in seconds"""
+		t_wake = time.perf_counter()
+		self.wakes += 1
+		self._state ^= 1
+		time.sleep(boot_s)
+
+		# The wake edge's journal copy over UDP, then the journal over TCP
+		packet = gate_packet(self.node_id, self._state, seq)
+		self._udp.sendto(make_event(self._epoch, self._seq, 0, packet), self._probe)
+		t_send = time.perf_counter()
+
+		old, self._tcp = self._tcp, None
+		delivered = False
+		try:
+			tcp = socket.create_connection(self._bridge, timeout=timeout, source_address=(self.addr, 0))
+			tcp.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+			tcp.sendall(frame(pong_packet(self.node_id, self.addr)))
+			tcp.sendall(frame(make_event(self._epoch, self._seq, int((time.perf_counter() - t_send) * 1e3), packet)))
+			tcp.sendall(frame(sleep_stats_packet(self.node_id, int((t_send - t_wake) * 1e6), 0, self.wakes)))
+			delivered = self._await_ack(tcp, t_wake + timeout)
+			self._tcp = tcp
+		except OSError:
+			pass
+		if old:
+			old.close()
+		self._seq += 1
+		t_sleep = time.perf_counter()
+		return t_send - t_wake, t_sleep - t_wake, delivered
+
+	def _await_ack(self, tcp, deadline):
+		stream = OSCStream()
+		while True:
+			remaining = deadline - time.perf_counter()
+			if remaining <= 0:
+				return False
+			tcp.settimeout(remaining)
+			try:
+				data = tcp.recv(4096)
+			except socket.timeout:
+				return False
+			if not data:
+				return False
+			for message in stream.feed(data):
+				if message.startswith(ACK_HEADER):
+					epoch, seq = struct.unpack_from('>II', message, len(ACK_HEADER))
+					if epoch == self._epoch and seq >= self._seq:
+						return True
+
+	def close(self):
+		if self._tcp:
+			self._tcp.close()
+		self._udp.close()
+		return
+
+
+class SleepHarness(Harness):
+	"""Runs the real bridge (tcp.py) between sleeping gate nodes and a stub
+	consumer, one wake at a time"""
+
+	def jittered(self, ms):
+		j = self._args.profile['jitter']
+		return ms * (1.0 + self._rng.uniform(-j, j))
+
+	def run(self):
+		a = self._args
+		phases = a.profile['phases']
+		self.start_bridge()
+		sink = Sink(self.iot_port)
+		# (The bridge takes UDP on its default probe port, iot_port + 1)
+		nodes = [SimSleeper(i + 1, self.iot_port, self.iot_port + 1) for i in range(a.nodes)]
+		wakes = []
+		try:
+			for seq in range(a.events):
+				node = nodes[self._rng.randrange(len(nodes))]
+				boot = dict((p, self.jittered(phases[p][0])) for p in RESUME_PHASES)
+				send_s, awake_s, delivered = node.wake(seq, sum(boot.values()) / 1e3, a.awake_max / 1e3)
+				wakes.append({'seq': seq, 'phases_ms': boot, 'send_ms': send_s * 1e3,
+					'awake_ms': awake_s * 1e3, 'delivered': delivered, 'sent_at': time.perf_counter() - awake_s + send_s})
+				time.sleep(a.gap / 1e3)
+
+			deadline = time.perf_counter() + a.drain
+			while time.perf_counter() < deadline and any(w['seq'] not in sink.arrivals for w in wakes):
+				time.sleep(0.01)
+		finally:
+			for node in nodes:
+				node.close()
+			sink.close()
+			self.stop_bridge()
+
+		# Wake-to-Max: from the reset, through the UDP send and the bridge, to
+		# the consumer
+		for w in wakes:
+			arrival = sink.arrivals.get(w['seq'])
+			w['max_ms'] = w['send_ms'] + (arrival - w['sent_at']) * 1e3 if arrival else None
+		return report(wakes, a.profile, a, sink.duplicates)
+
+
+def charge_uc(phases_ms, profile):
+	"""Charge drawn in the phases (ms by name), in microcoulombs (uA s)"""
+	return sum(ms * profile['phases'][name][1] for name, ms in phases_ms.items())
+
+
+def report(wakes, profile, args, duplicates):
+	"""Replayed resume figures, and the same for cold boots from the profile"""
+	phases = profile['phases']
+	send_ms = [w['send_ms'] for w in wakes]
+	awake_ms = [w['awake_ms'] for w in wakes]
+	max_ms = [w['max_ms'] for w in wakes if w['max_ms'] is not None]
+	charges = []
+	for w in wakes:
+		used = dict(w['phases_ms'])
+		used['send'] = phases['send'][0]
+		used['awake'] = max(0.0, w['awake_ms'] - sum(w['phases_ms'].values()))
+		charges.append(charge_uc(used, profile))
+
+	# A cold boot: full connect, then the same delivery
+	cold = dict((p, phases[p][0]) for p in COLD_PHASES)
+	cold_send_ms = sum(cold.values())
+	cold['send'] = phases['send'][0]
+	cold['awake'] = percentiles(awake_ms)[50] - sum(phases[p][0] for p in RESUME_PHASES)
+	cold_charge = charge_uc(cold, profile)
+
+	def summary(charge_uc_event, send):
+		energy_mj = charge_uc_event * profile['voltage'] / 1e3
+		# Average current at the event rate, and how long the battery lasts
+		avg_ma = charge_uc_event / 1e3 * args.rate / 3600.0 + profile['sleep_ua'] / 1e3
+		return {'send_ms': send, 'energy_mj': energy_mj, 'charge_uah': charge_uc_event / 3600.0,
+			'avg_ma': avg_ma, 'battery_days': args.battery / avg_ma / 24.0}
+
+	charge = percentiles(charges)[50]
+	return {
+		'events': len(wakes),
+		'delivered': sum(w['delivered'] for w in wakes),
+		'at_max': len(max_ms),
+		'duplicates': duplicates,
+		'send_ms': dict(('p%g' % p, v) for p, v in percentiles(send_ms).items()),
+		'max_ms': dict(('p%g' % p, v) for p, v in percentiles(max_ms).items()),
+		'awake_ms': dict(('p%g' % p, v) for p, v in percentiles(awake_ms).items()),
+		'resume': summary(charge, percentiles(send_ms)[50]),
+		'cold': summary(cold_charge, cold_send_ms),
+		'rate': args.rate,
+		'battery_mah': args.battery,
+	}
+
+
+def print_report(r):
+	print("%d wakes, %d acknowledged through the journal, %d reached the consumer, %d duplicates" %
+		(r['events'], r['delivered'], r['at_max'], r['duplicates']))
+	print("%14s %8s %8s %8s %8s" % ('ms', 'p50', 'p90', 'p99', 'p99.9'))
+	for name, key in (('wake-to-send', 'send_ms'), ('wake-to-Max', 'max_ms'), ('awake', 'awake_ms')):
+		v = r[key]
+		print("%14s %8.1f %8.1f %8.1f %8.1f" % (name, v['p50'], v['p90'], v['p99'], v['p99.9']))
+	print("At %g events/h on %g mAh:" % (r['rate'], r['battery_mah']))
+	print("%14s %10s %10s %10s %10s %10s" % ('', 'send ms', 'mJ/event', 'uAh/event', 'avg mA', 'days'))
+	for name in ('resume', 'cold'):
+		s = r[name]
+		print("%14s %10.1f %10.2f %10.2f %10.4f %10.0f" % (name, s['send_ms'], s['energy_mj'],
+			s['charge_uah'], s['avg_ma'], s['battery_days']))
+	return
+
+
+if __name__ == "__main__":
+
+	parser = argparse.ArgumentParser(description='Wake-to-send latency and energy per event of sleeping gate nodes, replayed through tcp.py')
+	parser.add_argument('--nodes', type=int, default=4, help='Simulated sleeping nodes (at most 253)')
+	parser.add_argument('--events', type=int, default=50, help='Wakes to replay')
+	parser.add_argument('--gap', type=float, default=20.0, help='Milliseconds between wakes')
+	parser.add_argument('--awake-max', type=float, default=1000.0, help='Milliseconds a wake waits for the journal ack (SLEEP_AWAKE_MAX_MS)')
+	parser.add_argument('--drain', type=float, default=1.0, help='Seconds to wait for late arrivals')
+	parser.add_argument('--profile', metavar='FILE', help='JSON phase durations and currents overriding the defaults')
+	parser.add_argument('--impair', metavar='PROFILE', help='Run the bridge with this link profile (see netsim.py)')
+	parser.add_argument('--rate', type=float, default=60.0, help='Events per hour, for the battery estimate')
+	parser.add_argument('--battery', type=float, default=2000.0, help='Battery capacity (mAh)')
+	parser.add_argument('--budget', type=float, default=250.0, help='Fail if the p99 wake-to-send exceeds this many ms (SLEEP_WAKE_BUDGET_US)')
+	parser.add_argument('--seed', type=int, default=1)
+	parser.add_argument('--json', action='store_true', help='Print the report as JSON')
+	args = parser.parse_args()
+	args.profile = load_profile(args.profile)
+
+	r = SleepHarness(args).run()
+	if args.json:
+		print(json.dumps(r, indent=2))
+	else:
+		print_report(r)
+	failures = []
+	if not r['send_ms']['p99'] <= args.budget:
+		failures.append("p99 wake-to-send %.1f ms > %.1f ms" % (r['send_ms']['p99'], args.budget))
+	if r['delivered'] < r['events']:
+		failures.append("%d of %d wakes not acknowledged" % (r['events'] - r['delivered'], r['events']))
+	for failure in failures:
+		print("FAIL: " + failure)
+	sys.exit(1 if failures else 0)
@@ -0,0 +1,159 @@
+import os
+import termios
+import tty
+
+# SLIP framing (RFC 1055) of OSC packets on serial links, as in OSC 1.1 and
+# libiot SLIPTransport: END and ESC bytes in a packet are escaped, and each
+# packet is sent between END bytes.
+
+END = 0xC0
+ESC = 0xDB
+ESC_END = 0xDC
+ESC_ESC = 0xDD
+
+MAX_PACKET = 512			# libiot SLIP_MAX_PACKET
+
+_ESCAPES = {END: bytes((ESC, ESC_END)), ESC: bytes((ESC, ESC_ESC))}
+
+
+def encode(data):
+	"""One packet, framed"""
+	if END in data or ESC in data:
+		data = data.replace(bytes((ESC,)), _ESCAPES[ESC]).replace(bytes((END,)), _ESCAPES[END])
+	return bytes((END,)) + data + bytes((END,))
+
+
+class Decoder:
+	"""Reassembles packets from serial reads, however they were split.
+	Packets longer than max_packet or with a bad escape are dropped and
+	counted in errors."""
+
+	def __init__(self, max_packet=MAX_PACKET):
+		self._max = max_packet
+		self._buf = bytearray()
+		self._escaped = False
+		self._dropping = False
+		self.errors = 0
+		return
+
+	def feed(self, data):
+		"""Return the packets completed by data"""
+		packets = []
+		for c in data:
+			if c == END:
+				if self._buf and not self._dropping:
+					packets.append(bytes(self._buf))
+				self._buf.clear()
+				self._escaped = self._dropping = False
+				continue
+			if self._dropping:
+				continue
+			if self._escaped:
+				self._escaped = False
+				if c == ESC_END:
+					c = END
+				elif c == ESC_ESC:
+					c = ESC
+				else:
+					self._drop()
+					continue
+			elif c == ESC:
+				self._escaped = True
+				continue
+			if len(self._buf) == self._max:
+				self._drop()
+				continue
+			self._buf.append(c)
+		return packets
+
+	def _drop(self):
+		self.errors += 1
+		self._dropping = True
+		self._buf.clear()
+		return
+
+
+def set_raw(fd, baud=None):
+	"""Put a tty in raw mode (no echo, line editing or CR/LF translation),
+	optionally at a baud rate (e.g. 921600), with reads returning as soon as
+	any byte arrives"""
+	tty.setraw(fd)
+	attrs = termios.tcgetattr(fd)
+	if baud:
+		speed = getattr(termios, 'B%d' % baud, None)
+		if speed is None:
+			raise ValueError("Unsupported baud rate %d" % baud)
+		attrs[4] = attrs[5] = speed
+	attrs[6][termios.VMIN] = 1
+	attrs[6][termios.VTIME] = 0
+	termios.tcsetattr(fd, termios.TCSANOW, attrs)
+	return
+
+
+def open_serial(path, baud):
+	"""Open a serial port (e.g. /dev/ttyUSB0) raw and non-blocking"""
+	fd = os.open(path, os.O_RDWR | os.O_NOCTTY | os.O_NONBLOCK)
+	set_raw(fd, baud)
+	return fd
+
+
+if __name__ == "__main__":
+
+	import random
+	import select
+	import struct
+	import time
+
+	# Self-check of this codec (not the firmware's) over a pty pair: packets
+	# full of END/ESC bytes, written in random pieces, must come back intact;
+	# then the round trip through the pty for an echoed /act message
+	master, slave = os.openpty()
+	set_raw(master)
+	set_raw(slave)
+
+	rng = random.Random(1)
+	packets = [bytes(rng.choice((END, ESC, ESC_END, ESC_ESC, rng.randrange(256)))
+		for _ in range(rng.randrange(1, 300))) for _ in range(500)]
+	stream = b''.join(encode(p) for p in packets)
+	decoder = Decoder()
+	received = []
+	i = 0
+	while i < len(stream) or len(received) < len(packets):
+		if i < len(stream):
+			n = rng.randrange(1, 64)
+			os.write(master, stream[i:i + n])
+			i += n
+		while select.select([slave], [], [], 0 if i < len(stream) else 1.0)[0]:
+			received += decoder.feed(os.read(slave, 4096))
+			if i < len(stream):
+				break
+		else:
+			if i >= len(stream):
+				break
+	assert received == packets, "%d of %d packets intact" % (
+		sum(a == b for a, b in zip(received, packets)), len(packets))
+	print("%d packets (%d bytes framed) intact, %d errors" % (len(packets), len(stream), decoder.errors))
+
+	assert Decoder().feed(bytes((END, ESC, 0x41, END, 0x42, END))) == [b'B']
+	assert Decoder(4).feed(encode(b'12345') + encode(b'1234')) == [b'1234']
+
+	message = b'/act\x00\x00\x00\x00,ii\x00' + struct.pack('>ii', 1, 512)
+	times = []
+	for _ in range(1000):
+		t = time.perf_counter()
+		os.write(master, encode(message))
+		got = []
+		while not got:
+			select.select([slave], [], [])
+			got = decoder.feed(os.read(slave, 4096))
+		os.write(slave, encode(got[0]))
+		got = []
+		while not got:
+			select.select([master], [], [])
+			got = decoder.feed(os.read(master, 4096))
+		times.append(time.perf_counter() - t)
+	times.sort()
+	print("pty round trip (%d bytes): median %.0f us, 99th percentile %.0f us" % (len(message),
+		times[len(times) // 2] * 1e6, times[len(times) * 99 // 100] * 1e6))
+	os.close(master)
+	os.close(slave)
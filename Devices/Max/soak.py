@@ -0,0 +1,317 @@
+import argparse
+import json
+import random
+import struct
+
+import intern
+from journal import ACK_HEADER, JournalReceiver, make_event
+from latency import GATE_PREFIX, INTERN_HEADER, gate_packet, pong_packet
+from netsim import EventQueue, LinkProfile, ImpairedLink, percentiles
+
+
+class SimNode:
+	"""Simulated gate node.
+
+	Mirrors the delivery logic of examples/gate: answer /ping with /pong and a
+	TCP connect, and journal every event (journal.py). Events go over TCP as
+	/ev while connected, interned once the bridge answers /intern, and stay
+	journaled until acknowledged; a reconnect resends everything unacked.
+	While disconnected, a copy of each event goes over UDP to the last pinged
+	address. With --reconnect, a lost connection is retried with jittered
+	exponential backoff (TCPClient::set_reconnect()), and with --keepalive it
+	is noticed within the keepalive timeout rather than on the next send.
+	"""
+
+	def __init__(self, node_id, sim, profile, warm):
+		self.node_id = node_id
+		self._sim = sim
+		self._dest = warm			# Destination loaded from EEPROM on boot
+		self._tcp_up = False
+		self._booted = False
+		self._profile = profile
+		q, rng = sim.queue, sim.rng
+		self._udp_up = ImpairedLink(profile, lambda d: sim.bridge_udp(self, d), q, rng=rng, t0=0.0)
+		self._tcp_uplink = ImpairedLink(profile, lambda d: sim.bridge_tcp(self, d), q, reliable=True, rng=rng, t0=0.0)
+		self._tcp_down = ImpairedLink(profile, self.handle_tcp, q, reliable=True, rng=rng, t0=0.0)
+		self._udp_down = ImpairedLink(profile, self.handle_udp, q, rng=rng, t0=0.0)
+		self._backoff = 0.0
+		self.addr = '10.0.%d.%d' % (node_id >> 8, node_id & 0xFF)
+		self._epoch = rng.getrandbits(31)
+		self._seq = 1
+		self._journal = []			# (seq, time recorded, message), oldest first
+		self._interning = False
+
+		# Keepalive timeouts notice dead links without traffic
+		if sim.keepalive:
+			for start, _ in profile.disconnects:
+				q.call_at(start + sim.keepalive, self.check_link)
+		return
+
+	def boot(self):
+		self._booted = True
+		if self._dest:
+			self.connect_dest()
+		return
+
+	def broadcast(self, data):
+		"""Host broadcast arriving at this node's radio"""
+		self._udp_down.send(data)
+		return
+
+	def handle_udp(self, data):
+		if self._booted and data[0] == '/ping':
+			self._dest = True
+			self.connect_dest()
+		return
+
+	def connect_dest(self):
+		self._udp_up.send(pong_packet(self.node_id, self.addr))
+		if not self._tcp_up and not self._tcp_uplink.is_down():
+			# SYN/SYN-ACK/ACK costs a round trip before /pong goes out on TCP
+			self._sim.queue.call_later(2 * self._profile.latency, self.handle_tcp_connect)
+		return
+
+	def handle_tcp_connect(self):
+		if self._tcp_uplink.is_down():
+			return
+		self._tcp_up = True
+		self._interning = False		# Until the bridge answers /intern
+		self._tcp_uplink.send(pong_packet(self.node_id, self.addr, intern.VERSION))
+
+		# Resend everything unacknowledged, after the /pong
+		now = self._sim.queue.now()
+		for seq, t, message in self._journal:
+			self._sim.count('resent')
+			self._tcp_uplink.send(make_event(self._epoch, seq, int((now - t) * 1e3), message))
+		return
+
+	def handle_tcp(self, data):
+		"""Bridge to node over TCP: acknowledgements and /intern"""
+		if not self._tcp_up:
+			return
+		if data.startswith(ACK_HEADER):
+			epoch, seq = struct.unpack_from('>II', data, len(ACK_HEADER))
+			if epoch == self._epoch:
+				while self._journal and self._journal[0][0] <= seq:
+					self._journal.pop(0)
+		elif data.startswith(INTERN_HEADER):
+			self._interning = struct.unpack_from('>i', data, len(INTERN_HEADER))[0] == intern.VERSION
+		return
+
+	def tcp_reply(self, data):
+		self._tcp_down.send(data)
+		return
+
+	def unacked(self):
+		return len(self._journal)
+
+	def check_link(self):
+		if self._tcp_up and self._tcp_uplink.is_down():
+			self.tcp_closed()
+		return
+
+	def tcp_closed(self):
+		self._tcp_up = False
+		if self._sim.reconnect:
+			self._backoff = self._sim.reconnect[0]
+			self.schedule_reconnect()
+		return
+
+	def schedule_reconnect(self):
+		delay = self._backoff / 2 + self._sim.rng.uniform(0, self._backoff / 2)
+		self._backoff = min(2 * self._backoff, self._sim.reconnect[1])
+		self._sim.queue.call_later(delay, self.try_reconnect)
+		return
+
+	def try_reconnect(self):
+		if self._tcp_up:
+			return
+		self._sim.count('reconnects')
+		if self._tcp_uplink.is_down():
+			self.schedule_reconnect()
+		else:
+			self._sim.queue.call_later(2 * self._profile.latency, self.handle_tcp_connect)
+		return
+
+	def sensor_edge(self, event_id):
+		if not self._booted:
+			return
+		message = gate_packet(self.node_id, 1, event_id)
+		if self._tcp_up and self._interning:
+			message = intern.encode(message)
+		event = make_event(self._epoch, self._seq, 0, message)
+		self._journal.append((self._seq, self._sim.queue.now(), message))
+		self._seq += 1
+		self._sim.sent(event_id)
+		if self._tcp_up:
+			if self._tcp_uplink.send(event):
+				self._sim.count('tcp')
+				return
+			# AsyncClient notices the dead link; without automatic reconnects
+			# nothing reconnects until the next /ping
+			self.tcp_closed()
+		if self._dest:
+			self._sim.count('udp')
+			self._udp_up.send(event)
+		else:
+			self._sim.count('nodest')
+		return
+
+
+class Soak:
+
+	def __init__(self, args, config):
+		self.queue = EventQueue()
+		self.rng = random.Random(args.seed)
+		self._args = args
+		self._config = config
+		self._sent = {}
+		self._latency = []
+		self._seen = set()
+		self._discovered = set()
+		self._counts = {'tcp': 0, 'udp': 0, 'nodest': 0, 'dup': 0, 'reconnects': 0, 'resent': 0,
+			'unknown': 0}
+		self._journal = JournalReceiver()
+		self.reconnect = [float(t) for t in args.reconnect.split(',')] if args.reconnect else None
+		self.keepalive = args.keepalive
+		self.nodes = []
+		for i in range(args.nodes):
+			profile = self.profile(i)
+			warm = self.rng.random() < args.warm
+			self.nodes.append(SimNode(i + 1, self, profile, warm))
+		return
+
+	def profile(self, i):
+		d = dict(self._config.get('default', {}))
+		d.update(self._config.get('links', {}).get(str(i + 1), {}))
+		return LinkProfile.from_dict(d)
+
+	def count(self, key):
+		self._counts[key] += 1
+		return
+
+	def sent(self, event_id):
+		self._sent[event_id] = self.queue.now()
+		return
+
+	def bridge_udp(self, node, data):
+		# Journal copies, delivered unless the journal's came first
+		packets, _ = self._journal.unwrap(node.node_id, data, copy=True)
+		for packet in packets:
+			self.receive(node, packet)
+		return
+
+	def bridge_tcp(self, node, data):
+		packets, ack = self._journal.unwrap(node.node_id, data)
+		if ack:
+			node.tcp_reply(ack)
+		for packet in packets:
+			self.receive(node, packet)
+			# /pong offering our intern version (its last argument)
+			if packet.startswith(b'/pong\0') and packet.endswith(struct.pack('>i', intern.VERSION)):
+				node.tcp_reply(intern.intern_message())
+		return
+
+	def receive(self, node, data):
+		data = intern.decode(data)
+		if data is None:
+			self._counts['unknown'] += 1		# Interned with an unknown ID
+		elif data.startswith(b'/pong\0'):
+			self._discovered.add(node.node_id)
+		elif data.startswith(GATE_PREFIX):
+			event_id = struct.unpack('>i', data[-4:])[0]
+			if event_id in self._seen:
+				self._counts['dup'] += 1
+				return
+			self._seen.add(event_id)
+			self._latency.append(self.queue.now() - self._sent[event_id])
+		return
+
+	def ping(self):
+		for node in self.nodes:
+			node.broadcast(('/ping',))
+		if self._args.ping_interval:
+			self.queue.call_later(self._args.ping_interval, self.ping)
+		return
+
+	def run(self):
+		a = self._args
+		for node in self.nodes:
+			self.queue.call_at(self.rng.uniform(0, a.boot_spread), node.boot)
+		self.queue.call_at(a.boot_spread, self.ping)
+
+		# Poisson sensor edges per node after boot
+		event_id = 0
+		for node in self.nodes:
+			t = a.boot_spread + self.rng.expovariate(a.rate)
+			while t < a.duration:
+				self.queue.call_at(t, node.sensor_edge, event_id)
+				event_id += 1
+				t += self.rng.expovariate(a.rate)
+		self.queue.run_until(a.duration + 10.0)
+		return self.report()
+
+	def report(self):
+		sent = len(self._sent)
+		delivered = len(self._latency)
+		pct = percentiles(self._latency)
+		result = {
+			'nodes': len(self.nodes),
+			'discovered': len(self._discovered),
+			'events': sent,
+			'delivered': delivered,
+			'delivery_rate': delivered / float(sent) if sent else 0.0,
+			'latency_ms': dict(('p%g' % p, v * 1e3) for p, v in pct.items()),
+			'latency_max_ms': max(self._latency) * 1e3 if self._latency else float('nan'),
+			'sends': dict(self._counts),
+			'journal': dict(self._journal.stats, unacked=sum(n.unacked() for n in self.nodes)),
+		}
+		return result
+
+
+def print_report(r):
+	print("Nodes:          %d (%d discovered)" % (r['nodes'], r['discovered']))
+	print("Events:         %d sent, %d delivered (%.3f%%)" %
+		(r['events'], r['delivered'], 100.0 * r['delivery_rate']))
+	print("Sent via:       TCP %(tcp)d, UDP %(udp)d, no destination %(nodest)d, duplicates %(dup)d" % r['sends'])
+	print("Reconnects:     %(reconnects)d" % r['sends'])
+	print("Journal:        %d resent, %d duplicates dropped, %d lost, %d unacknowledged" %
+		(r['sends']['resent'], r['journal']['duplicates'], r['journal']['lost'], r['journal']['unacked']))
+	print("Latency (ms):   " + ', '.join("%s %.2f" % (k, v) for k, v in sorted(r['latency_ms'].items(),
+		key=lambda kv: float(kv[0][1:]))) + ", max %.2f" % r['latency_max_ms'])
+	return
+
+
+if __name__ == "__main__":
+
+	parser = argparse.ArgumentParser(description='Simulated device fleet soak test')
+	parser.add_argument('--nodes', type=int, default=1000, help='Number of simulated nodes')
+	parser.add_argument('--duration', type=float, default=60.0, help='Simulated seconds')
+	parser.add_argument('--rate', type=float, default=1.0, help='Sensor edges per node per second')
+	parser.add_argument('--boot-spread', type=float, default=5.0, help='Nodes boot uniformly over this many seconds')
+	parser.add_argument('--warm', type=float, default=1.0, help='Fraction of nodes with a stored destination')
+	parser.add_argument('--ping-interval', type=float, default=0.0, help='Rebroadcast /ping every N seconds (0: once)')
+	parser.add_argument('--profile', metavar='PROFILE', help='JSON link profile (netsim.Impairments format, links keyed by node ID)')
+	parser.add_argument('--loss', type=float, help='Override default loss probability')
+	parser.add_argument('--latency', type=float, help='Override default one-way latency (s)')
+	parser.add_argument('--jitter', type=float, help='Override default jitter (s)')
+	parser.add_argument('--reconnect', metavar='MIN,MAX', help='Reconnect TCP with backoff from MIN to MAX seconds')
+	parser.add_argument('--keepalive', type=float, help='Keepalive timeout (s) for detecting dead links')
+	parser.add_argument('--seed', type=int, default=1)
+	parser.add_argument('--json', action='store_true', help='Print the report as JSON')
+	args = parser.parse_args()
+
+	config = {}
+	if args.profile:
+		with open(args.profile) as f:
+			config = json.load(f)
+	config.setdefault('default', {'latency': 0.003, 'jitter': 0.002})
+	for key in ('loss', 'latency', 'jitter'):
+		if getattr(args, key) is not None:
+			config['default'][key] = getattr(args, key)
+
+	report = Soak(args, config).run()
+	if args.json:
+		print(json.dumps(report, indent=2))
+	else:
+		print_report(report)
@@ -0,0 +1,122 @@
+import argparse
+import math
+import random
+import struct
+import time
+
+# Encodings used by libiot AnalogStream
+RAW16 = 0
+DELTA_VARINT = 1
+
+# /stream <node_id> <seq> <t0_us> <rate_hz> <encoding> <blob>: address, type 
+# tags, five ints and the blob size
+OSC_OVERHEAD = 8 + 8 + 5 * 4 + 4
+
+# IPv4 + UDP headers
+UDP_OVERHEAD = 28
+
+
+def encode(samples, encoding):
+	"""Encode a block the way AnalogStream::encode() does"""
+	if encoding == RAW16:
+		return struct.pack('>%dH' % len(samples), *samples)
+	out = bytearray()
+	prev = 0
+	for s in samples:
+		delta = s - prev
+		zz = ((delta << 1) ^ (delta >> 31)) & 0xFFFFFFFF
+		prev = s
+		while zz >= 0x80:
+			out.append((zz & 0x7F) | 0x80)
+			zz >>= 7
+		out.append(zz)
+	return bytes(out)
+
+
+def decode(blob, encoding):
+	"""Decode a /stream blob into a list of samples"""
+	if encoding == RAW16:
+		return list(struct.unpack('>%dH' % (len(blob) // 2), blob))
+	samples = []
+	prev = 0
+	zz = 0
+	shift = 0
+	for b in blob:
+		zz |= (b & 0x7F) << shift
+		shift += 7
+		if b & 0x80:
+			continue
+		prev += (zz >> 1) ^ -(zz & 1)
+		samples.append(prev)
+		zz = 0
+		shift = 0
+	return samples
+
+
+class StreamMonitor:
+	"""Reassemble /stream blocks from one node; counts gaps and duplicates"""
+
+	def __init__(self):
+		self.next_seq = None
+		self.blocks = 0
+		self.lost = 0
+		self.duplicates = 0
+		return
+
+	def handle(self, node_id, seq, t0_us, rate_hz, encoding, blob):
+		"""Return (t0_us, rate_hz, samples), or None for a stale block"""
+		if self.next_seq is not None and seq < self.next_seq:
+			self.duplicates += 1
+			return None
+		if self.next_seq is not None:
+			self.lost += seq - self.next_seq
+		self.next_seq = seq + 1
+		self.blocks += 1
+		return (t0_us, rate_hz, decode(blob, encoding))
+
+
+def packet_bytes(blob_len):
+	return UDP_OVERHEAD + OSC_OVERHEAD + ((blob_len + 3) & ~3)
+
+
+def test_signal(n, rate, rng, bits=10, noise=2.0):
+	"""Slowly varying sensor signal with ADC noise"""
+	full = (1 << bits) - 1
+	return [min(full, max(0, int(full / 2 + full / 4 * math.sin(2 * math.pi * 3.0 * i / rate) 
+		+ rng.gauss(0, noise)))) for i in range(n)]
+
+
+if __name__ == "__main__":
+
+	parser = argparse.ArgumentParser(description='AnalogStream packet rate and codec benchmark')
+	parser.add_argument('--rates', default='500,1000,2000', help='Sample rates (Hz)')
+	parser.add_argument('--blocks', default='32,64,128,256', help='Block lengths (samples)')
+	parser.add_argument('--max-pps', type=float, default=100.0, help='Packet rate budget per node')
+	parser.add_argument('--max-bps', type=float, default=250e3, help='Link budget per node (bytes/s)')
+	parser.add_argument('--noise', type=float, default=2.0, help='Test signal noise (ADC counts)')
+	args = parser.parse_args()
+
+	rng = random.Random(1)
+	rates = [int(r) for r in args.rates.split(',')]
+	blocks = [int(b) for b in args.blocks.split(',')]
+
+	print("%6s %6s %8s %7s %9s %9s %10s %11s %9s" % ('rate', 'block', 'encoding', 'pkts/s',
+		'B/packet', 'B/s', 'max rate', 'decode us', 'latency'))
+	for block in blocks:
+		for rate in rates:
+			samples = test_signal(block * 20, rate, rng, noise=args.noise)
+			for encoding, name in ((RAW16, 'raw16'), (DELTA_VARINT, 'varint')):
+				blobs = [encode(samples[i:i+block], encoding) for i in range(0, len(samples), block)]
+				assert all(decode(b, encoding) == samples[i*block:(i+1)*block] for i, b in enumerate(blobs))
+
+				t = time.perf_counter()
+				for b in blobs:
+					decode(b, encoding)
+				decode_us = (time.perf_counter() - t) / len(blobs) * 1e6
+
+				size = sum(packet_bytes(len(b)) for b in blobs) / float(len(blobs))
+				pps = rate / float(block)
+				# Highest sample rate within both the packet and byte budgets
+				max_rate = min(args.max_pps * block, args.max_bps / size * block)
+				print("%6d %6d %8s %7.1f %9.0f %9.0f %10.0f %11.1f %7.0fms" % (rate, block, name, pps, 
+					size, pps * size, max_rate, decode_us, 1e3 * block / rate))
@@ -5,7 +5,25 @@ import selectors
 import types
 import asyncore
 import argparse
-
+import os
+import signal
+import struct
+import sys
+import time
+
+import clocksync
+from coalesce import Coalescer, parse_limit
+from directory import DeviceDirectory
+from flow import FlowManager
+import intern
+from journal import JournalReceiver, EVENT_HEADER
+import linkprobe
+from lvcache import LastValueCache
+from netsim import Impairments
+from oscstream import OSCStream, KEEPALIVE, frame
+from shmring import ShmRingWriter, UnixFanout
+import slip
+from pythonosc import osc_message
 from pythonosc import osc_message_builder
 from pythonosc import osc_server
 from pythonosc import dispatcher
@@ -37,6 +55,37 @@ class UDPClient:
 		self._sock.sendto(data, self._addr)
 		return
 
+	def send_to(self, data, addr):
+		self._sock.sendto(data, addr)
+		return
+
+def group_mask(spec):
+	"""Group mask from a group number, a comma-separated list of group numbers 
+	(0-30), or 'all' to address every node whether grouped or not"""
+	if isinstance(spec, int):
+		spec = str(spec)
+	if spec == 'all':
+		return 0x80000000
+	mask = 0
+	for group in spec.split(','):
+		group = int(group)
+		if group < 0 or group > 30:
+			raise ValueError("Group %d out of range" % group)
+		mask |= 1 << group
+	return mask
+
+def address_header(spec):
+	"""The header libiot nodes check before decoding a packet: a group header
+	for a group spec (see group_mask), or a node header for 'node:' and a
+	comma-separated list of node IDs at most 31 apart"""
+	if not (isinstance(spec, str) and spec.startswith('node:')):
+		return b'#grp' + struct.pack('>I', group_mask(spec))
+	nodes = set(int(node) for node in spec[5:].split(','))
+	base = min(nodes)
+	if base < 0 or max(nodes) - base > 31:
+		raise ValueError("Nodes must be 0 or more and at most 31 apart")
+	return b'#nod' + struct.pack('>iI', base, sum(1 << (node - base) for node in nodes))
+
 class OSCServer:
 
 	def __init__(self, addr, default_handler=None):
@@ -88,10 +137,18 @@ class OSCServer:
 
 class TCPClient(asyncore.dispatcher_with_send):
 
+	transport = 'tcp'
+
 	def __init__(self, addr, *args, **kwargs):
 		super(TCPClient, self).__init__(*args, **kwargs)
 		self._addr = addr
 		self._data_handler = None
+		self._close_handler = None
+		self._rx_link = None
+		self._tx_link = None
+		self._stream = OSCStream()
+		self.interning = False			# Send interned messages (intern.py)
+		self.rx_time = 0.0				# When the packet being handled arrived
 		return
 
 	def print_helper(self, description, addr=None, data=None, nl=False):
@@ -107,6 +164,16 @@ class TCPClient(asyncore.dispatcher_with_send):
 		self._data_handler = handler
 		return
 
+	def set_close_handler(self, handler):
+		self._close_handler = handler
+		return
+
+	def set_impairments(self, impairments):
+		self._rx_link = impairments.link(self._addr[0], self._deliver_rx, reliable=True)
+		self._tx_link = impairments.link(self._addr[0], self._deliver_tx, reliable=True)
+		self.print_helper("Impaired")
+		return
+
 	def handle_accept(self):
 		pair = self.accept()
 		if pair is not None:
@@ -117,15 +184,35 @@ class TCPClient(asyncore.dispatcher_with_send):
 	def handle_read(self):
 		data = self.recv(1024)
 		# self.print_helper("Data in:", data=data, nl=True)
-		if data and self._data_handler:
-			self._data_handler(self, data)
+		if not data:
+			self.handle_close()
+		elif self._rx_link:
+			if not self._rx_link.send(data):
+				self.print_helper("Link down")
+				self.close()
 		else:
-			self.close()
+			self._deliver_rx(data)
+		return
+
+	def _deliver_rx(self, data):
+		# One OSC packet per call, however the stream was segmented
+		self.rx_time = time.time()
+		for packet in self._stream.feed(data):
+			if self._data_handler:
+				self._data_handler(self, packet)
+		return
+
+	def _deliver_tx(self, data):
+		if self.connected:
+			super(TCPClient, self).send(data)
 		return
 
 	def handle_close(self):
 		self.print_helper("Disconnected")
 		self.close()
+		if self._close_handler:
+			self._close_handler(self)
+			self._close_handler = None
 		return
 
 	def hendle_error(self):
@@ -135,7 +222,171 @@ class TCPClient(asyncore.dispatcher_with_send):
 
 	def send(self, data):
 		self.print_helper("Data out:", data=data)
-		super(TCPClient, self).send(data)
+		self.send_quiet(data)
+		return
+
+	def send_quiet(self, data):
+		data = frame(data)				# One OSC packet per call
+		if not self._tx_link:
+			super(TCPClient, self).send(data)
+		elif not self._tx_link.send(data):
+			self.print_helper("Link down")
+			self.close()
+		return
+
+class SerialLink(asyncore.file_dispatcher):
+	"""A device wired to a serial port, OSC packets SLIP-framed (slip.py).
+	Handled like a TCPClient, with the port path as its address."""
+
+	transport = 'serial'
+
+	def __init__(self, path, baud):
+		fd = slip.open_serial(path, baud)
+		super(SerialLink, self).__init__(fd)
+		os.close(fd)
+		self._addr = (path, baud)
+		self._data_handler = None
+		self._close_handler = None
+		self._decoder = slip.Decoder()
+		self._out = b''
+		self._out_lock = threading.Lock()
+		self.interning = False			# Only offered over TCP
+		self.rx_time = 0.0				# When the packet being handled arrived
+		return
+
+	def print_helper(self, description, addr=None, data=None, nl=False):
+		print('') if nl else None
+		print("SerialLink %s:%d:" % self._addr, end=' ')
+		print("%12s" % description, end=' ')
+		print("%s:%d" % addr, end='') if addr else None
+		print("%a" % data, end='') if data else None
+		print(' ')
+		return
+
+	def set_data_handler(self, handler):
+		self._data_handler = handler
+		return
+
+	def set_close_handler(self, handler):
+		self._close_handler = handler
+		return
+
+	def handle_read(self):
+		data = self.recv(1024)
+		if not data:
+			self.handle_close()
+			return
+		self.rx_time = time.time()
+		for packet in self._decoder.feed(data):
+			if self._data_handler:
+				self._data_handler(self, packet)
+		return
+
+	def writable(self):
+		return len(self._out) > 0
+
+	def handle_write(self):
+		with self._out_lock:
+			sent = super(SerialLink, self).send(self._out)
+			self._out = self._out[sent:]
+		return
+
+	def handle_close(self):
+		self.print_helper("Closed")
+		self.close()
+		if self._close_handler:
+			self._close_handler(self)
+			self._close_handler = None
+		return
+
+	def send(self, data):
+		self.print_helper("Data out:", data=data)
+		self.send_quiet(data)
+		return
+
+	def send_quiet(self, data):
+		# (Called from the OSC server's thread as well as the loop)
+		with self._out_lock:
+			self._out += slip.encode(data)
+		self.handle_write()
+		return
+
+class ProbeEchoServer(asyncore.dispatcher):
+	"""Echoes devices' UDP link probes (linkprobe.py) back to them, and passes
+	the copies of journaled events they send over UDP to the event handler"""
+
+	def __init__(self, addr):
+		asyncore.dispatcher.__init__(self)
+		self._addr = addr
+		self._event_handler = None
+		self.num_echoed = 0
+		self.create_socket(socket.AF_INET, socket.SOCK_DGRAM)
+		self.bind(addr)
+		return
+
+	def set_event_handler(self, handler):
+		self._event_handler = handler
+		return
+
+	def writable(self):
+		return False
+
+	def handle_read(self):
+		data, addr = self.socket.recvfrom(1024)
+		if linkprobe.is_probe(data):
+			self.socket.sendto(data, addr)
+			self.num_echoed += 1
+		elif data.startswith(EVENT_HEADER) and self._event_handler:
+			self._event_handler(addr, data)
+		return
+
+class UDPSource:
+	"""Stands in for the link of a device heard from only over UDP"""
+
+	transport = 'udp'
+
+	def __init__(self, addr):
+		self._addr = addr
+		return
+
+	def send_quiet(self, data):
+		return
+
+class LocalServer(asyncore.dispatcher):
+	"""Polls a UnixFanout for consumer registrations and OSC packets. Packets
+	go to handlers by address; /resync and (if resync_on_attach) new
+	consumers go to the resync handler with the consumer's address"""
+
+	def __init__(self, fanout, handlers, resync_handler=None, resync_on_attach=False):
+		asyncore.dispatcher.__init__(self, sock=fanout._sock)
+		self._fanout = fanout
+		self._handlers = handlers
+		self._resync_handler = resync_handler
+		self._resync_on_attach = resync_on_attach
+		print("LocalServer %s: Serving" % fanout.path)
+		return
+
+	def writable(self):
+		return False
+
+	def handle_read(self):
+		packets, attached = self._fanout.receive()
+		for peer in attached:
+			print("LocalServer %s: Consumer %s" % (self._fanout.path, peer))
+			if self._resync_on_attach and self._resync_handler:
+				self._resync_handler(peer)
+		for peer, packet in packets:
+			try:
+				msg = osc_message.OscMessage(packet)
+			except Exception:
+				print("LocalServer %s: Malformed packet" % self._fanout.path)
+				continue
+			if msg.address == '/resync' and self._resync_handler:
+				self._resync_handler(peer)
+				continue
+			handler = self._handlers.get(msg.address)
+			if handler:
+				handler(msg.address, *msg.params)
 		return
 
 class TCPServer(asyncore.dispatcher):
@@ -147,6 +398,8 @@ class TCPServer(asyncore.dispatcher):
 		else:
 			self._addr = addr
 		self._clients = {}
+		self._impairments = None
+		self._directory = None
 		self.create_socket(socket.AF_INET, socket.SOCK_STREAM)
 		self.set_reuse_addr()
 		self.bind(self._addr)
@@ -168,13 +421,53 @@ class TCPServer(asyncore.dispatcher):
 		self._data_handler = handler
 		return
 
+	def set_impairments(self, impairments):
+		self._impairments = impairments
+		return
+
+	def set_directory(self, directory):
+		self._directory = directory
+		return
+
 	def handle_accept(self):
 		pair = self.accept()
 		if pair is not None:
 			sock, addr = pair
 			self.print_helper("Accepted", addr)
-			self._clients[addr[0]] = TCPClient(addr, sock)
-			self._clients[addr[0]].set_data_handler(self._data_handler)
+
+			# A device that reconnects replaces its (half-open) old connection
+			old = self._clients.get(addr[0])
+			if old:
+				old.set_close_handler(None)
+				old.close()
+
+			# (Small packets like clock sync replies go out right away)
+			sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+			client = TCPClient(addr, sock)
+			client.set_data_handler(self._data_handler)
+			client.set_close_handler(self.handle_client_close)
+			if self._impairments:
+				client.set_impairments(self._impairments)
+			self._clients[addr[0]] = client
+			if self._directory:
+				self._directory.touch(addr[0], 'tcp')
+		return
+
+	def attach(self, link):
+		"""Route a SerialLink's packets like a client's, and /tcp messages
+		addressed to its path to it"""
+		link.set_data_handler(self._data_handler)
+		link.set_close_handler(self.handle_client_close)
+		self._clients[link._addr[0]] = link
+		if self._directory:
+			self._directory.touch(link._addr[0], link.transport)
+		return
+
+	def handle_client_close(self, client):
+		if self._clients.get(client._addr[0]) is client:
+			del self._clients[client._addr[0]]
+			if self._directory:
+				self._directory.touch(client._addr[0], 'udp')
 		return
 
 	def handle_read(self):
@@ -218,24 +511,279 @@ if __name__ == "__main__":
 			tcp_client = tcp_server._clients[dest_addr]
 			print("-- Routing OSC Message: (UDP) %s:%d" % udp_server._addr, end=' ')
 			print("--> (TCP) %s:%d" % tcp_client._addr)
-			tcp_client.send(msg.dgram)
+			tcp_client.send(intern.encode(msg.dgram) if tcp_client.interning else msg.dgram)
 		except:
 			print("\nNo TCP Client %s:%d" % tcp_client._addr)
 		return
 	
 
+	# Group-addressed UDP broadcast
+	def handle_group(addr, *args):
+
+		if len(args) < 2:
+			print("Invalid /group message...\n")
+			print("	Usage: /group [groups] [/oscpath] [arg1] ... [argN]\n")
+			return
+
+		try:
+			header = address_header(args[0])
+		except ValueError as e:
+			print("Invalid group '%s': %s" % (args[0], e))
+			return
+
+		builder = osc_message_builder.OscMessageBuilder(args[1])
+		[builder.add_arg(val) for val in args[2:]]
+		msg = builder.build()
+
+		print("-- Routing OSC Message: (UDP) %s:%d" % udp_server._addr, end=' ')
+		print("--> (UDP) groups %s" % args[0])
+		broadcast_client.send(header + msg.dgram)
+		return
+
+	# Group-addressed bundle, run by the devices on their synchronized clocks
+	def handle_at(addr, *args):
+
+		if len(args) < 3:
+			print("Invalid /at message...\n")
+			print("	Usage: /at [delay_ms] [groups] [/oscpath] [arg1] ... [argN]\n")
+			return
+
+		try:
+			header = address_header(args[1])
+		except ValueError as e:
+			print("Invalid group '%s': %s" % (args[1], e))
+			return
+
+		builder = osc_message_builder.OscMessageBuilder(args[2])
+		[builder.add_arg(val) for val in args[3:]]
+		bundle = clocksync.make_bundle(time.time() + args[0] / 1000.0, builder.build().dgram)
+
+		print("-- Routing OSC Bundle: (UDP) %s:%d" % udp_server._addr, end=' ')
+		print("--> (UDP) groups %s in %d ms" % (args[1], args[0]))
+		broadcast_client.send(header + bundle)
+		return
+
+	# Device directory queries and subscriptions from Max
+	def send_directory_entry(path, entry):
+		builder = osc_message_builder.OscMessageBuilder(path)
+		[builder.add_arg(val) for val in (entry.dev_id, entry.node_id, entry.addr, entry.transport)]
+		if path == '/dir/entry':
+			builder.add_arg(float(directory.age(entry)))
+		udp_client.send(builder.build().dgram)
+		return
+
+	def send_directory_delta(kind, entry):
+		send_directory_entry('/dir/' + kind, entry)
+		return
+
+	def handle_dir_list(addr, *args):
+		entries = directory.entries()
+		for entry in entries:
+			send_directory_entry('/dir/entry', entry)
+		builder = osc_message_builder.OscMessageBuilder('/dir/end')
+		builder.add_arg(len(entries))
+		udp_client.send(builder.build().dgram)
+		return
+
+	def handle_dir_subscribe(addr, *params):
+		directory.unsubscribe(send_directory_delta)
+		if not params or params[0]:
+			for entry in directory.entries():
+				send_directory_delta('add', entry)
+			directory.subscribe(send_directory_delta)
+
+			# Max (re)started
+			if args.resync_on_attach:
+				handle_resync(addr)
+		return
+
+	# Current device values from the last-value cache, as bundles, then
+	# /resync/end <n>
+	def send_resync(send):
+		bundles = cache.snapshot()
+		for bundle in bundles:
+			send(bundle)
+		builder = osc_message_builder.OscMessageBuilder('/resync/end')
+		builder.add_arg(len(cache))
+		send(builder.build().dgram)
+		print("-- Resync: %d values in %d bundles" % (len(cache), len(bundles)))
+		return
+
+	def handle_resync(addr, *args):
+		send_resync(udp_client.send)
+		return
+
+	def handle_local_resync(peer):
+		send_resync(lambda data: fanout.send_to(data, peer))
+		return
+
+	# Devices that leave the directory leave the cache too
+	def handle_directory_cache(kind, entry):
+		if kind == 'expire':
+			cache.forget(entry.addr)
+		return
+
+	# Devices that answered a UDP /ping (seen by Max, not the bridge)
+	def handle_dir_seen(addr, *args):
+		if len(args) < 3:
+			print("Invalid /dir/seen message...\n")
+			print("	Usage: /dir/seen [dev_id] [node_id] [addr]\n")
+			return
+		link = tcp_server._clients.get(args[2])
+		transport = link.transport if link else 'udp'
+		directory.observe(args[0], args[1], args[2], transport)
+		return
+
+	# Flow control messages to a device (TCP if connected, else UDP)
+	def send_flow(source, args):
+		builder = osc_message_builder.OscMessageBuilder('/flow')
+		[builder.add_arg(val) for val in args]
+		dgram = builder.build().dgram
+		tcp_client = tcp_server._clients.get(source)
+		if tcp_client:
+			tcp_client.send_quiet(dgram)
+		else:
+			broadcast_client.send_to(dgram, (source, iot_port))
+		return
+
+	def handle_flow_list(addr, *args):
+		rows = flow.rows() if flow else []
+		for row in rows:
+			builder = osc_message_builder.OscMessageBuilder('/flow/entry')
+			[builder.add_arg(val) for val in row]
+			udp_client.send(builder.build().dgram)
+		builder = osc_message_builder.OscMessageBuilder('/flow/end')
+		builder.add_arg(len(rows))
+		udp_client.send(builder.build().dgram)
+		return
+
 	def handle_tcp_to_udp(tcp_client, data):
+
+		# Any traffic renews the device's lease
+		directory.touch(tcp_client._addr[0])
+
+		# Keepalives, link probes and clock sync requests are answered on the 
+		# same connection, not forwarded
+		if data == KEEPALIVE or linkprobe.is_probe(data):
+			tcp_client.send_quiet(data)
+			return
+		seq = clocksync.parse_request(data)
+		if seq is not None:
+			tcp_client.send_quiet(clocksync.make_response(seq, tcp_client.rx_time))
+			return
+
+		# Journaled events are acknowledged, deduplicated and unwrapped
+		packets, ack = journal.unwrap(tcp_client._addr[0], data)
+		if ack:
+			tcp_client.send_quiet(ack)
+		for packet in packets:
+			route_device_message(tcp_client, packet)
+
+	# Copies of journaled events sent over UDP while it is the faster link
+	# (or before TCP is up), delivered unless the journal's came first
+	def handle_udp_event(addr, data):
+		directory.touch(addr[0])
+		packets, _ = journal.unwrap(addr[0], data, copy=True)
+		for packet in packets:
+			route_device_message(UDPSource(addr), packet)
+
+	def route_device_message(tcp_client, data):
+		data = intern.decode(data)
+		if data is None:
+			print("Unknown interned address from %s:%d" % tcp_client._addr)
+			return
+		if flow:
+			flow.count(tcp_client._addr[0])
+		cache.update(tcp_client._addr[0], data)
+
+		# /pong <dev_id> <node_id> <addr> [<intern_version>] identifies the 
+		# device on this link, and offers interning; TCP devices also learn 
+		# where to probe UDP
+		if data.startswith(b'/pong\0'):
+			try:
+				msg = osc_message.OscMessage(data)
+				directory.observe(msg.params[0], msg.params[1], tcp_client._addr[0], tcp_client.transport)
+				if not args.no_intern and tcp_client.transport == 'tcp' and msg.params[3:4] == [intern.VERSION]:
+					tcp_client.send_quiet(intern.intern_message())
+					tcp_client.interning = True
+				if probe_server and tcp_client.transport == 'tcp':
+					tcp_client.send_quiet(linkprobe.port_message(probe_server._addr[1]))
+			except Exception:
+				print("Malformed /pong from %s:%d" % tcp_client._addr)
 		
+		# Loop stalls go to the bridge log too
+		if data.startswith(b'/profile/stall\0'):
+			try:
+				msg = osc_message.OscMessage(data)
+				print("Stall: node %d, %.1f ms in %s (%d stalls)" % (msg.params[0], msg.params[2] / 1000.0,
+					msg.params[1], msg.params[3]))
+			except Exception:
+				print("Malformed /profile/stall from %s:%d" % tcp_client._addr)
+
+		# And sleeping nodes' wake reports (sent on each wake's connect)
+		if data.startswith(b'/sleep/stats\0'):
+			try:
+				p = osc_message.OscMessage(data).params
+				print("Sleep: node %d woke (%s), sent at %.1f ms (max %.1f ms), last awake %d ms; %d wakes, %d cold, %d fallbacks, %d over budget" %
+					(p[0], p[1], p[6] / 1000.0, p[7] / 1000.0, p[8], p[2], p[3], p[4], p[5]))
+			except Exception:
+				print("Malformed /sleep/stats from %s:%d" % tcp_client._addr)
+
+		# So do bundle scheduling errors, with the spread across nodes so far
+		if data.startswith(clocksync.ERROR_HEADER):
+			report = clocksync.parse_error(data)
+			if report:
+				nodes, lo, hi = clock_errors.add(*report)
+				print("Clock: node %d ran bundle %.3f at %+d us (%d nodes, spread %d us)" % (report[0],
+					(report[1] >> 32) + (report[1] & 0xFFFFFFFF) / 2.0 ** 32, report[2], nodes, hi - lo))
+
 		# eff = tcp_client._addr + (udp_client._addr, udp_client._port)
-		print("-- Routing OSC Message: (TCP) %s:%d" % tcp_client._addr, end=' ')
+		print("-- Routing OSC Message: (%s) %s:%d" % ((tcp_client.transport.upper(),) + tcp_client._addr), end=' ')
 		print("--> (UDP) %s:%d" % udp_client._addr)
-		udp_client.send(data)
+		for packet in coalescer.submit(tcp_client._addr[0], data):
+			udp_client.send(packet)
+
+		# Local fast paths (not coalesced)
+		if ring:
+			ring.write(data)
+		if fanout:
+			fanout.send(data)
 
 
 	# Create parser for command line arguments
 	parser = argparse.ArgumentParser(description='UDP to TCP bridge')
 	parser.add_argument('iot_port', help='Port number used by IoT devices')
 	parser.add_argument('local_port', help='Local port number for bridge')
+	parser.add_argument('--impair', metavar='PROFILE', 
+		help='JSON link profile applied to device TCP links (see netsim.py)')
+	parser.add_argument('--snapshot', metavar='FILE',
+		help='Device directory snapshot, loaded on start and saved periodically')
+	parser.add_argument('--lease', type=float, default=600.0,
+		help='Seconds after which a silent device is dropped from the directory')
+	parser.add_argument('--shm', metavar='FILE',
+		help='Also publish device messages to a shared-memory ring (e.g. /dev/shm/dslbridge)')
+	parser.add_argument('--shm-size', type=int, default=1 << 20,
+		help='Ring capacity in bytes (a power of two)')
+	parser.add_argument('--unix', metavar='PATH',
+		help='Unix datagram socket for local consumers (e.g. /tmp/dslbridge.sock)')
+	parser.add_argument('--no-intern', action='store_true',
+		help="Don't accept devices' offers of interned OSC addresses (see intern.py)")
+	parser.add_argument('--coalesce', type=float, default=0.0, metavar='MS',
+		help='Frame interval for latest-value coalescing of device messages to Max (0: off)')
+	parser.add_argument('--rate', action='append', default=[], type=parse_limit, metavar='PATH=RATE[:BURST]',
+		help='Limit a path (trailing * for a prefix) to RATE messages/s per device; repeatable')
+	parser.add_argument('--priority', action='append', default=['/pong'], metavar='PATH',
+		help='Path (trailing * for a prefix) that bypasses coalescing and rate limits; repeatable')
+	parser.add_argument('--flow-limit', type=float, metavar='RATE',
+		help='Throttle the heaviest devices (/flow) while they send more than RATE messages/s in total')
+	parser.add_argument('--cache', action='append', default=['/gate'], metavar='PATH',
+		help='Path (trailing * for a prefix) of device state to keep for /resync, besides /gate; repeatable')
+	parser.add_argument('--resync-on-attach', action='store_true',
+		help='Send the cached device values to Max when it subscribes to the directory, and to new local consumers')
+	parser.add_argument('--probe-port', type=int, metavar='PORT',
+		help='UDP port echoing link probes, so devices can compare UDP with TCP (default: iot_port + 1; 0: off)')
+	parser.add_argument('--serial', action='append', default=[], metavar='PATH[:BAUD]',
+		help='Serial port of a wired device (SLIP, see slip.py; default 921600 baud); repeatable')
 
 	# Parse
 	args = parser.parse_args()
@@ -247,15 +795,108 @@ if __name__ == "__main__":
 	# Local UDP Client (e.g Max/MSP) --> Local UDP server --> TCP Clients
 	udp_server = OSCServer(('localhost', udp_server_port))
 	udp_server.dispatch('/tcp', handle_udp_to_tcp)
+	udp_server.dispatch('/group', handle_group)
+	udp_server.dispatch('/at', handle_at)
+	udp_server.dispatch('/dir/list', handle_dir_list)
+	udp_server.dispatch('/dir/subscribe', handle_dir_subscribe)
+	udp_server.dispatch('/dir/seen', handle_dir_seen)
+	udp_server.dispatch('/flow/list', handle_flow_list)
+	udp_server.dispatch('/resync', handle_resync)
+
+	# Device directory (warm-started from the snapshot, if any)
+	directory = DeviceDirectory(lease=args.lease, path=args.snapshot)
+	if args.snapshot:
+		print("Loaded %d devices from %s" % (directory.load(), args.snapshot))
+
+	# Last value of every device path, for /resync
+	cache = LastValueCache(args.cache)
+	directory.subscribe(handle_directory_cache)
+
+	# Events journaled by devices across disconnects
+	journal = JournalReceiver()
+
+	# Scheduling errors reported by devices running timetagged bundles
+	clock_errors = clocksync.ErrorReport()
 
 	# TCP Clients --> TCP Server --> Local UDP Client
 	tcp_server = TCPServer(('', iot_port))
 	tcp_server.set_data_handler(handle_tcp_to_udp)
+	tcp_server.set_directory(directory)
 	udp_client = UDPClient(('localhost', iot_port))
 
+	# Local UDP Client --> Local UDP server --> UDP broadcast to device groups
+	broadcast_client = UDPClient(('255.255.255.255', iot_port))
+
+	# Local consumers: shared-memory ring and Unix datagram socket, which also
+	# accepts /tcp and /group
+	ring = ShmRingWriter(args.shm, args.shm_size) if args.shm else None
+	fanout = UnixFanout(args.unix) if args.unix else None
+	if fanout:
+		LocalServer(fanout, {'/tcp': handle_udp_to_tcp, '/group': handle_group, '/at': handle_at},
+			handle_local_resync, args.resync_on_attach)
+
+	# Coalescing and rate shaping of device messages to Max
+	coalescer = Coalescer(args.coalesce / 1000.0, args.rate, args.priority)
+
+	# Flow control of devices when their total rate exceeds the limit
+	flow = FlowManager(args.flow_limit, send_flow) if args.flow_limit else None
+
+	# Optional network fault injection on device links
+	impairments = None
+	if args.impair:
+		impairments = Impairments.load(args.impair)
+		tcp_server.set_impairments(impairments)
+
+	# UDP echo for devices' link probes
+	probe_port = iot_port + 1 if args.probe_port is None else args.probe_port
+	probe_server = None
+	if probe_port:
+		try:
+			probe_server = ProbeEchoServer(('', probe_port))
+			probe_server.set_event_handler(handle_udp_event)
+		except OSError as e:
+			print("No link probe echo on port %d: %s" % (probe_port, e))
+
+	# Wired devices, asked to identify themselves
+	for spec in args.serial:
+		path, _, baud = spec.partition(':')
+		link = SerialLink(path, int(baud or 921600))
+		tcp_server.attach(link)
+		link.send(osc_message_builder.OscMessageBuilder('/ping').build().dgram)
+
 	# Go
 	print('')
 	udp_server.begin()
 	tcp_server.begin()
-	asyncore.loop()
+	# Save the directory on kill as well as Ctrl-C
+	signal.signal(signal.SIGTERM, lambda signum, frame: sys.exit(0))
+	try:
+		while True:
+			timeout = impairments.poll_interval(max_wait=1.0) if impairments else 1.0
+			timeout = coalescer.poll_interval(max_wait=timeout)
+			asyncore.loop(timeout=timeout, count=1)
+			if impairments:
+				impairments.queue.run_pending()
+			for packet in coalescer.poll():
+				udp_client.send(packet)
+			directory.tick()
+			if flow:
+				flow.tick()
+	finally:
+		if coalescer.enabled():
+			print("Coalescer: %(in)d in, %(out)d out, %(bypass)d bypassed, %(coalesced)d coalesced" % coalescer.stats)
+		if flow:
+			print("Flow: %(throttles)d throttles, %(releases)d releases, %(renewals)d renewals" % flow.stats)
+		if journal.stats['events']:
+			print("Journal: %(events)d events, %(duplicates)d duplicates, %(lost)d lost, max age %(max_age_ms)d ms" % journal.stats)
+		if probe_server and probe_server.num_echoed:
+			print("Links: %d UDP probes echoed" % probe_server.num_echoed)
+		if clock_errors.stats['reports']:
+			print("Clock: %(bundles)d bundles, %(reports)d reports, max error %(max_error_us)d us, max spread %(max_spread_us)d us" % clock_errors.stats)
+		if args.snapshot:
+			directory.save()
+		if ring:
+			ring.close()
+		if fanout:
+			fanout.close()
 
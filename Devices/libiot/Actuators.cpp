@@ -0,0 +1,252 @@
+/* Actuators.cpp
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "Actuators.h"
+
+// Static timer handlers
+static void _s_act_handle_ramp_timer(void *arg) {
+	Actuators *self = (Actuators *)arg;
+	self->handle_ramp_timer();
+}
+
+static void _s_act_handle_pulse_timer(void *arg) {
+	Actuators::end_pulse(*(ActuatorChannel *)arg);
+}
+
+static float get_number(OSCMessage &msg, int idx, float default_value) {
+	if (msg.isInt(idx))
+		return msg.getInt(idx);
+	if (msg.isFloat(idx))
+		return msg.getFloat(idx);
+	return default_value;
+}
+
+// Public:
+// ============================================================================
+Actuators::Actuators() : Actuators(NULL) {
+
+}
+
+Actuators::Actuators(Stream *debug_serial) : num_channels(0), sched(NULL), 
+debug_serial(debug_serial) {
+	ramp_timer.set_handler(&_s_act_handle_ramp_timer, (void *)this);
+}
+
+int Actuators::add_digital(int pin, bool active_low) {
+	return add(ActuatorMode::Digital, pin, active_low, NULL);
+}
+
+int Actuators::add_pwm(int pin) {
+	analogWriteRange(ACT_PWM_RANGE);
+	return add(ActuatorMode::Pwm, pin, false, NULL);
+}
+
+int Actuators::add_pulse(int pin, bool active_low) {
+	return add(ActuatorMode::Pulse, pin, active_low, NULL);
+}
+
+int Actuators::add_led(LEDPin *led, ActuatorMode mode) {
+	if (mode == ActuatorMode::Pwm)
+		return -1;
+	return add(mode, -1, false, led);
+}
+
+bool Actuators::command(uint8_t channel, int32_t value, uint32_t ramp_ms) {
+	if (channel >= num_channels)
+		return false;
+	ActuatorChannel &ch = channels[channel];
+	if (ch.mode == ActuatorMode::Pwm && AnalogStream::timer_in_use())
+		return false;
+	ch.num_commands++;
+	if (ch.pending)
+		ch.num_coalesced++;
+	ch.pending = true;
+	ch.command = value;
+	ch.command_ms = ramp_ms;
+	return true;
+}
+
+bool Actuators::handle_message(OSCMessage &msg) {
+	if (msg.size() < 2 || !msg.isInt(0))
+		return false;
+	return command(msg.getInt(0), get_number(msg, 1, 0), get_number(msg, 2, 0));
+}
+
+void Actuators::loop() {
+	for (uint8_t i = 0; i < num_channels; i++) {
+		if (channels[i].pending)
+			apply(channels[i]);
+	}
+	if (sched)
+		return;
+
+	// Without a scheduler, ramps and pulses are polled
+	step_ramps();
+	for (uint8_t i = 0; i < num_channels; i++) {
+		ActuatorChannel &ch = channels[i];
+		if (ch.pulsing && millis() - ch.pulse_t0 >= (uint32_t)ch.value)
+			end_pulse(ch);
+	}
+}
+
+const char *Actuators::mode_name(ActuatorMode mode) {
+	switch (mode) {
+		case ActuatorMode::Pwm:		return "pwm";
+		case ActuatorMode::Pulse:	return "pulse";
+		default:					return "digital";
+	}
+}
+
+bool Actuators::pwm_active() {
+	for (uint8_t i = 0; i < num_channels; i++) {
+		ActuatorChannel &ch = channels[i];
+		if (ch.mode == ActuatorMode::Pwm && (ch.value || ch.ramp_ms || (ch.pending && ch.command > 0)))
+			return true;
+	}
+	return false;
+}
+
+void Actuators::handle_ramp_timer() {
+	if (step_ramps())
+		sched->add(&ramp_timer, ACT_RAMP_INTERVAL_MS);
+}
+
+// Protected:
+// ============================================================================
+int Actuators::add(ActuatorMode mode, int pin, bool active_low, LEDPin *led) {
+
+	if (num_channels == ACT_MAX_CHANNELS)
+		return -1;
+	ActuatorChannel &ch = channels[num_channels];
+	ch = ActuatorChannel();
+	ch.mode = mode;
+	ch.pin = pin;
+	ch.active_low = active_low;
+	ch.led = led;
+	ch.pulse_step.lit = true;
+	ch.pulse_timer.set_handler(&_s_act_handle_pulse_timer, (void *)&ch);
+	if (!led) {
+		pinMode(pin, OUTPUT);
+		write(ch, 0);
+	}
+	print_channel("Actuator added", num_channels);
+	return num_channels++;
+}
+
+/* Act on the channel's latest command */
+void Actuators::apply(ActuatorChannel &ch) {
+
+	ch.pending = false;
+	ch.num_applied++;
+	int32_t v = ch.command;
+	switch (ch.mode) {
+		case ActuatorMode::Digital:
+			ch.value = v != 0;
+			write(ch, ch.value);
+			break;
+
+		// Ramp from wherever the output is now (mid-ramp included)
+		case ActuatorMode::Pwm:
+			v = v < 0 ? 0 : (v > ACT_PWM_RANGE ? ACT_PWM_RANGE : v);
+			if (ch.command_ms) {
+				ch.ramp_from = ch.value;
+				ch.ramp_to = v;
+				ch.ramp_t0 = millis();
+				ch.ramp_ms = ch.command_ms;
+				if (sched && !ramp_timer.pending())
+					sched->add(&ramp_timer, ACT_RAMP_INTERVAL_MS);
+			}
+			else {
+				ch.ramp_ms = 0;
+				ch.value = v;
+				write(ch, v);
+			}
+			break;
+
+		// A new pulse restarts the pulse in progress
+		case ActuatorMode::Pulse:
+			ch.value = v < 0 ? 0 : (v > ACT_MAX_PULSE_MS ? ACT_MAX_PULSE_MS : v);
+			if (ch.led) {
+				ch.pulse_step.ms = ch.value;
+				if (ch.value)
+					ch.led->play(&ch.pulse_step, 1, 1, LED_PRIORITY_ALERT);
+				else if (ch.led->get_priority() == LED_PRIORITY_ALERT)
+					ch.led->stop();
+			}
+			else if (!ch.value) {
+				if (sched)
+					sched->cancel(&ch.pulse_timer);
+				end_pulse(ch);
+			}
+			else {
+				write(ch, 1);
+				ch.pulsing = true;
+				ch.pulse_t0 = millis();
+				if (sched)
+					sched->add(&ch.pulse_timer, ch.value);
+			}
+			break;
+	}
+}
+
+/* Move ramping PWM channels along; return whether any are still ramping */
+bool Actuators::step_ramps() {
+	uint32_t now = millis();
+	bool ramping = false;
+	for (uint8_t i = 0; i < num_channels; i++) {
+		ActuatorChannel &ch = channels[i];
+		if (!ch.ramp_ms)
+			continue;
+		uint32_t elapsed = now - ch.ramp_t0;
+		if (elapsed >= ch.ramp_ms) {
+			ch.value = ch.ramp_to;
+			ch.ramp_ms = 0;
+		}
+		else {
+			ch.value = ch.ramp_from + (int32_t)((int64_t)(ch.ramp_to - ch.ramp_from) * elapsed / ch.ramp_ms);
+			ramping = true;
+		}
+		write(ch, ch.value);
+	}
+	return ramping;
+}
+
+void Actuators::write(ActuatorChannel &ch, int32_t level) {
+	if (ch.led)
+		ch.led->set(level != 0);
+	else if (ch.mode == ActuatorMode::Pwm)
+		analogWrite(ch.pin, level);
+	else
+		digitalWrite(ch.pin, (level != 0) != ch.active_low ? HIGH : LOW);
+}
+
+/* Switch a pulse channel off */
+void Actuators::end_pulse(ActuatorChannel &ch) {
+	ch.pulsing = false;
+	write(ch, 0);
+}
+
+// Print utilities:
+// ============================================================================
+void Actuators::print_channel(char *description, uint8_t i) {
+	if (debug_serial)
+		debug_serial->printf("\n%24s: %u (%s, pin %d%s)\n", description, i, 
+			mode_name(channels[i].mode), channels[i].pin, channels[i].led ? ", LED" : "");
+}
@@ -0,0 +1,147 @@
+/* Actuators.h
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef ACTUATORS_H
+#define ACTUATORS_H
+
+#include <OSCMessage.h>
+#include "Arduino.h"
+#include "Scheduler.h"
+#include "LEDPin.h"
+#include "AnalogStream.h"
+
+#ifndef ACT_MAX_CHANNELS
+#define ACT_MAX_CHANNELS 8
+#endif
+
+// PWM levels run from 0 to ACT_PWM_RANGE; ramps step every 
+// ACT_RAMP_INTERVAL_MS
+#ifndef ACT_PWM_RANGE
+#define ACT_PWM_RANGE 1023
+#endif
+#ifndef ACT_RAMP_INTERVAL_MS
+#define ACT_RAMP_INTERVAL_MS 10
+#endif
+#define ACT_MAX_PULSE_MS 60000
+
+enum class ActuatorMode : uint8_t {
+	Digital = 0,	// On or off
+	Pwm,			// Level, optionally ramped to
+	Pulse			// On for a number of ms, then off
+};
+
+struct ActuatorChannel {
+
+	ActuatorMode mode;
+	int pin;
+	bool active_low;
+	LEDPin *led;				// Drives an LEDPin instead of the pin
+
+	// Latest command, applied on the next loop()
+	bool pending;
+	int32_t command;
+	uint32_t command_ms;
+
+	// Output: level (digital, PWM) or pulse length in ms (pulse)
+	int32_t value;
+	int32_t ramp_from;
+	int32_t ramp_to;
+	uint32_t ramp_t0;
+	uint32_t ramp_ms;			// 0 when not ramping
+	bool pulsing;
+	uint32_t pulse_t0;
+	LEDStep pulse_step;
+	Timer pulse_timer;
+
+	uint32_t num_commands;
+	uint32_t num_applied;
+	uint32_t num_coalesced;		// Commands replaced before they were applied
+};
+
+/* Output channels driven by OSC commands. Handlers only record the latest 
+   command per channel; loop() applies it, so a burst of commands costs one 
+   output update per loop() iteration, and the ones it replaced are counted 
+   as coalesced. PWM ramps and pulse ends run from scheduler timers (or from 
+   loop() without a scheduler), never in the handler. Digital and pulse 
+   channels can drive an LEDPin instead of a pin: digital sets its resting 
+   state, and a pulse plays over its patterns at alert priority. PWM 
+   (analogWrite()) runs on timer1, which AnalogStream takes over, so PWM 
+   commands are refused while a stream runs; don't start one while 
+   pwm_active(). */
+class Actuators {
+
+public:
+
+	Actuators();
+	Actuators(Stream *debug_serial);
+
+	void attach(Scheduler *scheduler)	{ sched = scheduler; }
+
+	// Add a channel (the pin is set up as an output); return its index, or 
+	// -1 if there is no room
+	int add_digital(int pin, bool active_low = false);
+	int add_pwm(int pin);
+	int add_pulse(int pin, bool active_low = false);
+	int add_led(LEDPin *led, ActuatorMode mode);
+
+	// Set a channel: 0/1 (digital), a level ramped to over ramp_ms (PWM), or 
+	// a pulse length in ms, 0 to end it (pulse); false for a PWM channel 
+	// while an AnalogStream runs
+	bool command(uint8_t channel, int32_t value, uint32_t ramp_ms = 0);
+
+	// /act <channel> <value> [<ramp_ms>]
+	bool handle_message(OSCMessage &msg);
+
+	// Apply pending commands; call from loop()
+	void loop();
+
+	// Whether a PWM channel is on, ramping or about to be (so timer1 is 
+	// taken)
+	bool pwm_active();
+
+	// Getters
+	uint8_t get_num_channels()						{ return num_channels; 	}
+	const ActuatorChannel &get_channel(uint8_t i)	{ return channels[i]; 	}
+
+	static const char *mode_name(ActuatorMode mode);
+
+	// Timer handlers; must be public for the static handlers
+	void handle_ramp_timer();
+	static void end_pulse(ActuatorChannel &ch);
+
+protected:
+
+	int add(ActuatorMode mode, int pin, bool active_low, LEDPin *led);
+	void apply(ActuatorChannel &ch);
+	bool step_ramps();
+	static void write(ActuatorChannel &ch, int32_t level);
+
+	// Print utilities
+	void print_channel(char *description, uint8_t i);
+
+	ActuatorChannel channels[ACT_MAX_CHANNELS];
+	uint8_t num_channels;
+
+	Scheduler *sched;
+	Timer ramp_timer;
+	Stream *debug_serial;
+};
+
+#endif
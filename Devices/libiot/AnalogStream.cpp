@@ -0,0 +1,183 @@
+/* AnalogStream.cpp
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "AnalogStream.h"
+#include "Arduino.h"
+
+// Timer1 ticks at 80 MHz / 16
+static const uint32_t TIMER1_HZ = 5000000;
+
+static AnalogStream *active_stream = NULL;
+
+// Static event handlers:
+// ============================================================================
+static ICACHE_RAM_ATTR void _s_analog_stream_isr() {
+	if (active_stream)
+		active_stream->sample();
+}
+
+// Public:
+// ============================================================================
+AnalogStream::AnalogStream(int analog_pin) : AnalogStream(analog_pin, NULL) {
+
+}
+
+AnalogStream::AnalogStream(int analog_pin, Stream *debug_serial) :
+pin(analog_pin), debug_serial(debug_serial), active(false), paused(false), rate(0), 
+block_len(0), encoding(StreamEncoding::Raw16), node_id(0), filling(0), 
+ready(-1), n_samples(0), seq(0), num_overruns(0), num_blocks(0), 
+num_bytes(0), block_handler(NULL), user_data(NULL) {
+
+}
+
+AnalogStream::~AnalogStream() {
+	stop();
+}
+
+bool AnalogStream::start(uint32_t rate_hz, uint16_t len, StreamEncoding enc) {
+
+	if (!rate_hz || rate_hz > ANALOG_STREAM_MAX_HZ || !len || len > ANALOG_STREAM_MAX_BLOCK)
+		return false;
+	if (active_stream && active_stream != this)
+		return false;
+	stop();
+
+	rate = rate_hz;
+	block_len = len;
+	encoding = enc;
+	filling = 0;
+	ready = -1;
+	n_samples = 0;
+	active = true;
+	active_stream = this;
+
+	paused = false;
+
+	timer1_isr_init();
+	timer1_attachInterrupt(_s_analog_stream_isr);
+	timer1_enable(TIM_DIV16, TIM_EDGE, TIM_LOOP);
+	timer1_write(TIMER1_HZ / rate);
+
+	if (debug_serial)
+		debug_serial->printf("Streaming A%d at %u Hz, %u samples/block\n", 
+			pin, rate, block_len);
+	return true;
+}
+
+void AnalogStream::stop() {
+	if (!active)
+		return;
+	timer1_disable();
+	timer1_detachInterrupt();
+	active = false;
+	paused = false;
+	active_stream = NULL;
+}
+
+bool AnalogStream::timer_in_use() {
+	return active_stream != NULL;
+}
+
+void AnalogStream::pause() {
+	if (!active || paused)
+		return;
+	timer1_disable();
+	paused = true;
+}
+
+void AnalogStream::resume() {
+	if (!active || !paused)
+		return;
+	n_samples = 0;
+	paused = false;
+	timer1_enable(TIM_DIV16, TIM_EDGE, TIM_LOOP);
+	timer1_write(TIMER1_HZ / rate);
+}
+
+bool AnalogStream::loop() {
+
+	if (ready < 0)
+		return false;
+
+	uint8_t buf = ready;
+	size_t len = encode(buffers[buf], block_len, encoding, packet);
+
+	OSCMessage msg("/stream");
+	msg.add(node_id);
+	msg.add((int32_t)seq);
+	msg.add((int32_t)t0[buf]);
+	msg.add((int32_t)rate);
+	msg.add((int32_t)encoding);
+	msg.add(packet, (int)len);
+
+	// Release the buffer before sending so the ISR can swap into it
+	ready = -1;
+	seq++;
+	num_blocks++;
+	num_bytes += len;
+	if (block_handler)
+		block_handler(msg, user_data);
+	return true;
+}
+
+size_t AnalogStream::encode(const uint16_t *samples, uint16_t n, StreamEncoding enc, uint8_t *out) {
+
+	size_t idx = 0;
+	if (enc == StreamEncoding::Raw16) {
+		for (uint16_t i = 0; i < n; i++) {
+			out[idx++] = samples[i] >> 8;
+			out[idx++] = samples[i] & 0xFF;
+		}
+		return idx;
+	}
+
+	int32_t prev = 0;
+	for (uint16_t i = 0; i < n; i++) {
+		int32_t delta = (int32_t)samples[i] - prev;
+		uint32_t zz = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+		prev = samples[i];
+		while (zz >= 0x80) {
+			out[idx++] = (zz & 0x7F) | 0x80;
+			zz >>= 7;
+		}
+		out[idx++] = zz;
+	}
+	return idx;
+}
+
+// Timer ISR:
+// ============================================================================
+ICACHE_RAM_ATTR void AnalogStream::sample() {
+
+	if (!n_samples)
+		t0[filling] = micros();
+	buffers[filling][n_samples++] = analogRead(pin);
+	if (n_samples < block_len)
+		return;
+
+	// Block full; hand it to loop() unless the other one is still pending
+	n_samples = 0;
+	if (ready >= 0) {
+		num_overruns++;
+		return;
+	}
+	ready = filling;
+	filling ^= 1;
+}
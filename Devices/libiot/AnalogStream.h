@@ -0,0 +1,132 @@
+/* AnalogStream.h
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef ANALOGSTREAM_H
+#define ANALOGSTREAM_H
+
+#include <OSCMessage.h>
+#include "Arduino.h"
+
+#ifndef ANALOG_STREAM_MAX_BLOCK
+#define ANALOG_STREAM_MAX_BLOCK 256
+#endif
+
+// Highest sample rate start() accepts; the ISR reads the ADC, and faster 
+// rates leave loop() (and WiFi) too little time
+#ifndef ANALOG_STREAM_MAX_HZ
+#define ANALOG_STREAM_MAX_HZ 2000
+#endif
+
+// Worst-case packed block: varints of 16-bit zigzag deltas take up to 3 bytes
+#define ANALOG_STREAM_MAX_BYTES (3 * ANALOG_STREAM_MAX_BLOCK)
+
+enum class StreamEncoding {
+	Raw16 = 0,          // Big-endian 16-bit samples
+	DeltaVarint = 1     // First sample, then zigzag LEB128 varint deltas
+};
+
+/* Continuous analog capture. A hardware timer (timer1) samples into one of two
+   buffers while the other is shipped from loop(); each full block goes out as 
+   one OSC message:
+
+     /stream <node_id> <seq> <t0_us> <rate_hz> <encoding> <blob>
+
+   where t0_us is the micros() timestamp of the first sample. Blocks that are 
+   not shipped before the next one fills are dropped and counted as overruns.
+   Only one stream can run at a time (there is one timer), and not alongside 
+   analogWrite() PWM, which uses timer1 as well (see Actuators). Note the ISR 
+   reads the ADC, so pause the stream around flash writes (e.g. 
+   EEPROM.commit()). */
+class AnalogStream {
+
+public:
+
+	AnalogStream(int analog_pin);
+	AnalogStream(int analog_pin, Stream *debug_serial);
+	~AnalogStream();
+
+	// Set callback for outgoing block messages
+	void set_block_handler(void (*handler)(OSCMessage &, void *), void *userdata) {
+		block_handler = handler;
+		user_data = userdata;
+	}
+
+	// Start sampling at rate_hz (up to ANALOG_STREAM_MAX_HZ) in blocks of 
+	// block_len samples
+	bool start(uint32_t rate_hz, uint16_t block_len, StreamEncoding enc);
+	void stop();
+	bool running() { return active; }
+
+	// Whether a stream holds timer1
+	static bool timer_in_use();
+
+	// Hold sampling around flash writes; resume() drops the partial block, so 
+	// every shipped block is contiguous
+	void pause();
+	void resume();
+
+	// Ship a full block, if any
+	bool loop();
+
+	// Node ID sent with each block
+	void set_node_id(int id) { node_id = id; }
+
+	// Statistics
+	uint32_t get_num_blocks()   { return num_blocks;   }
+	uint32_t get_num_overruns() { return num_overruns; }
+	uint32_t get_num_bytes()    { return num_bytes;    }
+
+	// Encode samples; return the number of bytes written to out
+	static size_t encode(const uint16_t *samples, uint16_t n, StreamEncoding enc, uint8_t *out);
+
+	// Timer ISR; must be public for the static handler
+	void sample();
+
+protected:
+
+	int pin;
+	Stream *debug_serial;
+
+	volatile bool active;
+	bool paused;
+	uint32_t rate;
+	uint16_t block_len;
+	StreamEncoding encoding;
+	int node_id;
+
+	// Double buffers: ISR fills buffers[filling], loop() ships buffers[ready]
+	uint16_t buffers[2][ANALOG_STREAM_MAX_BLOCK];
+	uint32_t t0[2];
+	volatile uint8_t filling;
+	volatile int8_t ready;
+	volatile uint16_t n_samples;
+
+	uint32_t seq;
+	uint8_t packet[ANALOG_STREAM_MAX_BYTES];
+
+	volatile uint32_t num_overruns;
+	uint32_t num_blocks;
+	uint32_t num_bytes;
+
+	void (*block_handler)(OSCMessage &, void *);
+	void *user_data;
+};
+
+#endif
@@ -0,0 +1,149 @@
+/* BlockPool.cpp
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "BlockPool.h"
+
+#define POOL_HEAP POOL_NUM_CLASSES
+
+static const char *OWNER_NAMES[POOL_NUM_OWNERS] = {"udp", "osc", "app"};
+
+// Public:
+// ============================================================================
+BlockPool::BlockPool() : min_free_heap(0xFFFFFFFF) {
+	init_class(0, small_storage, POOL_SMALL_SIZE, POOL_SMALL_COUNT);
+	init_class(1, medium_storage, POOL_MEDIUM_SIZE, POOL_MEDIUM_COUNT);
+	init_class(2, large_storage, POOL_LARGE_SIZE, POOL_LARGE_COUNT);
+	memset(owners, 0, sizeof(owners));
+}
+
+void *BlockPool::alloc(size_t n, PoolOwner owner) {
+
+	Header *hdr = NULL;
+	int cls = 0;
+	while (cls < POOL_NUM_CLASSES && n > classes[cls].block_size)
+		cls++;
+
+	// Pop a free block; an exhausted class falls back on the heap rather 
+	// than a larger class, which would starve the few large blocks
+	if (cls < POOL_NUM_CLASSES && free_list[cls]) {
+		hdr = free_list[cls];
+		memcpy(&free_list[cls], hdr + 1, sizeof(Header *));
+		hdr->cls = cls;
+	}
+	else {
+		if (cls < POOL_NUM_CLASSES)
+			classes[cls].fallbacks++;
+		hdr = (Header *)malloc(sizeof(Header) + n);
+		if (!hdr) {
+			owners[owner].failures++;
+			return NULL;
+		}
+		hdr->cls = POOL_HEAP;
+	}
+	hdr->size = n;
+	hdr->owner = owner;
+	count_alloc(hdr);
+	sample();
+	return hdr + 1;
+}
+
+void BlockPool::release(void *ptr) {
+
+	if (!ptr)
+		return;
+
+	Header *hdr = (Header *)ptr - 1;
+	PoolOwnerStats &o = owners[hdr->owner];
+	o.frees++;
+	o.bytes -= hdr->size;
+
+	if (hdr->cls == POOL_HEAP) {
+		free(hdr);
+		return;
+	}
+	PoolClassStats &c = classes[hdr->cls];
+	c.in_use--;
+	c.requested -= hdr->size;
+	memcpy(hdr + 1, &free_list[hdr->cls], sizeof(Header *));
+	free_list[hdr->cls] = hdr;
+}
+
+void BlockPool::sample() {
+	uint32_t free_heap = ESP.getFreeHeap();
+	if (free_heap < min_free_heap)
+		min_free_heap = free_heap;
+}
+
+const char *BlockPool::owner_name(int owner) {
+	return owner < POOL_NUM_OWNERS ? OWNER_NAMES[owner] : "";
+}
+
+void BlockPool::print_stats(Stream *serial) {
+	if (!serial)
+		return;
+	serial->printf("Heap: %u free, %u min free, %u max block, %u%% fragmented\n", 
+		get_free_heap(), min_free_heap, get_max_free_block(), get_fragmentation());
+	for (int i = 0; i < POOL_NUM_CLASSES; i++) {
+		PoolClassStats &c = classes[i];
+		serial->printf("Pool %4u B: %u/%u in use, %u peak, %u fallbacks\n", 
+			c.block_size, c.in_use, c.num_blocks, c.peak, c.fallbacks);
+	}
+	for (int i = 0; i < POOL_NUM_OWNERS; i++) {
+		PoolOwnerStats &o = owners[i];
+		serial->printf("Owner %s: %u allocs, %u frees, %u B (%u B peak), %u failures\n", 
+			OWNER_NAMES[i], o.allocs, o.frees, o.bytes, o.peak_bytes, o.failures);
+	}
+}
+
+// Protected:
+// ============================================================================
+void BlockPool::init_class(int cls, uint32_t *mem, uint16_t block_size, uint16_t num_blocks) {
+
+	free_list[cls] = NULL;
+	PoolClassStats &c = classes[cls];
+	memset(&c, 0, sizeof(c));
+	c.block_size = block_size;
+	c.num_blocks = num_blocks;
+
+	// Thread the free list back to front so blocks are handed out in order
+	size_t words = POOL_WORDS(block_size);
+	for (int i = num_blocks - 1; i >= 0; i--) {
+		Header *hdr = (Header *)(mem + i * words);
+		memcpy(hdr + 1, &free_list[cls], sizeof(Header *));
+		free_list[cls] = hdr;
+	}
+}
+
+void BlockPool::count_alloc(Header *hdr) {
+
+	PoolOwnerStats &o = owners[hdr->owner];
+	o.allocs++;
+	o.bytes += hdr->size;
+	if (o.bytes > o.peak_bytes)
+		o.peak_bytes = o.bytes;
+
+	if (hdr->cls != POOL_HEAP) {
+		PoolClassStats &c = classes[hdr->cls];
+		c.in_use++;
+		c.requested += hdr->size;
+		if (c.in_use > c.peak)
+			c.peak = c.in_use;
+	}
+}
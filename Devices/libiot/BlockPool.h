@@ -0,0 +1,136 @@
+/* BlockPool.h
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef BLOCKPOOL_H
+#define BLOCKPOOL_H
+
+#include "Arduino.h"
+
+// Size classes (payload bytes x blocks). The large class holds a full 
+// Ethernet-sized UDP payload. Override with build flags (so the library and 
+// sketch agree) to size the pools from field data (see /heap/stats in 
+// examples/gate)
+#ifndef POOL_SMALL_SIZE
+#define POOL_SMALL_SIZE 32
+#endif
+#ifndef POOL_SMALL_COUNT
+#define POOL_SMALL_COUNT 16
+#endif
+#ifndef POOL_MEDIUM_SIZE
+#define POOL_MEDIUM_SIZE 128
+#endif
+#ifndef POOL_MEDIUM_COUNT
+#define POOL_MEDIUM_COUNT 8
+#endif
+#ifndef POOL_LARGE_SIZE
+#define POOL_LARGE_SIZE 1472
+#endif
+#ifndef POOL_LARGE_COUNT
+#define POOL_LARGE_COUNT 2
+#endif
+#define POOL_NUM_CLASSES 3
+
+// Words per block: a 4-byte header plus the payload, rounded up
+#define POOL_WORDS(size) (1 + ((size) + 3) / 4)
+
+// Components whose allocations are counted separately
+enum PoolOwner : uint8_t {
+	POOL_OWNER_UDP,
+	POOL_OWNER_OSC,
+	POOL_OWNER_APP,
+	POOL_NUM_OWNERS
+};
+
+// Per-size-class usage
+struct PoolClassStats {
+	uint16_t block_size;
+	uint16_t num_blocks;
+	uint16_t in_use;
+	uint16_t peak;
+	uint32_t fallbacks;			// Requests of this class served by the heap
+	uint32_t requested;			// Payload bytes requested by blocks in use
+};
+
+// Per-component usage
+struct PoolOwnerStats {
+	uint32_t allocs;
+	uint32_t frees;
+	uint32_t bytes;				// Bytes currently allocated
+	uint32_t peak_bytes;
+	uint32_t failures;			// Requests that could not be served at all
+};
+
+/* Fixed-block allocator with size classes reserved at compile time. Blocks 
+   come from static storage, so steady-state packet handling never touches 
+   (or fragments) the heap. Requests larger than the largest class, or made 
+   while a class is exhausted, fall back on malloc() and are counted. */
+class BlockPool {
+
+public:
+
+	BlockPool();
+
+	// Allocate n bytes on behalf of owner; NULL if neither a block nor the 
+	// heap can serve the request. O(1) from the pools.
+	void *alloc(size_t n, PoolOwner owner);
+
+	// Return a block from alloc() (to its pool or the heap). NULL is ignored.
+	void release(void *ptr);
+
+	// Heap accounting. sample() records the low-water mark of free heap, and 
+	// is called on every allocation; call it from loop() to include 
+	// allocations made outside the pools.
+	void sample();
+	uint32_t get_free_heap()		{ return ESP.getFreeHeap();			 	}
+	uint32_t get_min_free_heap()	{ return min_free_heap; 				}
+	uint32_t get_max_free_block()	{ return ESP.getMaxFreeBlockSize(); 	}
+	uint8_t get_fragmentation()		{ return ESP.getHeapFragmentation();	}
+
+	// Usage counters
+	const PoolClassStats &get_class_stats(int cls)	{ return classes[cls]; 	}
+	const PoolOwnerStats &get_owner_stats(int owner){ return owners[owner];	}
+	static const char *owner_name(int owner);
+	void print_stats(Stream *serial);
+
+protected:
+
+	// Block header (also prefixed to heap fallbacks). Free blocks keep their 
+	// free list link in the payload.
+	struct Header {
+		uint16_t size;			// Requested bytes
+		uint8_t owner;
+		uint8_t cls;			// Size class, or POOL_NUM_CLASSES for the heap
+	};
+
+	void init_class(int cls, uint32_t *storage, uint16_t block_size, uint16_t num_blocks);
+	void count_alloc(Header *hdr);
+
+	// Block storage (word-aligned)
+	uint32_t small_storage[POOL_SMALL_COUNT * POOL_WORDS(POOL_SMALL_SIZE)];
+	uint32_t medium_storage[POOL_MEDIUM_COUNT * POOL_WORDS(POOL_MEDIUM_SIZE)];
+	uint32_t large_storage[POOL_LARGE_COUNT * POOL_WORDS(POOL_LARGE_SIZE)];
+
+	Header *free_list[POOL_NUM_CLASSES];
+	PoolClassStats classes[POOL_NUM_CLASSES];
+	PoolOwnerStats owners[POOL_NUM_OWNERS];
+	uint32_t min_free_heap;
+};
+
+#endif
@@ -0,0 +1,401 @@
+/* EventJournal.cpp
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "EventJournal.h"
+#include "SubscriberTable.h"
+
+// Static timer handler
+static void _s_journal_handle_flush_timer(void *arg) {
+	EventJournal *self = (EventJournal *)arg;
+	self->handle_flush_timer();
+}
+
+// Big-endian int32 (OSC byte order)
+static void put_u32(uint8_t *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+// Public:
+// ============================================================================
+EventJournal::EventJournal() : EventJournal(NULL) {
+
+}
+
+EventJournal::EventJournal(Stream *debug_serial) : 
+tcp_client(NULL), sched(NULL), debug_serial(debug_serial), 
+interval_ms(20), events_per_bundle(8), max_age_ms(0), armed(false), online(false), 
+head(0), tail(0), used(0), count(0), front_seq(1), next_seq(1), 
+send_pos(0), send_seq(1), last_pos(0), max_sent_seq(0), epoch(0), spill_count(0), spill_pos(0), spill_size(0), 
+num_recorded(0), num_sent(0), num_resent(0), num_dropped(0), num_expired(0), 
+num_spilled(0) {
+	set_filter("/");
+	flush_timer.set_handler(&_s_journal_handle_flush_timer, (void *)this);
+}
+
+void EventJournal::set_filter(const char *filter) {
+	strncpy(this->filter, filter, JOURNAL_FILTER_LENGTH-1);
+	this->filter[JOURNAL_FILTER_LENGTH-1] = '\0';
+}
+
+void EventJournal::set_pacing(uint32_t interval_ms, uint8_t events_per_bundle) {
+	this->interval_ms = interval_ms;
+	this->events_per_bundle = events_per_bundle ? events_per_bundle : 1;
+}
+
+bool EventJournal::accepts(const char *path) {
+	return armed && SubscriberTable::matches(filter, path);
+}
+
+bool EventJournal::record(const char *data, size_t len) {
+
+	if (!armed || len > JOURNAL_MAX_EVENT_BYTES)
+		return false;
+	expire();
+
+	// (Sequence numbers stay contiguous; a dropped event takes none)
+	JournalEntry entry;
+	entry.seq = next_seq;
+	entry.time_ms = millis();
+	entry.len = len;
+	if (!append(entry, data)) {
+		num_dropped++;
+		return true;
+	}
+	next_seq++;
+	num_recorded++;
+
+	// Send right away unless older events are still waiting
+	if (link_up() && send_seq == entry.seq && !spill_count)
+		flush(1);
+	else if (online && sched && !flush_timer.pending())
+		sched->add(&flush_timer, interval_ms);
+	return true;
+}
+
+size_t EventJournal::encode_last(uint8_t *out, size_t size) {
+	if (!count || spill_count)
+		return 0;
+	JournalEntry entry;
+	ring_read(last_pos, &entry, sizeof(entry));
+	if (entry.seq != next_seq - 1)
+		return 0;
+	return encode_event(out, size, entry, last_pos);
+}
+
+void EventJournal::resume() {
+
+	if (!armed) {
+		armed = true;
+		epoch = ESP.random();
+#if JOURNAL_FLASH_SPILL
+		LittleFS.remove(JOURNAL_FLASH_PATH);
+#endif
+	}
+
+	// Resend everything not acknowledged, after the caller's /pong
+	online = true;
+	send_pos = head;
+	send_seq = front_seq;
+	print_journal("Journal resumed");
+	if (sched)
+		sched->add(&flush_timer, 0);
+	else
+		flush(events_per_bundle);
+}
+
+void EventJournal::restore(uint32_t epoch, uint32_t next_seq) {
+
+	if (armed || !epoch)
+		return;
+	armed = true;
+	this->epoch = epoch;
+	front_seq = send_seq = this->next_seq = next_seq;
+	max_sent_seq = next_seq - 1;
+#if JOURNAL_FLASH_SPILL
+	LittleFS.remove(JOURNAL_FLASH_PATH);
+#endif
+	print_journal("Journal restored");
+}
+
+bool EventJournal::handle_ack(OSCMessage &msg) {
+	if (msg.size() < 2 || !msg.isInt(0) || !msg.isInt(1))
+		return false;
+	ack((uint32_t)msg.getInt(0), (uint32_t)msg.getInt(1));
+	return true;
+}
+
+void EventJournal::ack(uint32_t epoch, uint32_t seq) {
+	if (epoch != this->epoch)
+		return;
+	while (count && (int32_t)(seq - front_seq) >= 0)
+		pop_front();
+#if JOURNAL_FLASH_SPILL
+	unspill();
+#endif
+}
+
+void EventJournal::handle_flush_timer() {
+	flush(events_per_bundle);
+}
+
+// Protected:
+// ============================================================================
+bool EventJournal::link_up() {
+	if (online && !(tcp_client && tcp_client->connected())) {
+		online = false;
+		send_pos = head;
+		send_seq = front_seq;
+		print_journal("Journal offline");
+	}
+	return online;
+}
+
+/* Send up to max_events unsent events: one as a bare /ev message, more as a 
+   bundle. Schedule the next batch if any remain. */
+void EventJournal::flush(uint8_t max_events) {
+
+	expire();
+	if (!link_up())
+		return;
+#if JOURNAL_FLASH_SPILL
+	unspill();
+#endif
+	uint32_t unsent = count - (send_seq - front_seq);
+	if (!unsent)
+		return;
+
+	JournalEntry entry;
+	size_t len = 0;
+	size_t pos = send_pos;
+	uint8_t n = 0;
+	if (max_events == 1 || unsent == 1) {
+		ring_read(pos, &entry, sizeof(entry));
+		len = encode_event(out, sizeof(out), entry, pos);
+		pos = ring_next(pos, entry);
+		n = 1;
+	}
+	else {
+		memcpy(out, "#bundle\0", 8);
+		put_u32(out + 8, 0);
+		put_u32(out + 12, 1);			// Timetag: immediately
+		len = 16;
+		while (n < max_events && n < unsent) {
+			ring_read(pos, &entry, sizeof(entry));
+			size_t m = encode_event(out + len + 4, sizeof(out) - len - 4, entry, pos);
+			if (!m)
+				break;
+			put_u32(out + len, m);
+			len += 4 + m;
+			pos = ring_next(pos, entry);
+			n++;
+		}
+	}
+	// TCP refuses sends it has no room for (e.g. behind stream blocks) 
+	// while the link stays up, so try again after the interval
+	if (!n || !tcp_client->send((char *)out, len)) {
+		if (n && sched && !flush_timer.pending())
+			sched->add(&flush_timer, interval_ms);
+		return;
+	}
+
+	// Events past the highest sequence sent before are new
+	uint32_t resent = 0;
+	for (uint8_t i = 0; i < n; i++) {
+		if ((int32_t)(send_seq - max_sent_seq) <= 0)
+			resent++;
+		else
+			max_sent_seq = send_seq;
+		send_seq++;
+	}
+	send_pos = pos;
+	num_sent += n;
+	num_resent += resent;
+
+	if (n < unsent && sched)
+		sched->add(&flush_timer, interval_ms);
+}
+
+void EventJournal::expire() {
+	if (!max_age_ms)
+		return;
+	uint32_t now = millis();
+	JournalEntry entry;
+	while (count) {
+		ring_read(head, &entry, sizeof(entry));
+		if (now - entry.time_ms <= max_age_ms)
+			break;
+		pop_front();
+		num_expired++;
+	}
+}
+
+void EventJournal::pop_front() {
+	JournalEntry entry;
+	ring_read(head, &entry, sizeof(entry));
+	size_t next = ring_next(head, entry);
+	if (send_seq == entry.seq) {
+		send_pos = next;
+		send_seq++;
+	}
+	head = next;
+	used -= sizeof(entry) + entry.len;
+	count--;
+	front_seq = entry.seq + 1;
+}
+
+/* Add an event, dropping the oldest to make room (or spilling to flash) */
+bool EventJournal::append(const JournalEntry &entry, const char *data) {
+
+	size_t n = sizeof(entry) + entry.len;
+	if (n > JOURNAL_RAM_BYTES)
+		return false;
+
+#if JOURNAL_FLASH_SPILL
+	// Once spilling, newer events go to flash until the ring drains it
+	if (spill_count || used + n > JOURNAL_RAM_BYTES)
+		return spill(entry, data);
+#endif
+
+	while (used + n > JOURNAL_RAM_BYTES) {
+		pop_front();
+		num_dropped++;
+	}
+	push_back(entry, data);
+	return true;
+}
+
+void EventJournal::push_back(const JournalEntry &entry, const char *data) {
+	if (!count) {
+		front_seq = entry.seq;
+		send_seq = entry.seq;
+		send_pos = tail;
+	}
+	last_pos = tail;
+	ring_write(tail, &entry, sizeof(entry));
+	ring_write((tail + sizeof(entry)) % JOURNAL_RAM_BYTES, data, entry.len);
+	tail = ring_next(tail, entry);
+	used += sizeof(entry) + entry.len;
+	count++;
+}
+
+/* Encode /ev <epoch> <seq> <age_ms> <blob> for the entry at pos; return its 
+   length, or 0 if it does not fit */
+size_t EventJournal::encode_event(uint8_t *out, size_t size, JournalEntry &entry, size_t pos) {
+	size_t padded = (entry.len + 3) & ~3;
+	size_t len = JOURNAL_EVENT_HEADER_BYTES + padded;
+	if (len > size)
+		return 0;
+	memcpy(out, "/ev\0,iiib\0\0\0", 12);
+	put_u32(out + 12, epoch);
+	put_u32(out + 16, entry.seq);
+	put_u32(out + 20, millis() - entry.time_ms);
+	put_u32(out + 24, entry.len);
+	ring_read((pos + sizeof(entry)) % JOURNAL_RAM_BYTES, out + 28, entry.len);
+	memset(out + 28 + entry.len, 0, padded - entry.len);
+	return len;
+}
+
+void EventJournal::ring_write(size_t pos, const void *src, size_t n) {
+	size_t first = JOURNAL_RAM_BYTES - pos < n ? JOURNAL_RAM_BYTES - pos : n;
+	memcpy(ring + pos, src, first);
+	memcpy(ring, (const uint8_t *)src + first, n - first);
+}
+
+void EventJournal::ring_read(size_t pos, void *dst, size_t n) {
+	size_t first = JOURNAL_RAM_BYTES - pos < n ? JOURNAL_RAM_BYTES - pos : n;
+	memcpy(dst, ring + pos, first);
+	memcpy((uint8_t *)dst + first, ring, n - first);
+}
+
+size_t EventJournal::ring_next(size_t pos, const JournalEntry &entry) {
+	return (pos + sizeof(entry) + entry.len) % JOURNAL_RAM_BYTES;
+}
+
+#if JOURNAL_FLASH_SPILL
+bool EventJournal::spill(const JournalEntry &entry, const char *data) {
+	if (spill_size + sizeof(entry) + entry.len > JOURNAL_FLASH_BYTES)
+		return false;
+	File f = LittleFS.open(JOURNAL_FLASH_PATH, "a");
+	if (!f)
+		return false;
+	bool ok = f.write((const uint8_t *)&entry, sizeof(entry)) == sizeof(entry) && 
+		f.write((const uint8_t *)data, entry.len) == entry.len;
+	f.close();
+	if (!ok)
+		return false;
+	spill_size += sizeof(entry) + entry.len;
+	spill_count++;
+	num_spilled++;
+	return true;
+}
+
+/* Move spilled events back into the ring as it drains */
+void EventJournal::unspill() {
+
+	if (!spill_count)
+		return;
+	expire();			// (Spilled events are newer, so only expire once the ring has)
+	File f = LittleFS.open(JOURNAL_FLASH_PATH, "r");
+	bool readable = f && f.seek(spill_pos);
+	JournalEntry entry;
+	char data[JOURNAL_MAX_EVENT_BYTES];
+	while (readable && spill_count) {
+		if (f.read((uint8_t *)&entry, sizeof(entry)) != sizeof(entry) || 
+			entry.len > JOURNAL_MAX_EVENT_BYTES) {
+			readable = false;
+			break;
+		}
+		if (used + sizeof(entry) + entry.len > JOURNAL_RAM_BYTES)
+			break;
+		if (f.read((uint8_t *)data, entry.len) != entry.len) {
+			readable = false;
+			break;
+		}
+		spill_pos += sizeof(entry) + entry.len;
+		spill_count--;
+		if (!count && max_age_ms && millis() - entry.time_ms > max_age_ms)
+			num_expired++;
+		else
+			push_back(entry, data);
+	}
+	if (!readable) {
+		num_dropped += spill_count;		// Give up on the rest
+		spill_count = 0;
+	}
+	if (f)
+		f.close();
+	if (!spill_count) {
+		LittleFS.remove(JOURNAL_FLASH_PATH);
+		spill_pos = 0;
+		spill_size = 0;
+	}
+}
+#endif
+
+// Print utilities:
+// ============================================================================
+void EventJournal::print_journal(char *description) {
+	if (debug_serial)
+		debug_serial->printf("\n%24s: %u pending (%u in flash), next seq %u\n", 
+			description, count, spill_count, next_seq);
+}
@@ -0,0 +1,203 @@
+/* EventJournal.h
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef EVENTJOURNAL_H
+#define EVENTJOURNAL_H
+
+#include <OSCMessage.h>
+#include "Arduino.h"
+#include "TCPClient.h"
+#include "Scheduler.h"
+
+#ifndef JOURNAL_RAM_BYTES
+#define JOURNAL_RAM_BYTES 2048
+#endif
+#ifndef JOURNAL_MAX_EVENT_BYTES
+#define JOURNAL_MAX_EVENT_BYTES 128
+#endif
+#ifndef JOURNAL_BUNDLE_BYTES
+#define JOURNAL_BUNDLE_BYTES 512
+#endif
+#ifndef JOURNAL_FILTER_LENGTH
+#define JOURNAL_FILTER_LENGTH 32
+#endif
+
+// Optional spill of events that don't fit in RAM to a LittleFS file (note 
+// flash writes stall interrupts whose handlers aren't in IRAM, such as the 
+// AnalogStream ISR's ADC reads)
+#ifndef JOURNAL_FLASH_SPILL
+#define JOURNAL_FLASH_SPILL 0
+#endif
+#ifndef JOURNAL_FLASH_BYTES
+#define JOURNAL_FLASH_BYTES 16384
+#endif
+#ifndef JOURNAL_FLASH_PATH
+#define JOURNAL_FLASH_PATH "/journal"
+#endif
+#if JOURNAL_FLASH_SPILL
+#include <LittleFS.h>
+#endif
+
+// Journaled event: /ev <epoch> <seq> <age_ms> <message blob>
+#define JOURNAL_EVENT_PATH "/ev"
+#define JOURNAL_EVENT_HEADER_BYTES 28
+// Cumulative acknowledgement from the host: /ev/ack <epoch> <seq>
+#define JOURNAL_ACK_PATH "/ev/ack"
+
+struct JournalEntry {
+	uint32_t seq;
+	uint32_t time_ms;
+	uint16_t len;
+};
+
+/* Store-and-forward journal for events sent over TCP. Once the TCP link has 
+   been up, every event (serialized OSC message) under the filter gets a 
+   sequence number and is kept until the host acknowledges it; while the 
+   link is down, events are only recorded. After a reconnect (resume()), 
+   unacknowledged events are resent in order as bundles of up to 
+   events_per_bundle, one bundle every interval_ms, skipping events older 
+   than the maximum age. The host drops duplicates by (epoch, seq), the 
+   epoch being random per boot unless restored. When the journal is full, 
+   the oldest events are dropped (or with JOURNAL_FLASH_SPILL, new events go 
+   to flash until it is full too, and then new events are dropped). */
+class EventJournal {
+
+public:
+
+	EventJournal();
+	EventJournal(Stream *debug_serial);
+
+	void attach(TCPClient *tcp)			{ tcp_client = tcp; 	}
+	// The scheduler paces resends and retries sends TCP had no room for; 
+	// without one, call handle_flush_timer() from loop()
+	void attach(Scheduler *scheduler)	{ sched = scheduler; 	}
+
+	// Journal messages under this path filter (SubscriberTable::matches())
+	void set_filter(const char *filter);
+	void set_pacing(uint32_t interval_ms, uint8_t events_per_bundle);
+	void set_max_age(uint32_t max_age_ms) 	{ this->max_age_ms = max_age_ms; }
+
+	// Whether messages on this path are journaled (false until the link has 
+	// been up once, so UDP-only setups are unaffected)
+	bool accepts(const char *path);
+
+	// Record a serialized message and send it if the link is up; false if 
+	// the journal did not take it
+	bool record(const char *data, size_t len);
+
+	// Encode the event record() just took as it is sent (/ev ...), for a 
+	// copy over another link that the host matches with the journal's by 
+	// (epoch, seq); 0 if the event was dropped or spilled to flash
+	size_t encode_last(uint8_t *out, size_t size);
+
+	// Resend unacknowledged events; call once connected (after /pong)
+	void resume();
+
+	// Continue an earlier journal's epoch and sequence (e.g. one saved 
+	// across deep sleep) instead of starting a new epoch, so the host sees 
+	// one stream of events; journals from then on, even before the link is up
+	void restore(uint32_t epoch, uint32_t next_seq);
+
+	// /ev/ack <epoch> <seq>
+	bool handle_ack(OSCMessage &msg);
+	void ack(uint32_t epoch, uint32_t seq);
+
+	// Getters
+	uint32_t get_epoch()				{ return epoch; 				}
+	uint32_t get_next_seq()				{ return next_seq; 				}
+	uint32_t get_num_pending()			{ return count + spill_count; 	}
+	uint32_t get_num_recorded()			{ return num_recorded; 			}
+	uint32_t get_num_sent()				{ return num_sent; 				}
+	uint32_t get_num_resent()			{ return num_resent; 			}
+	uint32_t get_num_dropped()			{ return num_dropped; 			}
+	uint32_t get_num_expired()			{ return num_expired; 			}
+	uint32_t get_num_spilled()			{ return num_spilled; 			}
+
+	// Timer handler; must be public for the static handler
+	void handle_flush_timer();
+
+protected:
+
+	bool link_up();
+	void flush(uint8_t max_events);
+	void expire();
+	void pop_front();
+	bool append(const JournalEntry &entry, const char *data);
+	void push_back(const JournalEntry &entry, const char *data);
+	size_t encode_event(uint8_t *out, size_t size, JournalEntry &entry, size_t pos);
+
+	// Ring buffer access (wrapping at JOURNAL_RAM_BYTES)
+	void ring_write(size_t pos, const void *src, size_t n);
+	void ring_read(size_t pos, void *dst, size_t n);
+	size_t ring_next(size_t pos, const JournalEntry &entry);
+
+#if JOURNAL_FLASH_SPILL
+	bool spill(const JournalEntry &entry, const char *data);
+	void unspill();
+#endif
+
+	// Print utilities
+	void print_journal(char *description);
+
+	TCPClient *tcp_client;
+	Scheduler *sched;
+	Timer flush_timer;
+	Stream *debug_serial;
+
+	char filter[JOURNAL_FILTER_LENGTH];
+	uint32_t interval_ms;
+	uint8_t events_per_bundle;
+	uint32_t max_age_ms;
+	bool armed;				// The link has been up since boot (or restored)
+	bool online;			// Connected and resumed
+
+	// Entries [JournalEntry][message] from head (oldest, seq front_seq) to 
+	// tail, with contiguous sequence numbers; send_pos/send_seq is the next 
+	// one to send
+	uint8_t ring[JOURNAL_RAM_BYTES];
+	size_t head;
+	size_t tail;
+	size_t used;
+	uint32_t count;
+	uint32_t front_seq;
+	uint32_t next_seq;
+	size_t send_pos;
+	uint32_t send_seq;
+	size_t last_pos;			// Newest entry
+	uint32_t max_sent_seq;		// Highest sent so far (to count resends)
+	uint32_t epoch;
+
+	// Newer events spilled to flash ([JournalEntry][message] ...), read back 
+	// from spill_pos as the ring drains
+	uint32_t spill_count;
+	size_t spill_pos;
+	size_t spill_size;
+
+	uint8_t out[JOURNAL_BUNDLE_BYTES];
+
+	uint32_t num_recorded;
+	uint32_t num_sent;
+	uint32_t num_resent;
+	uint32_t num_dropped;
+	uint32_t num_expired;
+	uint32_t num_spilled;
+};
+
+#endif
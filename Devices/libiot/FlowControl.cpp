@@ -0,0 +1,220 @@
+/* FlowControl.cpp
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "FlowControl.h"
+
+// Public:
+// ============================================================================
+FlowControl::FlowControl() : FlowControl(NULL) {
+
+}
+
+FlowControl::FlowControl(Stream *debug_serial) : 
+mode(FlowMode::Open), credits(0), grant(0), rate(0), burst(0), tokens(0), 
+refilled_ms(0), set_ms(0), ttl_ms(0), throttled(false), 
+throttle_handler(NULL), throttle_userdata(NULL), debug_serial(debug_serial), 
+num_coalesced(0), num_throttles(0) {
+	for (int i = 0; i < FLOW_NUM_PRIORITIES; i++) {
+		num_admitted[i] = 0;
+		num_denied[i] = 0;
+	}
+}
+
+void FlowControl::open() {
+	set_mode(FlowMode::Open, 0);
+	set_throttled(false);
+	print_limits("Flow open");
+}
+
+void FlowControl::set_credits(uint32_t credits, uint32_t ttl_ms) {
+	this->credits = credits;
+	grant = credits;
+	set_mode(FlowMode::Credits, ttl_ms);
+	print_limits("Flow credits");
+}
+
+void FlowControl::add_credits(uint32_t credits, uint32_t ttl_ms) {
+	if (mode != FlowMode::Credits)
+		this->credits = 0;
+	this->credits += credits;
+	grant = credits;
+	set_mode(FlowMode::Credits, ttl_ms);
+	print_limits("Flow credits granted");
+}
+
+void FlowControl::set_rate(float rate, float burst, uint32_t ttl_ms) {
+	if (rate <= 0) {
+		open();
+		return;
+	}
+	if (burst < 1)
+		burst = 1;
+
+	// Keep the current level when renewing the same limits
+	if (mode != FlowMode::Rate || this->rate != rate || this->burst != burst)
+		tokens = burst;
+	this->rate = rate;
+	this->burst = burst;
+	refilled_ms = millis();
+	set_mode(FlowMode::Rate, ttl_ms);
+	print_limits("Flow rate");
+}
+
+bool FlowControl::handle_message(OSCMessage &msg) {
+
+	char kind[16];
+	if (!msg.isString(0) || msg.getDataLength(0) > (int)sizeof(kind))
+		return false;
+	msg.getString(0, kind, sizeof(kind));
+
+	if (strcmp(kind, "open") == 0)
+		open();
+	else if (strcmp(kind, "credits") == 0 && msg.size() >= 2)
+		set_credits(get_number(msg, 1, 0), get_number(msg, 2, FLOW_DEFAULT_TTL_MS));
+	else if (strcmp(kind, "grant") == 0 && msg.size() >= 2)
+		add_credits(get_number(msg, 1, 0), get_number(msg, 2, FLOW_DEFAULT_TTL_MS));
+	else if (strcmp(kind, "rate") == 0 && msg.size() >= 2) {
+		float r = get_number(msg, 1, 0);
+		set_rate(r, get_number(msg, 2, r), get_number(msg, 3, FLOW_DEFAULT_TTL_MS));
+	}
+	else
+		return false;
+	return true;
+}
+
+bool FlowControl::ready(FlowPriority priority) {
+	loop();
+	if (priority == FlowPriority::High)
+		return true;
+	switch (mode) {
+		case FlowMode::Credits:
+			return priority == FlowPriority::Normal ? credits > 0 : has_headroom();
+		case FlowMode::Rate:
+			return priority == FlowPriority::Normal ? tokens >= 1 : has_headroom();
+		default:
+			return true;
+	}
+}
+
+bool FlowControl::admit(FlowPriority priority) {
+	if (!ready(priority)) {
+		num_denied[(int)priority]++;
+		set_throttled(true);
+		return false;
+	}
+	if (priority != FlowPriority::High) {
+		if (mode == FlowMode::Credits)
+			credits--;
+		else if (mode == FlowMode::Rate)
+			tokens -= 1;
+	}
+	num_admitted[(int)priority]++;
+	return true;
+}
+
+void FlowControl::loop() {
+
+	if (mode == FlowMode::Open)
+		return;
+	if (ttl_ms && millis() - set_ms > ttl_ms) {
+		print_limits("Flow limits expired");
+		open();
+		return;
+	}
+	refill();
+	if (throttled && has_headroom())
+		set_throttled(false);
+}
+
+void FlowControl::set_throttle_handler(void (*handler)(bool, void *), void *userdata) {
+	throttle_handler = handler;
+	throttle_userdata = userdata;
+}
+
+const char *FlowControl::mode_name(FlowMode mode) {
+	switch (mode) {
+		case FlowMode::Credits:	return "credits";
+		case FlowMode::Rate:	return "rate";
+		default:				return "open";
+	}
+}
+
+// Protected:
+// ============================================================================
+void FlowControl::set_mode(FlowMode mode, uint32_t ttl_ms) {
+	this->mode = mode;
+	this->ttl_ms = ttl_ms;
+	set_ms = millis();
+}
+
+void FlowControl::refill() {
+	if (mode != FlowMode::Rate)
+		return;
+	uint32_t now = millis();
+	tokens += (now - refilled_ms) * rate / 1000.0f;
+	if (tokens > burst)
+		tokens = burst;
+	refilled_ms = now;
+}
+
+// Low-priority messages must leave half the burst (or grant) in reserve
+bool FlowControl::has_headroom() {
+	switch (mode) {
+		case FlowMode::Credits:	return credits > 0 && credits > grant / 2;
+		case FlowMode::Rate:	return tokens >= 1 && tokens >= burst / 2;
+		default:				return true;
+	}
+}
+
+void FlowControl::set_throttled(bool throttled) {
+	if (throttled == this->throttled)
+		return;
+	this->throttled = throttled;
+	if (throttled)
+		num_throttles++;
+	if (debug_serial)
+		debug_serial->printf("\n%24s\n", throttled ? "Flow throttled" : "Flow unthrottled");
+	if (throttle_handler)
+		throttle_handler(throttled, throttle_userdata);
+}
+
+// Int or float argument, or default_value if missing
+float FlowControl::get_number(OSCMessage &msg, int idx, float default_value) {
+	if (msg.isInt(idx))
+		return msg.getInt(idx);
+	if (msg.isFloat(idx))
+		return msg.getFloat(idx);
+	return default_value;
+}
+
+void FlowControl::print_limits(char *description) {
+	if (!debug_serial)
+		return;
+	switch (mode) {
+		case FlowMode::Credits:
+			debug_serial->printf("\n%24s: %u credits, TTL %u ms\n", description, credits, ttl_ms);
+			break;
+		case FlowMode::Rate:
+			debug_serial->printf("\n%24s: %.1f/s, burst %.1f, TTL %u ms\n", description, rate, burst, ttl_ms);
+			break;
+		default:
+			debug_serial->printf("\n%24s\n", description);
+	}
+}
@@ -0,0 +1,134 @@
+/* FlowControl.h
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef FLOWCONTROL_H
+#define FLOWCONTROL_H
+
+#include <OSCMessage.h>
+#include "Arduino.h"
+
+#ifndef FLOW_DEFAULT_TTL_MS
+#define FLOW_DEFAULT_TTL_MS 10000
+#endif
+
+enum class FlowMode {
+	Open = 0,		// No limits
+	Credits,		// One credit per message; the host grants more
+	Rate			// Token bucket: messages/s with a burst allowance
+};
+
+enum class FlowPriority {
+	Low = 0,		// Dropped first (e.g. analog stream blocks)
+	Normal,			// Held back and coalesced by the caller (e.g. sensor edges)
+	High			// Never limited (replies, /pong)
+};
+
+#define FLOW_NUM_PRIORITIES 3
+
+/* Host-to-device flow control. The host (the bridge) grants credits or caps 
+   the message rate with /flow; the send path asks admit() before sending 
+   each message. Low-priority messages are only admitted while more than 
+   half the burst (or half the last credit grant) remains, so they are 
+   dropped well before normal ones are held back. Limits expire after their 
+   TTL unless renewed, so a device never stays throttled by a host that went 
+   away. Throttle events (messages held back, then flowing freely again) go 
+   to the throttle handler. */
+class FlowControl {
+
+public:
+
+	FlowControl();
+	FlowControl(Stream *debug_serial);
+
+	// Set limits; each lasts ttl_ms unless renewed (0: until changed)
+	void open();
+	void set_credits(uint32_t credits, uint32_t ttl_ms);
+	void add_credits(uint32_t credits, uint32_t ttl_ms);
+	void set_rate(float rate, float burst, uint32_t ttl_ms);
+
+	// /flow open
+	// /flow credits <n> [ttl_ms]		(replaces the balance)
+	// /flow grant <n> [ttl_ms]			(adds to the balance)
+	// /flow rate <msgs/s> [burst] [ttl_ms]
+	bool handle_message(OSCMessage &msg);
+
+	// Take a credit or token for a message; false if it must not be sent now
+	bool admit(FlowPriority priority);
+
+	// Whether admit() would succeed, without taking anything (for callers 
+	// retrying a message they held back)
+	bool ready(FlowPriority priority);
+
+	// Count messages the caller folded into a later one while throttled
+	void coalesced(uint32_t n) 			{ num_coalesced += n; }
+
+	// Expire limits and end throttling when idle; call from loop()
+	void loop();
+
+	// Called with true when messages start being held back or dropped, and 
+	// with false once there is headroom again
+	void set_throttle_handler(void (*handler)(bool, void *), void *userdata);
+
+	// Getters
+	FlowMode get_mode()					{ return mode; 				}
+	bool is_throttled()					{ return throttled; 		}
+	uint32_t get_credits()				{ return credits; 			}
+	float get_rate()					{ return rate; 				}
+	float get_tokens()					{ return tokens; 			}
+	uint32_t get_num_admitted(FlowPriority p)	{ return num_admitted[(int)p]; 	}
+	uint32_t get_num_denied(FlowPriority p)		{ return num_denied[(int)p]; 	}
+	uint32_t get_num_coalesced()		{ return num_coalesced; 	}
+	uint32_t get_num_throttles()		{ return num_throttles; 	}
+
+	static const char *mode_name(FlowMode mode);
+
+protected:
+
+	void set_mode(FlowMode mode, uint32_t ttl_ms);
+	void refill();
+	bool has_headroom();
+	void set_throttled(bool throttled);
+	static float get_number(OSCMessage &msg, int idx, float default_value);
+
+	// Print utilities
+	void print_limits(char *description);
+
+	FlowMode mode;
+	uint32_t credits;
+	uint32_t grant;				// Last credit grant (sets the low-priority reserve)
+	float rate;
+	float burst;
+	float tokens;
+	uint32_t refilled_ms;
+	uint32_t set_ms;
+	uint32_t ttl_ms;
+	bool throttled;
+
+	void (*throttle_handler)(bool, void *);
+	void *throttle_userdata;
+	Stream *debug_serial;
+
+	uint32_t num_admitted[FLOW_NUM_PRIORITIES];
+	uint32_t num_denied[FLOW_NUM_PRIORITIES];
+	uint32_t num_coalesced;
+	uint32_t num_throttles;
+};
+
+#endif
@@ -21,34 +21,130 @@
 #define LEDPIN_H
 
 #include "Arduino.h"
+#include "Scheduler.h"
 
 #define LP_HIGH (LOW)
 #define LP_LOW (HIGH)
 
+// Pattern priorities; a pattern only interrupts one of equal or lower priority
+const uint8_t LED_PRIORITY_ACTIVITY = 0;     // I/O blinks
+const uint8_t LED_PRIORITY_STATUS = 1;       // Connection state
+const uint8_t LED_PRIORITY_ALERT = 2;
+
+const uint8_t LED_REPEAT_FOREVER = 0;
+
+// One step of a pattern: LED state and how long to hold it
+struct LEDStep {
+	bool lit;
+	uint16_t ms;
+};
+
+/* Non-blocking LED pattern engine. Patterns are sequences of steps played a 
+   number of times from loop(), after which the LED returns to its resting 
+   state. Step arrays are not copied, so they must outlive the pattern. 
+   Attached to a Scheduler, steps are timer-driven and loop() does nothing. */
 class LEDPin {
 
 public:
 
 	LEDPin(int digitalpin, int blink_duration) 
-	: pin(digitalpin), t0(0), dt(blink_duration) {}
+	: pin(digitalpin), rest_lit(true), steps(NULL), n_steps(0), step(0), 
+	  repeats(0), priority(0), t0(0), sched(NULL) {
+		blink_step.lit = false;
+		blink_step.ms = blink_duration;
+		step_timer.set_handler(&LEDPin::handle_step_timer, this);
+	}
+
+	// Drive steps from scheduler timers instead of loop()
+	void attach(Scheduler *scheduler) {
+		sched = scheduler;
+		if (sched && steps)
+			sched->add_at(&step_timer, t0 + steps[step].ms);
+	}
 
+	// Momentarily switch the LED off (activity indicator)
 	void blink() {
-		digitalWrite(pin, LP_LOW);
+		play(&blink_step, 1, 1, LED_PRIORITY_ACTIVITY);
+	}
+
+	// Play n_steps steps n_repeats times (or LED_REPEAT_FOREVER); return false
+	// if a higher-priority pattern is playing
+	bool play(const LEDStep *pattern, uint8_t n, uint8_t n_repeats, uint8_t prio) {
+		if (steps && prio < priority)
+			return false;
+		steps = pattern;
+		n_steps = n;
+		repeats = n_repeats;
+		priority = prio;
+		step = 0;
 		t0 = millis();
+		digitalWrite(pin, steps[0].lit ? LP_HIGH : LP_LOW);
+		if (sched)
+			sched->add_at(&step_timer, t0 + steps[0].ms);
+		return true;
+	}
+
+	// Stop any pattern and return to the resting state
+	void stop() {
+		steps = NULL;
+		if (sched)
+			sched->cancel(&step_timer);
+		digitalWrite(pin, rest_lit ? LP_HIGH : LP_LOW);
+	}
+
+	// Set the resting state (applied immediately unless a pattern is playing)
+	void set(bool lit) {
+		rest_lit = lit;
+		if (!steps)
+			digitalWrite(pin, rest_lit ? LP_HIGH : LP_LOW);
 	}
 
+	bool playing() 			{ return steps != NULL; }
+	uint8_t get_priority() 	{ return steps ? priority : 0; }
+
 	void loop() {
-		if (t0 && ((millis() - t0) > dt)) {
-			digitalWrite(pin, LP_HIGH);
-			t0 = 0;
-		}
+		if (sched || !steps || (millis() - t0) < steps[step].ms)
+			return;
+		advance();
 	}
 
 protected:
 
+	static void handle_step_timer(void *user_data) {
+		LEDPin *led = (LEDPin *)user_data;
+		if (led->steps) {
+			led->advance();
+			if (led->steps)
+				led->sched->add_at(&led->step_timer, led->t0 + led->steps[led->step].ms);
+		}
+	}
+
+	void advance() {
+		t0 += steps[step].ms;
+		if (++step >= n_steps) {
+			step = 0;
+			if (repeats != LED_REPEAT_FOREVER && --repeats == 0) {
+				stop();
+				return;
+			}
+		}
+		digitalWrite(pin, steps[step].lit ? LP_HIGH : LP_LOW);
+	}
+
 	int pin;
-	int t0;
-	int dt;
+	bool rest_lit;
+
+	LEDStep blink_step;
+
+	const LEDStep *steps;
+	uint8_t n_steps;
+	uint8_t step;
+	uint8_t repeats;
+	uint8_t priority;
+	unsigned long t0;
+
+	Scheduler *sched;
+	Timer step_timer;
 };
 
 #endif
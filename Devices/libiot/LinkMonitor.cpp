@@ -0,0 +1,228 @@
+/* LinkMonitor.cpp
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "LinkMonitor.h"
+
+// Smoothed loss moves an eighth of the way per probe
+#define LINK_LOSS_STEP_PERMILLE 125
+
+static void _s_link_handle_probe_timer(void *arg) {
+	LinkMonitor *self = (LinkMonitor *)arg;
+	self->handle_probe_timer();
+}
+
+// Public:
+// ============================================================================
+LinkMonitor::LinkMonitor() : LinkMonitor(NULL) {
+
+}
+
+LinkMonitor::LinkMonitor(Stream *debug_serial) : udp_client(NULL), tcp_client(NULL), 
+sched(NULL), debug_serial(debug_serial), probe_port(0), running(false), 
+choice(LinkId::Tcp) {
+	memset(links, 0, sizeof(links));
+	probe_timer.set_handler(&_s_link_handle_probe_timer, (void *)this);
+}
+
+void LinkMonitor::start() {
+
+	// A new connection starts with a clean round trip estimate
+	LinkStats &tcp = links[(int)LinkId::Tcp].stats;
+	tcp.srtt_us = tcp.tail_us = 0;
+	for (int i = 0; i < LINK_NUM_LINKS; i++)
+		links[i].in_flight = false;
+	running = true;
+	if (sched) {
+		sched->cancel(&probe_timer);
+		sched->add(&probe_timer, 0);
+	}
+}
+
+void LinkMonitor::stop() {
+	running = false;
+	if (sched)
+		sched->cancel(&probe_timer);
+}
+
+void LinkMonitor::set_probe_port(uint16_t port) {
+	probe_port = port;
+	if (tcp_client && tcp_client->connected())
+		probe_addr = tcp_client->remote_addr();
+	links[(int)LinkId::Udp].in_flight = false;
+	update_choice();
+}
+
+void LinkMonitor::set_probe_port(IPAddress addr, uint16_t port) {
+	probe_addr = addr;
+	set_probe_port(port);
+}
+
+bool LinkMonitor::send_udp(const uint8_t *data, size_t len) {
+	return udp_client && probe_port && 
+		udp_client->send((char *)data, len, probe_addr, probe_port);
+}
+
+bool LinkMonitor::handle_port(OSCMessage &msg) {
+	if (!msg.isInt(0))
+		return false;
+	set_probe_port(msg.getInt(0));
+	return true;
+}
+
+bool LinkMonitor::handle_probe(OSCMessage &msg) {
+
+	uint32_t now = micros();
+	if (msg.size() < 2 || !msg.isInt(0) || !msg.isInt(1))
+		return false;
+	int idx = msg.getInt(1);
+	if (idx < 0 || idx >= LINK_NUM_LINKS)
+		return false;
+
+	// Only the probe in flight counts; a late one was already counted lost
+	Link &link = links[idx];
+	if (!link.in_flight || (uint32_t)msg.getInt(0) != link.seq)
+		return true;
+	link.in_flight = false;
+	link.stats.probes_answered++;
+	link.stats.loss_permille -= link.stats.loss_permille >> 3;
+	sample(link, now - link.sent_us);
+	update_choice();
+	return true;
+}
+
+LinkId LinkMonitor::choose() {
+	update_choice();
+	links[(int)choice].stats.num_events++;
+	return choice;
+}
+
+const char *LinkMonitor::link_name(LinkId link) {
+	return link == LinkId::Udp ? "udp" : "tcp";
+}
+
+uint32_t LinkMonitor::score_us(LinkId id) {
+
+	Link &link = links[(int)id];
+	uint32_t score = link.stats.tail_us;
+	if (id == LinkId::Tcp) {
+		if (!tcp_client || !tcp_client->connected())
+			return LINK_UNUSABLE;
+		uint32_t queue_us = tcp_client->get_queue_delay_ms() * 1000;
+		if (queue_us > score)
+			score = queue_us;
+	}
+	else if (!udp_client || !probe_port || !link.stats.srtt_us || 
+		link.stats.loss_permille > LINK_MAX_LOSS_PERMILLE)
+		return LINK_UNUSABLE;
+
+	// An overdue probe bounds the round trip from below
+	if (link.in_flight && micros() - link.sent_us > score)
+		score = micros() - link.sent_us;
+	return score;
+}
+
+void LinkMonitor::handle_probe_timer() {
+	if (!running || !sched)
+		return;
+
+	// TCP probes are never lost, only late (which the score sees)
+	if (!links[(int)LinkId::Tcp].in_flight)
+		send_probe(LinkId::Tcp);
+
+	Link &udp = links[(int)LinkId::Udp];
+	if (udp.in_flight && micros() - udp.sent_us > LINK_PROBE_TIMEOUT_MS * 1000UL) {
+		udp.in_flight = false;
+		udp.stats.probes_lost++;
+		udp.stats.loss_permille += LINK_LOSS_STEP_PERMILLE - (udp.stats.loss_permille >> 3);
+	}
+	if (!udp.in_flight && probe_port)
+		send_probe(LinkId::Udp);
+
+	update_choice();
+	sched->add(&probe_timer, LINK_PROBE_INTERVAL_MS);
+}
+
+// Protected:
+// ============================================================================
+void LinkMonitor::send_probe(LinkId id) {
+
+	Link &link = links[(int)id];
+	OSCMessage msg(LINK_PROBE_PATH);
+	msg.add((int)++link.seq);
+	msg.add((int)id);
+	link.sent_us = micros();
+
+	bool sent = false;
+	if (id == LinkId::Tcp)
+		sent = tcp_client && tcp_client->connected() && tcp_client->send(msg);
+	else
+		sent = udp_client && udp_client->send(msg, probe_addr, probe_port);
+	if (sent) {
+		link.in_flight = true;
+		link.stats.probes_sent++;
+	}
+}
+
+/* Smoothed round trip as in TCP (RFC 6298); the tail jumps to any longer 
+   round trip and decays an eighth per sample */
+void LinkMonitor::sample(Link &link, uint32_t rtt_us) {
+
+	LinkStats &stats = link.stats;
+	if (!rtt_us)
+		rtt_us = 1;
+	if (!stats.srtt_us)
+		stats.srtt_us = rtt_us;
+	else
+		stats.srtt_us = stats.srtt_us - (stats.srtt_us >> 3) + (rtt_us >> 3);
+	stats.tail_us -= stats.tail_us >> 3;
+	if (stats.tail_us < rtt_us)
+		stats.tail_us = rtt_us;
+}
+
+/* Move events to UDP when TCP is down, or when UDP's score beats TCP's by 
+   the margin; back to TCP once it is within half the margin */
+void LinkMonitor::update_choice() {
+
+	uint32_t tcp = score_us(LinkId::Tcp);
+	uint32_t udp = score_us(LinkId::Udp);
+	LinkId next = choice;
+	if (choice == LinkId::Tcp && (tcp == LINK_UNUSABLE || 
+		(udp != LINK_UNUSABLE && udp + LINK_SWITCH_MARGIN_US < tcp)))
+		next = LinkId::Udp;
+	else if (choice == LinkId::Udp && tcp != LINK_UNUSABLE && 
+		(udp == LINK_UNUSABLE || tcp <= udp + LINK_SWITCH_MARGIN_US / 2))
+		next = LinkId::Tcp;
+	if (next == choice)
+		return;
+	choice = next;
+	links[(int)choice].stats.num_switches++;
+	print_link("Events moved to", choice);
+}
+
+// Print utilities:
+// ============================================================================
+void LinkMonitor::print_link(char *description, LinkId id) {
+	if (debug_serial) {
+		LinkStats &stats = links[(int)id].stats;
+		debug_serial->printf("\n%24s: %s (srtt %u us, tail %u us, loss %u/1000, queue %u ms)\n", 
+			description, link_name(id), stats.srtt_us, stats.tail_us, stats.loss_permille, 
+			id == LinkId::Tcp && tcp_client ? tcp_client->get_queue_delay_ms() : 0);
+	}
+}
@@ -0,0 +1,160 @@
+/* LinkMonitor.h
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef LINKMONITOR_H
+#define LINKMONITOR_H
+
+#include <OSCMessage.h>
+#include "Arduino.h"
+#include "UDPClient.h"
+#include "TCPClient.h"
+#include "Scheduler.h"
+
+#ifndef LINK_PROBE_INTERVAL_MS
+#define LINK_PROBE_INTERVAL_MS 500
+#endif
+#ifndef LINK_PROBE_TIMEOUT_MS
+#define LINK_PROBE_TIMEOUT_MS 1000
+#endif
+#ifndef LINK_MAX_LOSS_PERMILLE
+#define LINK_MAX_LOSS_PERMILLE 50
+#endif
+#ifndef LINK_SWITCH_MARGIN_US
+#define LINK_SWITCH_MARGIN_US 5000
+#endif
+
+// /link/probe <seq> <link>, echoed unchanged by the bridge over the link it 
+// came on; /link/port <port> tells the node where the bridge echoes UDP
+#define LINK_PROBE_PATH "/link/probe"
+#define LINK_PORT_PATH "/link/port"
+
+// Score of a link that can't carry events now
+#define LINK_UNUSABLE 0xFFFFFFFF
+
+enum class LinkId {
+	Tcp = 0,
+	Udp
+};
+
+#define LINK_NUM_LINKS 2
+
+// How a message is sent to the TCP subscriber
+enum class MessageClass {
+	State = 0,		// Over TCP while connected (replies, stream blocks, 
+					// anything that must arrive, and in order)
+	Event			// Over the link with the lowest tail latency (sensor 
+					// edges)
+};
+
+struct LinkStats {
+	uint32_t srtt_us;			// Smoothed round trip
+	uint32_t tail_us;			// Worst recent round trip, decaying
+	uint16_t loss_permille;		// Probes lost (UDP), smoothed
+	uint32_t probes_sent;
+	uint32_t probes_answered;
+	uint32_t probes_lost;
+	uint32_t num_events;		// Events sent over the link
+	uint32_t num_switches;		// Times events moved to the link
+};
+
+/* Chooses the link for latency-critical messages from live measurements. 
+   Every interval the monitor probes TCP, and UDP once the bridge has said 
+   where it echoes, one probe per link in flight. TCP's score is the worst 
+   of its tail round trip, the age of its unanswered probe and of its 
+   unacknowledged data, so a retransmitting connection scores badly before 
+   its next probe returns. UDP's is its tail round trip, as long as it loses 
+   few probes. Events move to UDP when it beats TCP by a margin, and back 
+   once TCP is nearly as good; everything else stays on TCP. */
+class LinkMonitor {
+
+public:
+
+	LinkMonitor();
+	LinkMonitor(Stream *debug_serial);
+
+	void attach(UDPClient *udp, TCPClient *tcp)	{ udp_client = udp; tcp_client = tcp; }
+	void attach(Scheduler *scheduler)			{ sched = scheduler; }
+
+	// Probe now and every interval (call once connected), or stop probing
+	void start();
+	void stop();
+
+	// /link/port <port>: probe UDP to the TCP peer's address on this port 
+	// (0 stops)
+	void set_probe_port(uint16_t port);
+	bool handle_port(OSCMessage &msg);
+
+	// Probe the bridge at this address and port before connecting (e.g. 
+	// from a sleep snapshot)
+	void set_probe_port(IPAddress addr, uint16_t port);
+
+	// Send a packet to the bridge over UDP, to the port it echoes probes 
+	// on; false if it hasn't said where
+	bool send_udp(const uint8_t *data, size_t len);
+
+	// /link/probe <seq> <link>, echoed
+	bool handle_probe(OSCMessage &msg);
+
+	// The link for the next event (counted)
+	LinkId choose();
+	LinkId get_choice()							{ return choice; }
+
+	static const char *link_name(LinkId link);
+
+	// Score of a link in microseconds, or LINK_UNUSABLE
+	uint32_t score_us(LinkId link);
+
+	// Getters
+	const LinkStats &get_stats(LinkId link)		{ return links[(int)link].stats; }
+	uint16_t get_probe_port()					{ return probe_port; }
+
+	// Timer handler; must be public for the static handler
+	void handle_probe_timer();
+
+protected:
+
+	struct Link {
+		LinkStats stats;
+		uint32_t seq;
+		uint32_t sent_us;
+		bool in_flight;
+	};
+
+	void send_probe(LinkId link);
+	void sample(Link &link, uint32_t rtt_us);
+	void update_choice();
+
+	// Print utilities
+	void print_link(char *description, LinkId link);
+
+	UDPClient *udp_client;
+	TCPClient *tcp_client;
+	Scheduler *sched;
+	Timer probe_timer;
+	Stream *debug_serial;
+
+	Link links[LINK_NUM_LINKS];
+	IPAddress probe_addr;		// The bridge (the TCP peer when the port was set)
+	uint16_t probe_port;
+	bool running;
+	LinkId choice;
+};
+
+#endif
@@ -0,0 +1,172 @@
+/* LoopProfiler.cpp
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "LoopProfiler.h"
+
+LoopProfiler *LoopProfiler::active = NULL;
+
+// Public:
+// ============================================================================
+LoopProfiler::LoopProfiler() : LoopProfiler(NULL) {
+
+}
+
+LoopProfiler::LoopProfiler(Stream *debug_serial) : 
+stall_us(PROFILE_DEFAULT_STALL_US), stall_handler(NULL), stall_userdata(NULL), 
+debug_serial(debug_serial) {
+	reset();
+}
+
+void LoopProfiler::begin(uint32_t stall_us) {
+	this->stall_us = stall_us ? stall_us : PROFILE_DEFAULT_STALL_US;
+	reset();
+	active = this;
+	if (debug_serial)
+		debug_serial->printf("\n%24s: stalls >= %u us\n", "Profiling", this->stall_us);
+}
+
+void LoopProfiler::end() {
+	if (active == this)
+		active = NULL;
+}
+
+void LoopProfiler::reset() {
+	started = false;
+	iteration_site = NULL;
+	iteration_site_us = 0;
+	num_iterations = 0;
+	num_stalls = 0;
+	max_iteration_us = 0;
+	for (int i = 0; i < PROFILE_NUM_BUCKETS; i++)
+		buckets[i] = 0;
+	num_sites = 0;
+}
+
+void LoopProfiler::loop() {
+
+	if (active != this)
+		return;
+	uint32_t now = micros();
+	if (!started) {
+		started = true;
+		last_us = now;
+		return;
+	}
+	uint32_t us = now - last_us;
+	last_us = now;
+
+	num_iterations++;
+	if (us > max_iteration_us)
+		max_iteration_us = us;
+	int b = 0;
+	while (b < PROFILE_NUM_BUCKETS - 1 && us >> (PROFILE_FIRST_BUCKET_SHIFT + b))
+		b++;
+	buckets[b]++;
+
+	if (us >= stall_us) {
+		num_stalls++;
+		ProfileSite *site = iteration_site;
+		if (site && iteration_site_us >= stall_us)
+			us = iteration_site_us;
+		else if ((site = find_site(PROFILE_UNMARKED_SITE)) != NULL)
+			count(site, us);
+		if (site && us > site->reported_us) {
+			site->reported_us = us;
+			print_stall(*site, us);
+			if (stall_handler)
+				stall_handler(*site, us, stall_userdata);
+		}
+	}
+	iteration_site = NULL;
+	iteration_site_us = 0;
+}
+
+void LoopProfiler::set_stall_handler(void (*handler)(const ProfileSite &, uint32_t, void *), 
+	void *userdata) {
+	stall_handler = handler;
+	stall_userdata = userdata;
+}
+
+int LoopProfiler::get_worst_sites(uint8_t *idx, int n) {
+	int count = 0;
+	for (int i = 0; i < num_sites; i++) {
+		if (!sites[i].stalls)
+			continue;
+
+		// Insertion sort by stall time, keeping the first n
+		int j = count < n ? count++ : n;
+		while (j > 0 && sites[idx[j-1]].stall_us < sites[i].stall_us) {
+			if (j < n)
+				idx[j] = idx[j-1];
+			j--;
+		}
+		if (j < n)
+			idx[j] = i;
+	}
+	return count;
+}
+
+void LoopProfiler::record(const char *name, uint32_t us) {
+	ProfileSite *site = find_site(name);
+	if (!site)
+		return;
+	count(site, us);
+	if (us > iteration_site_us) {
+		iteration_site = site;
+		iteration_site_us = us;
+	}
+}
+
+// Protected:
+// ============================================================================
+ProfileSite *LoopProfiler::find_site(const char *name) {
+	for (int i = 0; i < num_sites; i++) {
+		if (sites[i].name == name || strcmp(sites[i].name, name) == 0)
+			return &sites[i];
+	}
+	if (num_sites == PROFILE_MAX_SITES)
+		return NULL;
+	ProfileSite &site = sites[num_sites++];
+	site.name = name;
+	site.calls = 0;
+	site.stalls = 0;
+	site.max_us = 0;
+	site.stall_us = 0;
+	site.reported_us = 0;
+	return &site;
+}
+
+void LoopProfiler::count(ProfileSite *site, uint32_t us) {
+	site->calls++;
+	if (us > site->max_us)
+		site->max_us = us;
+	if (us >= stall_us) {
+		site->stalls++;
+		site->stall_us += us;
+	}
+}
+
+// Print utilities:
+// ============================================================================
+void LoopProfiler::print_stall(ProfileSite &site, uint32_t us) {
+	if (debug_serial)
+		debug_serial->printf("\n%24s: %s %u us (%u stalls)\n", "Loop stall", 
+			site.name, us, site.stalls);
+}
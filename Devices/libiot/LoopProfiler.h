@@ -0,0 +1,154 @@
+/* LoopProfiler.h
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+
+#ifndef LOOPPROFILER_H
+#define LOOPPROFILER_H
+
+#include "Arduino.h"
+
+// Scoped markers (PROFILE_SCOPE) compile to nothing with PROFILE_MARKERS 0
+#ifndef PROFILE_MARKERS
+#define PROFILE_MARKERS 1
+#endif
+#ifndef PROFILE_MAX_SITES
+#define PROFILE_MAX_SITES 12
+#endif
+#ifndef PROFILE_DEFAULT_STALL_US
+#define PROFILE_DEFAULT_STALL_US 20000
+#endif
+
+// Iteration time histogram: < 128 us, < 256 us, ... < 131 ms, and longer
+#define PROFILE_NUM_BUCKETS 12
+#define PROFILE_FIRST_BUCKET_SHIFT 7
+
+// Marked call sites; "loop" collects stalls no marked site accounts for
+#define PROFILE_UNMARKED_SITE "loop"
+
+struct ProfileSite {
+	const char *name;
+	uint32_t calls;
+	uint32_t stalls;			// Calls lasting at least the stall threshold
+	uint32_t max_us;
+	uint32_t stall_us;			// Total time spent in stalls
+	uint32_t reported_us;		// Longest stall passed to the stall handler
+};
+
+/* Opt-in profiler for the main loop. loop() measures the time between 
+   successive calls (one loop() iteration) into a histogram; iterations 
+   lasting at least the stall threshold are stalls. Blocking library calls 
+   are marked with PROFILE_SCOPE("name"), which times the enclosing scope 
+   while a profiler is running. A stall is attributed to the longest marked 
+   scope of its iteration if that scope stalled too, and to 
+   PROFILE_UNMARKED_SITE otherwise. One profiler runs at a time (begin()); 
+   markers cost a pointer test while none does. */
+class LoopProfiler {
+
+public:
+
+	LoopProfiler();
+	LoopProfiler(Stream *debug_serial);
+
+	// Start (resetting the counters) or stop profiling
+	void begin(uint32_t stall_us);
+	void end();
+	void reset();
+	bool is_running() 					{ return active == this; 	}
+
+	// Call first thing in loop()
+	void loop();
+
+	// Called with the site and duration of a stall that is the longest yet 
+	// for its site (so the worst offenders get reported, not every stall)
+	void set_stall_handler(void (*handler)(const ProfileSite &, uint32_t, void *), void *userdata);
+
+	// Indices of up to n sites with stalls, most stall time first; return 
+	// the number written
+	int get_worst_sites(uint8_t *idx, int n);
+
+	// Getters
+	uint32_t get_stall_threshold() 		{ return stall_us; 			}
+	uint32_t get_num_iterations()		{ return num_iterations; 	}
+	uint32_t get_num_stalls()			{ return num_stalls; 		}
+	uint32_t get_max_iteration_us()		{ return max_iteration_us; 	}
+	uint32_t get_bucket(int i)			{ return buckets[i]; 		}
+	int get_num_sites()					{ return num_sites; 		}
+	const ProfileSite &get_site(int i)	{ return sites[i]; 			}
+
+	// Marker interface (see ProfileScope)
+	static LoopProfiler *active;
+	void record(const char *name, uint32_t us);
+
+protected:
+
+	ProfileSite *find_site(const char *name);
+	void count(ProfileSite *site, uint32_t us);
+
+	// Print utilities
+	void print_stall(ProfileSite &site, uint32_t us);
+
+	uint32_t stall_us;
+	uint32_t last_us;
+	bool started;				// last_us is valid
+
+	// Longest marked scope of the current iteration
+	ProfileSite *iteration_site;
+	uint32_t iteration_site_us;
+
+	uint32_t num_iterations;
+	uint32_t num_stalls;
+	uint32_t max_iteration_us;
+	uint32_t buckets[PROFILE_NUM_BUCKETS];
+	ProfileSite sites[PROFILE_MAX_SITES];
+	int num_sites;
+
+	void (*stall_handler)(const ProfileSite &, uint32_t, void *);
+	void *stall_userdata;
+	Stream *debug_serial;
+};
+
+/* Times its scope for the running profiler, if any */
+class ProfileScope {
+
+public:
+
+	ProfileScope(const char *name) : name(name), profiler(LoopProfiler::active) {
+		if (profiler)
+			start_us = micros();
+	}
+	~ProfileScope() {
+		if (profiler && profiler == LoopProfiler::active)
+			profiler->record(name, micros() - start_us);
+	}
+
+protected:
+
+	const char *name;
+	LoopProfiler *profiler;
+	uint32_t start_us;
+};
+
+#if PROFILE_MARKERS
+#define PROFILE_SCOPE(name) ProfileScope _profile_scope(name)
+#else
+#define PROFILE_SCOPE(name)
+#endif
+
+#endif
@@ -0,0 +1,73 @@
+/* OSCIntern.cpp
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "OSCIntern.h"
+
+// Version 1. Append only, bumping OSC_INTERN_VERSION (IDs start at 1)
+static const char *const intern_paths[] = {
+	"/gate",
+	"/stream",
+	"/flow",
+	"/flow/throttle",
+	"/ev/ack",
+	"/stream/start",
+	"/stream/stop",
+	"/sched/stats",
+	"/heap/stats",
+	"/video/instruction",
+	"/video/object",
+	"/retrieval",
+};
+static const uint16_t num_intern_paths = sizeof(intern_paths) / sizeof(intern_paths[0]);
+static_assert(num_intern_paths <= OSC_INTERN_MAX_IDS, "Raise OSC_INTERN_MAX_IDS");
+
+// ============================================================================
+uint16_t OSCIntern::id(const char *path) {
+	if (path[0] != '/')
+		return 0;
+	for (uint16_t i = 0; i < num_intern_paths; i++) {
+		if (intern_paths[i][1] == path[1] && strcmp(intern_paths[i], path) == 0)
+			return i + 1;
+	}
+	return 0;
+}
+
+const char *OSCIntern::path(uint16_t id) {
+	return id && id <= num_intern_paths ? intern_paths[id - 1] : NULL;
+}
+
+uint16_t OSCIntern::get_num_paths() {
+	return num_intern_paths;
+}
+
+bool OSCIntern::is_interned(const uint8_t *bytes, size_t len) {
+	return len >= OSC_INTERN_HEADER_LENGTH && bytes[0] == '#' && bytes[1] == '$';
+}
+
+uint16_t OSCIntern::packet_id(const uint8_t *bytes) {
+	return ((uint16_t)bytes[2] << 8) | bytes[3];
+}
+
+void OSCIntern::write_header(uint8_t *bytes, uint16_t id) {
+	bytes[0] = '#';
+	bytes[1] = '$';
+	bytes[2] = id >> 8;
+	bytes[3] = id & 0xFF;
+}
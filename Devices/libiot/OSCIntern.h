@@ -0,0 +1,60 @@
+/* OSCIntern.h
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+
+#ifndef OSCINTERN_H
+#define OSCINTERN_H
+
+#include "Arduino.h"
+
+// Interned packets replace a message's padded address with "#$" and a 
+// big-endian 16-bit ID, followed by the type tags and arguments as usual. 
+// IDs index a table fixed per version (mirrored by Max/intern.py); a host 
+// that decodes them answers a /pong carrying the version with 
+// /intern <version>, and only then does a node send it interned packets.
+#define OSC_INTERN_VERSION 1
+#define OSC_INTERN_HEADER "#$"
+#define OSC_INTERN_HEADER_LENGTH 4
+#define OSC_INTERN_PATH "/intern"
+#define OSC_INTERN_MAX_IDS 32
+
+class OSCIntern {
+
+public:
+
+	// ID of an address, or 0 if it is not in the table
+	static uint16_t id(const char *path);
+
+	// Address of an ID, or NULL if it is not in the table
+	static const char *path(uint16_t id);
+	static uint16_t get_num_paths();
+
+	// Whether a packet is interned, and its ID
+	static bool is_interned(const uint8_t *bytes, size_t len);
+	static uint16_t packet_id(const uint8_t *bytes);
+
+	// Length of an address in a serialized message, padding included
+	static size_t address_length(const char *path) { return (strlen(path) + 4) & ~3; }
+
+	// Write the header for id at bytes (OSC_INTERN_HEADER_LENGTH)
+	static void write_header(uint8_t *bytes, uint16_t id);
+};
+
+#endif
@@ -25,79 +25,30 @@ static int pad_len(int bytes) {
 }
 
 // ============================================================================
-OSCManager::OSCManager() {
-	OSCManager(NULL);
-}
+OSCManager::OSCManager() : OSCManager(NULL) {
 
-OSCManager::OSCManager(Stream *debug_serial) : debug_serial(debug_serial), 
-local_port(NULL), dest_port(NULL), dest_address(NULL), num_handlers(0) {
-	
 }
 
-OSCManager::~OSCManager() {
-
+OSCManager::OSCManager(Stream *debug_serial) : debug_serial(debug_serial), pool(NULL), 
+groups(0), node_id(-1), num_filtered(0), num_unknown(0), clock(NULL), num_scheduled(0), 
+schedule_handler(NULL), schedule_userdata(NULL), num_executed(0), num_late(0), 
+num_dropped(0), num_unsynced(0), last_error_us(0), max_error_us(0), num_handlers(0) {
+	memset(intern_handlers, -1, sizeof(intern_handlers));
 }
 
-bool OSCManager::open_port(uint16_t port) {
-	local_port = dest_port = port;
-	if (udp_local.begin(local_port) == 1) {
-		if (debug_serial)
-			debug_serial->printf("Listening for OSC on port %d\n", local_port);
-		return true;
-	}
-	return false;
-}
+OSCManager::~OSCManager() {
 
-void OSCManager::set_dest(IPAddress addr, uint16_t port) {
-	dest_address = addr;
-	dest_port = port;
 }
 
 void OSCManager::dispatch(char *path, void (*handler)(OSCMessage &)) {
 	strcpy(paths[num_handlers], path);
 	handlers[num_handlers] = handler;
+	uint16_t id = OSCIntern::id(path);
+	if (id && intern_handlers[id] < 0)
+		intern_handlers[id] = num_handlers;
 	num_handlers++;
 }
 
-bool OSCManager::loop() {
-
-	bool success = false;
-	int n_bytes = udp_local.parsePacket();
-
-	if (n_bytes) {
-		char *data = (char *)malloc(n_bytes * sizeof(char));
-		udp_local.read(data, n_bytes);		
-
-		// Debug printing
-		print_udp("Data from UDP client", 
-			udp_local.remoteIP().toString().c_str(), 
-			udp_local.remotePort());
-
-		success = handle_buffer((uint8_t *)data, n_bytes);
-		free(data);
-	}
-	return success;
-}
-
-void OSCManager::send(OSCMessage &msg) {
-	send(msg, dest_address);
-}
-
-void OSCManager::send(OSCMessage &msg, IPAddress dest) {
-	if (!dest_port)
-		return;
-
-	// Debug printing
-	print_udp("Sending UDP to client", 
-		dest.toString().c_str(), 
-		dest_port);
-	print_osc_msg("OSC Message", msg);
-
-	udp_local.beginPacket(dest, dest_port);
-	msg.send(udp_local);
-	udp_local.endPacket();
-}
-
 bool OSCManager::handle_message(OSCMessage &msg) {
 	
 	if (!msg.hasError())  { 
@@ -119,18 +70,199 @@ bool OSCManager::handle_message(OSCMessage &msg) {
 }
 
 bool OSCManager::handle_buffer(uint8_t *bytes, size_t len) {
+	if (!accepts(bytes, len)) {
+		num_filtered++;
+		return false;
+	}
+	if (len >= OSC_GROUP_HEADER_LENGTH && bytes[0] == '#' && bytes[1] == 'g') {
+		bytes += OSC_GROUP_HEADER_LENGTH;
+		len -= OSC_GROUP_HEADER_LENGTH;
+	}
+	else if (len >= OSC_NODE_HEADER_LENGTH && bytes[0] == '#' && bytes[1] == 'n') {
+		bytes += OSC_NODE_HEADER_LENGTH;
+		len -= OSC_NODE_HEADER_LENGTH;
+	}
+	if (OSCIntern::is_interned(bytes, len))
+		return handle_interned(bytes, len);
+	if (len >= OSC_BUNDLE_HEADER_LENGTH && memcmp(bytes, "#bundle", 8) == 0)
+		return handle_bundle(bytes, len);
 	OSCMessage msg; 
 	msg.fill(bytes, len);
 	return handle_message(msg);	
 }
 
-// Print utilities:
+bool OSCManager::accepts(const uint8_t *bytes, size_t len) {
+	
+	// Plain OSC messages start with '/', bundles with "#bundle"
+	if (len < OSC_GROUP_HEADER_LENGTH || bytes[0] != '#' || (bytes[1] != 'g' && bytes[1] != 'n'))
+		return true;
+
+	if (bytes[1] == 'g') {
+		if (memcmp(bytes, OSC_GROUP_HEADER, 4))
+			return false;
+		uint32_t mask = ((uint32_t)bytes[4] << 24) | ((uint32_t)bytes[5] << 16) | 
+						((uint32_t)bytes[6] << 8) | (uint32_t)bytes[7];
+		return (mask & OSC_GROUP_ALL) || (mask & groups);
+	}
+
+	if (len < OSC_NODE_HEADER_LENGTH || memcmp(bytes, OSC_NODE_HEADER, 4) || node_id < 0)
+		return false;
+	int32_t base = (int32_t)(((uint32_t)bytes[4] << 24) | ((uint32_t)bytes[5] << 16) | 
+							 ((uint32_t)bytes[6] << 8) | (uint32_t)bytes[7]);
+	uint32_t mask = ((uint32_t)bytes[8] << 24) | ((uint32_t)bytes[9] << 16) | 
+					((uint32_t)bytes[10] << 8) | (uint32_t)bytes[11];
+	uint32_t bit = (uint32_t)(node_id - base);
+	return bit < 32 && (mask >> bit) & 1;
+}
+
+void OSCManager::run_scheduled() {
+
+	while (num_scheduled) {
+		ScheduledBundle &next = scheduled[0];
+		uint64_t now = clock->local_us();
+		if (next.due_us > now + OSC_SCHEDULE_SPIN_US)
+			return;
+
+		ScheduledBundle bundle = next;
+		num_scheduled--;
+		memmove(scheduled, scheduled + 1, num_scheduled * sizeof(ScheduledBundle));
+		execute(bundle.bytes, bundle.len, bundle.timetag, bundle.due_us);
+		if (pool)
+			pool->release(bundle.bytes);
+		else
+			free(bundle.bytes);
+	}
+}
+
+void OSCManager::set_schedule_handler(void (*handler)(uint64_t, int32_t, void *), 
+	void *userdata) {
+	schedule_handler = handler;
+	schedule_userdata = userdata;
+}
+
+// Protected:
 // ============================================================================
-void OSCManager::print_udp(char *description, const char *addr, uint16_t port) {
-	if (debug_serial) 
-		debug_serial->printf("\n%24s: %s:%d", description, addr, port);
+bool OSCManager::handle_bundle(uint8_t *bytes, size_t len) {
+
+	uint64_t timetag = 0;
+	for (int i = 8; i < 16; i++)
+		timetag = (timetag << 8) | bytes[i];
+
+	// Timetag 1 means immediately
+	if (timetag <= 1)
+		return dispatch_bundle(bytes, len);
+	if (!clock || !clock->is_synced()) {
+		num_unsynced++;
+		return dispatch_bundle(bytes, len);
+	}
+
+	uint64_t due = clock->to_local_us(SyncClock::timetag_to_us(timetag));
+	uint64_t now = clock->local_us();
+	if (due > now + (uint64_t)OSC_MAX_SCHEDULE_AHEAD_MS * 1000) {
+		num_dropped++;
+		return false;
+	}
+	if (due > now + OSC_SCHEDULE_SPIN_US || num_scheduled)
+		return schedule(bytes, len, timetag, due);
+
+	// Due (or past due) with nothing queued ahead of it
+	return execute(bytes, len, timetag, due);
 }
 
+/* Wait out the last stretch before a bundle's time here (rather than risk a 
+   whole loop() iteration), dispatch it, and record the scheduling error */
+bool OSCManager::execute(uint8_t *bytes, size_t len, uint64_t timetag, uint64_t due_us) {
+
+	uint64_t now = clock->local_us();
+	while (now < due_us) {
+		delayMicroseconds(due_us - now > 100 ? 100 : due_us - now);
+		now = clock->local_us();
+	}
+	int32_t error = (int32_t)(now - due_us);
+	bool success = dispatch_bundle(bytes, len);
+
+	num_executed++;
+	last_error_us = error;
+	if ((uint32_t)abs(error) > max_error_us)
+		max_error_us = abs(error);
+	if (error > OSC_LATE_US)
+		num_late++;
+	if (schedule_handler)
+		schedule_handler(timetag, error, schedule_userdata);
+	return success;
+}
+
+/* Dispatch each element of a bundle (messages, or bundles in turn) */
+bool OSCManager::dispatch_bundle(uint8_t *bytes, size_t len) {
+	bool success = true;
+	size_t i = OSC_BUNDLE_HEADER_LENGTH;
+	while (i + 4 <= len) {
+		uint32_t n = ((uint32_t)bytes[i] << 24) | ((uint32_t)bytes[i+1] << 16) | 
+					 ((uint32_t)bytes[i+2] << 8) | (uint32_t)bytes[i+3];
+		i += 4;
+		if (n == 0 || n > len - i)
+			return false;
+		success &= handle_buffer(bytes + i, n);
+		i += n;
+	}
+	return success;
+}
+
+bool OSCManager::schedule(uint8_t *bytes, size_t len, uint64_t timetag, uint64_t due_us) {
+	if (num_scheduled == OSC_MAX_SCHEDULED) {
+		num_dropped++;
+		return false;
+	}
+	uint8_t *copy = (uint8_t *)(pool ? pool->alloc(len, POOL_OWNER_OSC) : malloc(len));
+	if (!copy) {
+		num_dropped++;
+		return false;
+	}
+	memcpy(copy, bytes, len);
+
+	// Insert in order of due time (after bundles due at the same time)
+	int i = num_scheduled;
+	while (i > 0 && scheduled[i-1].due_us > due_us) {
+		scheduled[i] = scheduled[i-1];
+		i--;
+	}
+	scheduled[i].due_us = due_us;
+	scheduled[i].timetag = timetag;
+	scheduled[i].bytes = copy;
+	scheduled[i].len = len;
+	num_scheduled++;
+	return true;
+}
+
+bool OSCManager::handle_interned(uint8_t *bytes, size_t len) {
+
+	uint16_t id = OSCIntern::packet_id(bytes);
+	const char *path = OSCIntern::path(id);
+	if (!path) {
+		num_unknown++;
+		return false;
+	}
+
+	// Decode the table's address followed by the rest of the packet
+	static const uint8_t zeros[4] = {0, 0, 0, 0};
+	size_t n = strlen(path);
+	OSCMessage msg;
+	msg.fill((uint8_t *)path, n);
+	msg.fill((uint8_t *)zeros, 4 - (n & 3));
+	msg.fill(bytes + OSC_INTERN_HEADER_LENGTH, len - OSC_INTERN_HEADER_LENGTH);
+
+	// Straight to the handler registered for the address, instead of 
+	// matching each handler's path in turn
+	int i = intern_handlers[id];
+	if (i < 0 || msg.hasError())
+		return handle_message(msg);
+	print_osc_msg("OSC Message", msg);
+	handlers[i](msg);
+	return true;
+}
+
+// Print utilities:
+// ============================================================================
 void OSCManager::print_osc_msg(char *description, OSCMessage &msg) {
 	if (debug_serial) {
 		char oscpath[OSC_MAX_PATH_LENGTH];
@@ -20,10 +20,12 @@
 #ifndef OSCMANAGER_H
 #define OSCMANAGER_H
 
-#include <WiFiUdp.h>
 #include <OSCMessage.h>
 #include <stdarg.h>
 #include "Arduino.h"
+#include "BlockPool.h"
+#include "OSCIntern.h"
+#include "SyncClock.h"
 
 #ifndef OSC_MAX_NUM_HANDLERS
 #define OSC_MAX_NUM_HANDLERS 32
@@ -32,6 +34,37 @@
 #define OSC_MAX_PATH_LENGTH 64
 #endif
 
+// Bundles with a future timetag wait in a queue (copied into blocks from the 
+// pool, if attached), and are dispatched from run_scheduled() at their time 
+// on the synchronized clock; the last OSC_SCHEDULE_SPIN_US before it are 
+// spent waiting in place. Bundles further ahead than OSC_MAX_SCHEDULE_AHEAD_MS 
+// are dropped, and any dispatched more than OSC_LATE_US after their time 
+// count as late.
+#ifndef OSC_MAX_SCHEDULED
+#define OSC_MAX_SCHEDULED 8
+#endif
+#ifndef OSC_SCHEDULE_SPIN_US
+#define OSC_SCHEDULE_SPIN_US 1500
+#endif
+#ifndef OSC_MAX_SCHEDULE_AHEAD_MS
+#define OSC_MAX_SCHEDULE_AHEAD_MS 60000
+#endif
+#define OSC_LATE_US 1000
+#define OSC_BUNDLE_HEADER_LENGTH 16
+
+// Group-addressed packets are prefixed with "#grp" and a big-endian 32-bit 
+// group mask. Nodes accept the packet if they belong to any group in the mask;
+// the high bit addresses all nodes, grouped or not.
+#define OSC_GROUP_HEADER "#grp"
+#define OSC_GROUP_HEADER_LENGTH 8
+#define OSC_GROUP_ALL 0x80000000
+#define OSC_GROUP_MASK 0x7FFFFFFF
+
+// Node-addressed packets are prefixed with "#nod", a big-endian base node ID 
+// and a 32-bit node mask: bit n addresses node base + n.
+#define OSC_NODE_HEADER "#nod"
+#define OSC_NODE_HEADER_LENGTH 12
+
 class OSCManager {
 
 public:
@@ -41,47 +74,96 @@ public:
     OSCManager(Stream *debug_serial);
     ~OSCManager();
 
-    // Start listening on the specified port
-    bool open_port(uint16_t port);
+    // Copy scheduled bundles into blocks from a pool instead of the heap
+    void attach(BlockPool *pool)    { this->pool = pool; }
 
-    // Set a default destination for outgoing messages
-    void set_dest(IPAddress addr, uint16_t port);
-    
     // Set OSC handlers for the specified path
     void dispatch(char *path, void (*handler)(OSCMessage &));
 
-    // OSC Message senders
-    void send(OSCMessage &msg);                     // OSC --> default dest
-    void send(OSCMessage &msg, IPAddress dest);     // OSC --> specified dest
-
-    // Loop 
-    bool loop(); 
-
-    // OSC
+    // OSC (packets come from any Transport's data handler; replies go out 
+    // through a Transport or the SubscriberTable)
     bool handle_message(OSCMessage &msg);
     bool handle_buffer(uint8_t *bytes, size_t len);
 
-    // Established via UDP only (should be a /ping)
-    IPAddress remote_addr() { return udp_local.remoteIP(); }
-    uint16_t remote_port() { return udp_local.remotePort(); }
+    // Group membership (mask of groups 0-30) for group-addressed packets
+    void set_groups(uint32_t mask)  { groups = mask & OSC_GROUP_MASK; }
+    uint32_t get_groups()           { return groups; }
+    uint32_t get_num_filtered()     { return num_filtered; }
+
+    // Node ID for node-addressed packets (none until set)
+    void set_node_id(int id)        { node_id = id; }
+
+    // Check a packet's group or node header, if any, without decoding it
+    bool accepts(const uint8_t *bytes, size_t len);
+
+    // Interned packets (see OSCIntern.h) whose ID this version doesn't know
+    uint32_t get_num_unknown()      { return num_unknown; }
+
+    // Execute timetagged bundles against a synchronized clock (without one, 
+    // or until it syncs, bundles are dispatched on arrival)
+    void attach(SyncClock *clock)   { this->clock = clock; }
+
+    // Dispatch scheduled bundles that are due; call from loop()
+    void run_scheduled();
+
+    // Called after each scheduled bundle with its timetag and scheduling 
+    // error (dispatch time minus timetag on the synchronized clock, in us)
+    void set_schedule_handler(void (*handler)(uint64_t, int32_t, void *), void *userdata);
+
+    // Scheduling stats
+    int get_num_pending()               { return num_scheduled; }
+    uint32_t get_num_executed()         { return num_executed; }
+    uint32_t get_num_late()             { return num_late; }
+    uint32_t get_num_dropped()          { return num_dropped; }
+    uint32_t get_num_unsynced()         { return num_unsynced; }
+    int32_t get_last_error_us()         { return last_error_us; }
+    uint32_t get_max_error_us()         { return max_error_us; }
 
 protected:
 
+    // Decode an interned packet, dispatching by ID
+    bool handle_interned(uint8_t *bytes, size_t len);
+
+    // Bundles: dispatch the elements now, or queue for later
+    bool handle_bundle(uint8_t *bytes, size_t len);
+    bool dispatch_bundle(uint8_t *bytes, size_t len);
+    bool schedule(uint8_t *bytes, size_t len, uint64_t timetag, uint64_t due_us);
+    bool execute(uint8_t *bytes, size_t len, uint64_t timetag, uint64_t due_us);
+
     // Print utilities
-    void print_udp(char *description, const char *addr, uint16_t port);
     void print_osc_msg(char *description, OSCMessage &msg);
 
     Stream *debug_serial;
-
-    WiFiUDP udp_local;
-
-    uint16_t local_port;
-    uint16_t dest_port;
-    IPAddress dest_address;    
+    BlockPool *pool;
+
+    uint32_t groups;
+    int node_id;
+    uint32_t num_filtered;
+    uint32_t num_unknown;
+
+    // Scheduled bundles, soonest first
+    struct ScheduledBundle {
+        uint64_t due_us;            // Local time (SyncClock::local_us())
+        uint64_t timetag;
+        uint8_t *bytes;
+        size_t len;
+    };
+    SyncClock *clock;
+    ScheduledBundle scheduled[OSC_MAX_SCHEDULED];
+    int num_scheduled;
+    void (*schedule_handler)(uint64_t, int32_t, void *);
+    void *schedule_userdata;
+    uint32_t num_executed;
+    uint32_t num_late;
+    uint32_t num_dropped;
+    uint32_t num_unsynced;
+    int32_t last_error_us;
+    uint32_t max_error_us;
 
     int num_handlers;
     char paths[OSC_MAX_NUM_HANDLERS][OSC_MAX_PATH_LENGTH];
     void (*handlers[OSC_MAX_NUM_HANDLERS])(OSCMessage &);
+    int8_t intern_handlers[OSC_INTERN_MAX_IDS + 1];    // Handler per ID, or -1
 };
 
 #endif
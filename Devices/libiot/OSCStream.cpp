@@ -0,0 +1,83 @@
+/* OSCStream.cpp
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "OSCStream.h"
+
+// Public:
+// ============================================================================
+void OSCStream::feed(uint8_t *data, size_t len, void (*handler)(uint8_t *, size_t, void *), void *userdata) {
+
+	size_t i = 0;
+
+	// Complete the held packet first; bytes past its end go back to data
+	if (buffered) {
+		size_t n = len < sizeof(buffer) - buffered ? len : sizeof(buffer) - buffered;
+		memcpy(buffer + buffered, data, n);
+		buffered += n;
+		int flen = frame_length(buffer, buffered);
+		if (flen < 0 || (!flen && buffered == sizeof(buffer))) {
+			num_errors++;			// Lost sync; start over with the next segment
+			buffered = 0;
+			return;
+		}
+		if (!flen)
+			return;
+		i = n - (buffered - flen);
+		buffered = 0;
+		handler(buffer + OSC_STREAM_PREFIX_BYTES, flen - OSC_STREAM_PREFIX_BYTES, userdata);
+	}
+
+	while (i < len) {
+		int flen = frame_length(data + i, len - i);
+		if (flen < 0) {
+			num_errors++;
+			return;
+		}
+		if (!flen) {
+			if (len - i > sizeof(buffer)) {
+				num_errors++;
+				return;
+			}
+			memcpy(buffer, data + i, len - i);
+			buffered = len - i;
+			return;
+		}
+		handler(data + i + OSC_STREAM_PREFIX_BYTES, flen - OSC_STREAM_PREFIX_BYTES, userdata);
+		i += flen;
+	}
+}
+
+void OSCStream::put_prefix(uint8_t *out, size_t len) {
+	out[0] = (len >> 24) & 0xFF;
+	out[1] = (len >> 16) & 0xFF;
+	out[2] = (len >> 8) & 0xFF;
+	out[3] = len & 0xFF;
+}
+
+/* OSC packets are a non-zero multiple of 4 bytes, and none sent here come 
+   near 64 KB; any other length means the stream is out of step */
+int OSCStream::frame_length(const uint8_t *data, size_t len) {
+	if (len < OSC_STREAM_PREFIX_BYTES)
+		return 0;
+	uint32_t n = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | 
+		((uint32_t)data[2] << 8) | data[3];
+	if (!n || (n & 3) || n > 0xFFFF)
+		return -1;
+	return len >= OSC_STREAM_PREFIX_BYTES + n ? OSC_STREAM_PREFIX_BYTES + n : 0;
+}
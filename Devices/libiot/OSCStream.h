@@ -0,0 +1,67 @@
+/* OSCStream.h
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef OSCSTREAM_H
+#define OSCSTREAM_H
+
+#include "Arduino.h"
+
+// Longest packet that can be reassembled across TCP segments
+#ifndef OSC_STREAM_BUFFER_BYTES
+#define OSC_STREAM_BUFFER_BYTES 512
+#endif
+
+#define OSC_STREAM_PREFIX_BYTES 4
+
+/* Splits a TCP byte stream into OSC packets (messages and bundles), as the 
+   bridge's oscstream.py does. Each packet is preceded by its length as a 
+   big-endian int32 (OSC 1.0 stream framing), since bundles carry no length 
+   of their own. A segment may carry several packets or part of one, and 
+   partial packets are held until the rest arrives. Packets inside a segment 
+   are handed over in place. */
+class OSCStream {
+
+public:
+
+	OSCStream() : buffered(0), num_errors(0) {}
+
+	// Pass each complete packet in data to the handler (without its prefix)
+	void feed(uint8_t *data, size_t len, void (*handler)(uint8_t *, size_t, void *), void *userdata);
+
+	// Drop any partial packet (e.g. on a new connection)
+	void reset() 					{ buffered = 0; 		}
+
+	// Times the stream lost sync (a bad length, or a packet too long to hold)
+	uint32_t get_num_errors() 		{ return num_errors; 	}
+
+	// Write the length prefix for a packet of len bytes (OSC_STREAM_PREFIX_BYTES)
+	static void put_prefix(uint8_t *out, size_t len);
+
+	// Length of the framed packet at the start of data, prefix included, 0 if 
+	// it is incomplete, or -1 if the prefix isn't a packet length
+	static int frame_length(const uint8_t *data, size_t len);
+
+protected:
+
+	uint8_t buffer[OSC_STREAM_BUFFER_BYTES];
+	size_t buffered;
+	uint32_t num_errors;
+};
+
+#endif
@@ -0,0 +1,111 @@
+/* SLIPTransport.cpp
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "SLIPTransport.h"
+
+// Public:
+// ============================================================================
+SLIPTransport::SLIPTransport() : stream(NULL), rx_len(0), escaped(false), 
+dropping(false) {
+
+}
+
+void SLIPTransport::begin(Stream *stream) {
+	this->stream = stream;
+	rx_len = 0;
+	escaped = false;
+	dropping = false;
+}
+
+/* Write runs of plain bytes in one call, and escapes between them */
+bool SLIPTransport::send(const uint8_t *data, size_t len) {
+
+	static const uint8_t end = SLIP_END;
+	static const uint8_t esc_end[2] = {SLIP_ESC, SLIP_ESC_END};
+	static const uint8_t esc_esc[2] = {SLIP_ESC, SLIP_ESC_ESC};
+	if (!stream)
+		return count_send(len, false);
+
+	size_t expected = 2 + len;
+	size_t written = stream->write(&end, 1);
+	size_t run = 0;
+	for (size_t i = 0; i < len; i++) {
+		if (data[i] != SLIP_END && data[i] != SLIP_ESC)
+			continue;
+		written += stream->write(data + run, i - run);
+		written += stream->write(data[i] == SLIP_END ? esc_end : esc_esc, 2);
+		expected++;
+		run = i + 1;
+	}
+	written += stream->write(data + run, len - run);
+	written += stream->write(&end, 1);
+	return count_send(len, written == expected);
+}
+
+bool SLIPTransport::loop() {
+
+	bool handled = false;
+	while (stream && stream->available() > 0) {
+		int c = stream->read();
+		if (c < 0)
+			break;
+		if (c == SLIP_END) {
+			if (rx_len && !dropping) {
+				deliver(rx, rx_len);
+				handled = true;
+			}
+			rx_len = 0;
+			escaped = false;
+			dropping = false;
+			continue;
+		}
+		if (dropping)
+			continue;
+		if (escaped) {
+			escaped = false;
+			if (c == SLIP_ESC_END)
+				c = SLIP_END;
+			else if (c == SLIP_ESC_ESC)
+				c = SLIP_ESC;
+			else {
+				drop();
+				continue;
+			}
+		}
+		else if (c == SLIP_ESC) {
+			escaped = true;
+			continue;
+		}
+		if (rx_len == SLIP_MAX_PACKET) {
+			drop();
+			continue;
+		}
+		rx[rx_len++] = c;
+	}
+	return handled;
+}
+
+// Protected:
+// ============================================================================
+void SLIPTransport::drop() {
+	stats.errors++;
+	dropping = true;
+	rx_len = 0;
+}
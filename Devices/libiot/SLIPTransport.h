@@ -0,0 +1,72 @@
+/* SLIPTransport.h
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef SLIPTRANSPORT_H
+#define SLIPTRANSPORT_H
+
+#include "Arduino.h"
+#include "Transport.h"
+
+// SLIP (RFC 1055) special bytes
+#define SLIP_END 0xC0
+#define SLIP_ESC 0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+
+#ifndef SLIP_MAX_PACKET
+#define SLIP_MAX_PACKET 512
+#endif
+
+/* OSC packets over a serial Stream (e.g. the USB serial port), framed with 
+   SLIP as in OSC 1.1: END and ESC bytes in a packet are escaped, and each 
+   packet is sent between END bytes (the leading one flushes line noise). 
+   loop() decodes whatever bytes are available and delivers each complete 
+   packet; packets longer than SLIP_MAX_PACKET or with a bad escape are 
+   dropped and counted as errors. A wired link has no connection state, so 
+   connected() only says whether a stream was given. */
+class SLIPTransport : public Transport {
+
+public:
+
+	SLIPTransport();
+
+	// Use an opened stream (e.g. &Serial after Serial.begin())
+	void begin(Stream *stream);
+
+	virtual bool send(const uint8_t *data, size_t len);
+	using Transport::send;
+
+	virtual bool loop();
+
+	virtual bool connected()	{ return stream != NULL; }
+	virtual const char *name()	{ return "slip"; }
+
+protected:
+
+	void drop();
+
+	Stream *stream;
+	uint8_t rx[SLIP_MAX_PACKET];
+	size_t rx_len;
+	bool escaped;
+	bool dropping;			// Discarding up to the next END
+};
+
+#endif
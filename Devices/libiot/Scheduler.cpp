@@ -0,0 +1,196 @@
+/* Scheduler.cpp
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "Scheduler.h"
+#include "Arduino.h"
+
+static inline uint32_t level_shift(int level) {
+	return SCHED_WHEEL_BITS * level;
+}
+
+// Public:
+// ============================================================================
+Scheduler::Scheduler() : now_tick(millis()), num_pending(0), 
+tolerance(SCHED_DEFAULT_TOLERANCE_MS) {
+	memset(wheel, 0, sizeof(wheel));
+	reset_stats();
+}
+
+void Scheduler::add(Timer *timer, uint32_t delay_ms) {
+	add_at(timer, millis() + delay_ms);
+}
+
+void Scheduler::add_at(Timer *timer, uint32_t deadline) {
+	if (timer->bucket)
+		unlink(timer);
+	else {
+		// Nothing was pending, so the wheel may lag far behind the clock
+		if (!num_pending)
+			now_tick = millis();
+		num_pending++;
+	}
+	timer->deadline = deadline;
+	insert(timer, now_tick + 1);
+}
+
+void Scheduler::cancel(Timer *timer) {
+	if (!timer->bucket)
+		return;
+	unlink(timer);
+	num_pending--;
+}
+
+uint32_t Scheduler::run() {
+
+	uint32_t now = millis();
+	if (!num_pending) {
+		now_tick = now;
+		return UINT32_MAX;
+	}
+	while ((int32_t)(now - now_tick) > 0 && num_pending)
+		tick();
+	if (!num_pending) {
+		now_tick = now;
+		return UINT32_MAX;
+	}
+
+	// Scan the first level for the next occupied slot
+	uint32_t idx = now_tick & SCHED_WHEEL_MASK;
+	for (uint32_t dt = 1; dt < SCHED_WHEEL_SLOTS - idx; dt++) {
+		if (wheel[0][idx + dt])
+			return dt;
+	}
+	return SCHED_WHEEL_SLOTS - idx;
+}
+
+void Scheduler::loop(uint32_t max_sleep_ms) {
+	uint32_t idle_ms = run();
+	if (idle_ms > 1 && max_sleep_ms)
+		delay(idle_ms - 1 < max_sleep_ms ? idle_ms - 1 : max_sleep_ms);
+	else
+		yield();
+}
+
+void Scheduler::reset_stats() {
+	num_fired = num_missed = max_lateness = 0;
+}
+
+void Scheduler::print_stats(Stream *serial) {
+	if (serial)
+		serial->printf("Scheduler: %u pending, %u fired, %u missed, %u ms max late\n", 
+			num_pending, num_fired, num_missed, max_lateness);
+}
+
+// Wheel:
+// ============================================================================
+void Scheduler::insert(Timer *timer, uint32_t earliest) {
+
+	uint32_t deadline = timer->deadline;
+	Timer **bucket;
+
+	// Overdue: fire on the earliest tick not yet processed
+	if ((int32_t)(deadline - earliest) < 0)
+		bucket = &wheel[0][earliest & SCHED_WHEEL_MASK];
+	else {
+
+		// Lowest level at which the deadline shares all higher bits with the
+		// current tick, so it cascades down before it's due
+		int level = 0;
+		while (level < SCHED_NUM_LEVELS && 
+			(deadline >> level_shift(level+1)) != (now_tick >> level_shift(level+1)))
+			level++;
+
+		if (level < SCHED_NUM_LEVELS)
+			bucket = &wheel[level][(deadline >> level_shift(level)) & SCHED_WHEEL_MASK];
+		else {
+			// Beyond this rotation of the top level; park in its first slot, 
+			// which is cascaded (and the timer re-queued) when it wraps. 
+			// Nothing else can be in that slot outside the first interval.
+			bucket = &wheel[SCHED_NUM_LEVELS-1][0];
+		}
+	}
+
+	timer->prev = NULL;
+	timer->next = *bucket;
+	if (*bucket)
+		(*bucket)->prev = timer;
+	*bucket = timer;
+	timer->bucket = bucket;
+}
+
+void Scheduler::unlink(Timer *timer) {
+	if (timer->prev)
+		timer->prev->next = timer->next;
+	else
+		*timer->bucket = timer->next;
+	if (timer->next)
+		timer->next->prev = timer->prev;
+	timer->next = timer->prev = NULL;
+	timer->bucket = NULL;
+}
+
+void Scheduler::cascade(int level) {
+	Timer **bucket = &wheel[level][(now_tick >> level_shift(level)) & SCHED_WHEEL_MASK];
+	Timer *timer = *bucket;
+	*bucket = NULL;
+	while (timer) {
+		Timer *next = timer->next;
+		insert(timer, now_tick);
+		timer = next;
+	}
+}
+
+void Scheduler::tick() {
+
+	now_tick++;
+
+	// Move timers down from each level whose slot boundary we just crossed
+	for (int level = SCHED_NUM_LEVELS - 1; level > 0; level--) {
+		if (!(now_tick & ((1UL << level_shift(level)) - 1)))
+			cascade(level);
+	}
+
+	// Fire everything in the current slot. Detach the list first, since 
+	// callbacks may add timers (including to this slot).
+	Timer **bucket = &wheel[0][now_tick & SCHED_WHEEL_MASK];
+	Timer *timer = *bucket;
+	*bucket = NULL;
+	while (timer) {
+		Timer *next = timer->next;
+		timer->next = timer->prev = NULL;
+		timer->bucket = NULL;
+		num_pending--;
+		fire(timer);
+		timer = next;
+	}
+}
+
+void Scheduler::fire(Timer *timer) {
+	uint32_t late = millis() - timer->deadline;
+	if ((int32_t)late < 0)
+		late = 0;
+	if (late > max_lateness)
+		max_lateness = late;
+	if (late > tolerance)
+		num_missed++;
+	num_fired++;
+	if (timer->callback)
+		timer->callback(timer->user_data);
+}
@@ -0,0 +1,119 @@
+/* Scheduler.h
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "Arduino.h"
+
+// Hierarchical timer wheel with 1 ms ticks: SCHED_NUM_LEVELS levels of 
+// 2^SCHED_WHEEL_BITS slots each (default range 2^24 ms, about 4.6 hours; 
+// longer delays are re-queued at the top level until they come in range)
+#ifndef SCHED_WHEEL_BITS
+#define SCHED_WHEEL_BITS 6
+#endif
+#ifndef SCHED_NUM_LEVELS
+#define SCHED_NUM_LEVELS 4
+#endif
+#define SCHED_WHEEL_SLOTS (1 << SCHED_WHEEL_BITS)
+#define SCHED_WHEEL_MASK (SCHED_WHEEL_SLOTS - 1)
+
+// Lateness beyond which a timer counts as a missed deadline
+#ifndef SCHED_DEFAULT_TOLERANCE_MS
+#define SCHED_DEFAULT_TOLERANCE_MS 2
+#endif
+
+/* A deadline registered with the Scheduler. Timers are intrusive (the 
+   scheduler never allocates), so they must outlive their registration. */
+struct Timer {
+
+	Timer() : callback(NULL), user_data(NULL), deadline(0), 
+	next(NULL), prev(NULL), bucket(NULL) {}
+
+	Timer(void (*handler)(void *), void *userdata) : callback(handler), 
+	user_data(userdata), deadline(0), next(NULL), prev(NULL), bucket(NULL) {}
+
+	void set_handler(void (*handler)(void *), void *userdata) {
+		callback = handler;
+		user_data = userdata;
+	}
+
+	bool pending() { return bucket != NULL; }
+
+	void (*callback)(void *);
+	void *user_data;
+	uint32_t deadline;
+
+	// Slot list links (owned by the Scheduler)
+	Timer *next;
+	Timer *prev;
+	Timer **bucket;
+};
+
+class Scheduler {
+
+public:
+
+	Scheduler();
+
+	// Fire timer delay_ms from now, or at an absolute millis() deadline. 
+	// Adding a pending timer reschedules it. O(1).
+	void add(Timer *timer, uint32_t delay_ms);
+	void add_at(Timer *timer, uint32_t deadline);
+
+	// Remove a pending timer. O(1).
+	void cancel(Timer *timer);
+
+	// Fire all due timers; return the number of ms until the next timer may 
+	// be due (a lower bound when timers are far out)
+	uint32_t run();
+
+	// Run due timers, then yield, or sleep up to max_sleep_ms when nothing 
+	// is due sooner
+	void loop(uint32_t max_sleep_ms);
+
+	// Missed-deadline statistics
+	void set_tolerance(uint32_t ms)	{ tolerance = ms; 		}
+	uint32_t get_num_pending()		{ return num_pending; 	}
+	uint32_t get_num_fired()		{ return num_fired; 	}
+	uint32_t get_num_missed()		{ return num_missed;	}
+	uint32_t get_max_lateness()		{ return max_lateness; 	}
+	void reset_stats();
+	void print_stats(Stream *serial);
+
+protected:
+
+	void insert(Timer *timer, uint32_t earliest);
+	void unlink(Timer *timer);
+	void cascade(int level);
+	void tick();
+	void fire(Timer *timer);
+
+	Timer *wheel[SCHED_NUM_LEVELS][SCHED_WHEEL_SLOTS];
+	uint32_t now_tick;
+	uint32_t num_pending;
+
+	uint32_t tolerance;
+	uint32_t num_fired;
+	uint32_t num_missed;
+	uint32_t max_lateness;
+};
+
+#endif
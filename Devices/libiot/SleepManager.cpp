@@ -0,0 +1,139 @@
+/* SleepManager.cpp
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "SleepManager.h"
+extern "C" {
+#include <user_interface.h>
+}
+
+// Public:
+// ============================================================================
+SleepManager::SleepManager() : SleepManager(NULL) {
+
+}
+
+SleepManager::SleepManager(Stream *debug_serial) : debug_serial(debug_serial), 
+reason(WakeReason::PowerOn), resumed(false), sent(false) {
+	memset(&snapshot, 0, sizeof(snapshot));
+}
+
+bool SleepManager::resume() {
+
+	// (RTC memory holds garbage after a power-on, which the CRC rejects)
+	bool valid = ESP.rtcUserMemoryRead(SLEEP_RTC_OFFSET, (uint32_t *)&snapshot, sizeof(snapshot)) && 
+		snapshot.version == SLEEP_SNAPSHOT_VERSION && 
+		snapshot.crc == crc32((uint8_t *)&snapshot.version, sizeof(snapshot) - sizeof(snapshot.crc));
+	if (!valid)
+		memset(&snapshot, 0, sizeof(snapshot));
+	snapshot.stats.send_us = 0;
+
+	// Reset pulses in deep sleep report the same reason as the timer, so 
+	// only a sleep without a timer pins the wake on the sensor
+	switch (ESP.getResetInfoPtr()->reason) {
+		case REASON_DEFAULT_RST: 		reason = WakeReason::PowerOn; 	break;
+		case REASON_EXT_SYS_RST: 		reason = WakeReason::Sensor; 	break;
+		case REASON_DEEP_SLEEP_AWAKE: 
+			reason = valid && !snapshot.sleep_ms ? WakeReason::Sensor : WakeReason::DeepSleep;
+			break;
+		default: 						reason = WakeReason::Restart; 	break;
+	}
+
+	resumed = valid && reason != WakeReason::PowerOn;
+	if (resumed)
+		snapshot.stats.num_wakes++;
+	else
+		snapshot.stats.num_cold++;
+	if (resumed)
+		print_sleep("Resumed");
+	else
+		print_sleep("Cold boot");
+	return resumed;
+}
+
+void SleepManager::mark_sent() {
+
+	if (sent)
+		return;
+	sent = true;
+
+	// Counted from boot (the ROM bootloader's few milliseconds before it 
+	// aren't visible to the firmware)
+	SleepStats &stats = snapshot.stats;
+	stats.send_us = micros();
+	if (resumed) {
+		if (stats.send_us > stats.max_send_us)
+			stats.max_send_us = stats.send_us;
+		if (stats.send_us > SLEEP_WAKE_BUDGET_US)
+			stats.num_over_budget++;
+	}
+	print_sleep("Wake event sent");
+}
+
+void SleepManager::save() {
+	snapshot.version = SLEEP_SNAPSHOT_VERSION;
+	snapshot.crc = crc32((uint8_t *)&snapshot.version, sizeof(snapshot) - sizeof(snapshot.crc));
+	ESP.rtcUserMemoryWrite(SLEEP_RTC_OFFSET, (uint32_t *)&snapshot, sizeof(snapshot));
+}
+
+void SleepManager::sleep(uint32_t max_ms) {
+
+	SleepStats &stats = snapshot.stats;
+	stats.awake_ms = millis();
+	stats.total_awake_ms += stats.awake_ms;
+	snapshot.sleep_ms = max_ms;
+	save();
+	print_sleep("Sleeping");
+
+	uint64_t us = (uint64_t)max_ms * 1000;
+	if (us > ESP.deepSleepMax())
+		us = ESP.deepSleepMax();
+	ESP.deepSleep(us);
+}
+
+const char *SleepManager::reason_name(WakeReason reason) {
+	switch (reason) {
+		case WakeReason::PowerOn: 	return "power-on";
+		case WakeReason::Sensor: 	return "sensor";
+		case WakeReason::DeepSleep: return "deep-sleep";
+		default: 					return "restart";
+	}
+}
+
+// Protected:
+// ============================================================================
+/* CRC-32 (IEEE, bitwise: the snapshot is small and checked once per boot) */
+uint32_t SleepManager::crc32(const uint8_t *data, size_t len) {
+	uint32_t crc = 0xFFFFFFFF;
+	while (len--) {
+		crc ^= *data++;
+		for (int i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+	return ~crc;
+}
+
+// Print utilities:
+// ============================================================================
+void SleepManager::print_sleep(char *description) {
+	if (debug_serial)
+		debug_serial->printf("\n%24s: %s, %u wakes, %u cold, sent at %u us, awake %u ms\n", 
+			description, reason_name(reason), snapshot.stats.num_wakes, snapshot.stats.num_cold, 
+			snapshot.stats.send_us, snapshot.stats.awake_ms);
+}
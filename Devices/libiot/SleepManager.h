@@ -0,0 +1,131 @@
+/* SleepManager.h
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef SLEEPMANAGER_H
+#define SLEEPMANAGER_H
+
+#include "Arduino.h"
+#include "WifiManager.h"
+
+// Where the snapshot lives in RTC user memory, in 4-byte blocks (the first 
+// 128 bytes hold OTA update commands)
+#ifndef SLEEP_RTC_OFFSET
+#define SLEEP_RTC_OFFSET 32
+#endif
+
+// Wake-to-send budget for resumed wakes: from boot to the wake event's send
+#ifndef SLEEP_WAKE_BUDGET_US
+#define SLEEP_WAKE_BUDGET_US 250000
+#endif
+
+// Bumped when the snapshot layout changes (older snapshots are ignored)
+#define SLEEP_SNAPSHOT_VERSION 2
+
+enum class WakeReason {
+	PowerOn = 0,	// Power applied; RTC memory doesn't survive it
+	Sensor,			// Reset pin pulsed (the sensor's wake circuit), while 
+					// awake or in deep sleep without a timer
+	DeepSleep,		// Out of deep sleep with a timer set: the timer (GPIO16 
+					// wired to reset) or the sensor, which reset alike
+	Restart			// Software restart, watchdog or exception
+};
+
+struct SleepStats {
+	uint32_t num_wakes;			// Boots resumed from the snapshot
+	uint32_t num_cold;			// Boots without one
+	uint32_t num_fallbacks;		// Resumes that needed a full connect
+	uint32_t num_over_budget;	// Resumed wakes over SLEEP_WAKE_BUDGET_US
+	uint32_t send_us;			// Boot to the wake event's send, last boot
+	uint32_t max_send_us;		// Of resumed wakes
+	uint32_t awake_ms;			// Boot to sleep, last completed boot
+	uint32_t total_awake_ms;
+};
+
+// Kept in RTC memory across deep sleep (a multiple of 4 bytes)
+struct SleepSnapshot {
+	uint32_t crc;				// CRC-32 of everything after it
+	uint32_t version;
+	WifiResume net;				// Access point, channel and addresses
+	uint32_t dest_addr;			// Host and port events go to
+	uint16_t dest_port;
+	uint16_t probe_port;		// Where the bridge takes UDP (LinkMonitor)
+	uint32_t journal_epoch;		// EventJournal::restore()
+	uint32_t journal_seq;
+	uint32_t sleep_ms;			// sleep()'s max_ms (0: only the sensor wakes)
+	SleepStats stats;
+};
+
+/* Battery operation in deep sleep. The node is reset out of deep sleep 
+   (by the sensor, or by the timer) and boots from scratch, with only RTC 
+   memory kept: sleep() saves a CRC-checked snapshot of what the next boot 
+   needs to send at once (network parameters, destination and sequence 
+   counters), and resume() reads it back. The manager also times each wake, 
+   from boot to the first send and to sleep, against a budget. */
+class SleepManager {
+
+public:
+
+	SleepManager();
+	SleepManager(Stream *debug_serial);
+
+	// Read the snapshot and the reset reason; return false after a power-on 
+	// or without a valid snapshot (boot cold)
+	bool resume();
+
+	// Snapshot saved by save() and sleep(); the caller fills it in
+	SleepSnapshot &get_snapshot()		{ return snapshot; 		}
+
+	// Record the wake event's send (only the first of each boot counts)
+	void mark_sent();
+
+	// Record a full connect after a failed resume
+	void mark_fallback()				{ snapshot.stats.num_fallbacks++; }
+
+	// Write the snapshot to RTC memory (e.g. after each event, in case a 
+	// sensor edge resets the node before it sleeps)
+	void save();
+
+	// Save the snapshot and sleep until reset, or for up to max_ms (with 
+	// GPIO16 wired to reset; 0 sleeps until the sensor wakes the node)
+	void sleep(uint32_t max_ms);
+
+	// Getters
+	bool is_resumed()					{ return resumed; 		}
+	bool is_sent()						{ return sent; 			}
+	WakeReason get_wake_reason()		{ return reason; 		}
+	const SleepStats &get_stats()		{ return snapshot.stats; }
+
+	static const char *reason_name(WakeReason reason);
+
+protected:
+
+	static uint32_t crc32(const uint8_t *data, size_t len);
+
+	// Print utilities
+	void print_sleep(char *description);
+
+	Stream *debug_serial;
+	SleepSnapshot snapshot;
+	WakeReason reason;
+	bool resumed;
+	bool sent;
+};
+
+#endif
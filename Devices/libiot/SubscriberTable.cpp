@@ -0,0 +1,239 @@
+/* SubscriberTable.cpp
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "SubscriberTable.h"
+#include "EventJournal.h"
+
+// Public:
+// ============================================================================
+SubscriberTable::SubscriberTable() : SubscriberTable(NULL) {
+
+}
+
+SubscriberTable::SubscriberTable(Stream *debug_serial) : 
+udp_client(NULL), tcp_client(NULL), wired(NULL), pool(NULL), journal(NULL), links(NULL), debug_serial(debug_serial), 
+interning(false), num_published(0), num_failed(0) {
+	clear();
+}
+
+bool SubscriberTable::subscribe(IPAddress addr, uint16_t port, const char *filter, 
+	SubTransport transport, uint32_t lease_ms) {
+
+	// Only one subscriber can own the TCP connection
+	if (transport == SubTransport::Tcp) {
+		for (int i = 0; i < SUB_MAX_SUBSCRIBERS; i++) {
+			Subscriber &sub = subscribers[i];
+			if (sub.active && sub.transport == SubTransport::Tcp && 
+				(sub.addr != addr || sub.port != port)) {
+				print_subscriber("Replacing subscriber", sub);
+				sub.active = false;
+			}
+		}
+	}
+
+	// Renew in place, else take a free slot
+	int idx = find(addr, port);
+	if (idx < 0) {
+		for (idx = 0; idx < SUB_MAX_SUBSCRIBERS && subscribers[idx].active; idx++)
+			;
+		if (idx == SUB_MAX_SUBSCRIBERS) {
+			if (debug_serial)
+				debug_serial->printf("\n%24s: %s\n", "Subscriber table full", filter);
+			return false;
+		}
+		subscribers[idx].num_sent = 0;
+	}
+
+	Subscriber &sub = subscribers[idx];
+	sub.addr = addr;
+	sub.port = port;
+	sub.transport = transport;
+	strncpy(sub.filter, filter, SUB_MAX_FILTER_LENGTH-1);
+	sub.filter[SUB_MAX_FILTER_LENGTH-1] = '\0';
+	sub.lease_ms = lease_ms;
+	sub.renewed_ms = millis();
+	sub.active = true;
+	print_subscriber("Subscribed", sub);
+	return true;
+}
+
+bool SubscriberTable::unsubscribe(IPAddress addr, uint16_t port) {
+	int idx = find(addr, port);
+	if (idx < 0)
+		return false;
+	print_subscriber("Unsubscribed", subscribers[idx]);
+	subscribers[idx].active = false;
+	return true;
+}
+
+void SubscriberTable::clear() {
+	for (int i = 0; i < SUB_MAX_SUBSCRIBERS; i++)
+		subscribers[i].active = false;
+}
+
+int SubscriberTable::publish(OSCMessage &msg, MessageClass cls) {
+
+	char path[SUB_MAX_PATH_LENGTH];
+	msg.getAddress(path, 0, sizeof(path));
+	expire();
+
+	// Serialize only if someone wants the message
+	int num_matched = 0;
+	bool match[SUB_MAX_SUBSCRIBERS];
+	for (int i = 0; i < SUB_MAX_SUBSCRIBERS; i++) {
+		match[i] = subscribers[i].active && matches(subscribers[i].filter, path);
+		num_matched += match[i];
+	}
+	if (!num_matched)
+		return 0;
+
+	size_t len = msg.bytes();
+	char *data = (char *)(pool ? pool->alloc(len, POOL_OWNER_APP) : malloc(len));
+	if (!data) {
+		num_failed++;
+		return 0;
+	}
+	BufferPrint buffer((uint8_t *)data, len);
+	msg.send(buffer);
+
+	for (int i = 0; i < SUB_MAX_SUBSCRIBERS; i++) {
+		if (match[i])
+			send(subscribers[i], data, buffer.len, path, cls);
+	}
+	num_published++;
+
+	if (pool)
+		pool->release(data);
+	else
+		free(data);
+	return num_matched;
+}
+
+void SubscriberTable::expire() {
+	uint32_t now = millis();
+	for (int i = 0; i < SUB_MAX_SUBSCRIBERS; i++) {
+		Subscriber &sub = subscribers[i];
+		if (sub.active && sub.lease_ms && now - sub.renewed_ms > sub.lease_ms) {
+			print_subscriber("Subscription expired", sub);
+			sub.active = false;
+		}
+	}
+}
+
+bool SubscriberTable::matches(const char *filter, const char *path) {
+
+	size_t n = strlen(filter);
+	if (n == 0 || (n == 1 && filter[0] == '/'))
+		return true;
+	if (filter[n-1] == '*')
+		return strncmp(filter, path, n-1) == 0;
+
+	// Whole path segments only: "/gate" matches "/gate/x" but not "/gates"
+	return strncmp(filter, path, n) == 0 && 
+		(path[n] == '\0' || path[n] == '/' || filter[n-1] == '/');
+}
+
+const char *SubscriberTable::transport_name(SubTransport transport) {
+	switch (transport) {
+		case SubTransport::Tcp:		return "tcp";
+		case SubTransport::Wired:	return "wired";
+		default:					return "udp";
+	}
+}
+
+int SubscriberTable::get_num_subscribers() {
+	int n = 0;
+	expire();
+	for (int i = 0; i < SUB_MAX_SUBSCRIBERS; i++)
+		n += subscribers[i].active;
+	return n;
+}
+
+// Protected:
+// ============================================================================
+int SubscriberTable::find(IPAddress addr, uint16_t port) {
+	for (int i = 0; i < SUB_MAX_SUBSCRIBERS; i++) {
+		if (subscribers[i].active && subscribers[i].addr == addr && subscribers[i].port == port)
+			return i;
+	}
+	return -1;
+}
+
+void SubscriberTable::send(Subscriber &sub, char *data, size_t len, const char *path, 
+	MessageClass cls) {
+	if (sub.transport == SubTransport::Wired) {
+		if (wired && wired->send((uint8_t *)data, len))
+			sub.num_sent++;
+		return;
+	}
+	// Events go over UDP while the link monitor prefers it. Journaled ones 
+	// go to the bridge instead, as a copy of the journal's /ev for it to 
+	// drop whichever comes second (and only through the journal if the 
+	// bridge takes no UDP).
+	if (sub.transport == SubTransport::Tcp) {
+		bool udp = cls == MessageClass::Event && links && links->choose() == LinkId::Udp;
+		if (udp && journal && journal->accepts(path) && send_tcp(data, len, path)) {
+			uint8_t copy[JOURNAL_EVENT_HEADER_BYTES + JOURNAL_MAX_EVENT_BYTES + 3];
+			size_t n = journal->encode_last(copy, sizeof(copy));
+			if (n)
+				links->send_udp(copy, n);
+			sub.num_sent++;
+			return;
+		}
+		if (!udp && send_tcp(data, len, path)) {
+			sub.num_sent++;
+			return;
+		}
+	}
+	if (udp_client) {
+		udp_client->send(data, len, sub.addr, sub.port);
+		sub.num_sent++;
+	}
+}
+
+/* Send over TCP, via the journal if it takes the path. Interned packets are 
+   made in place by writing the header over the end of the padded address 
+   (restored after, for other subscribers and the UDP fallback). */
+bool SubscriberTable::send_tcp(char *data, size_t len, const char *path) {
+
+	uint16_t id = interning ? OSCIntern::id(path) : 0;
+	char saved[OSC_INTERN_HEADER_LENGTH];
+	char *packet = data;
+	if (id) {
+		size_t n = OSCIntern::address_length(path) - OSC_INTERN_HEADER_LENGTH;
+		packet = data + n;
+		len -= n;
+		memcpy(saved, packet, OSC_INTERN_HEADER_LENGTH);
+		OSCIntern::write_header((uint8_t *)packet, id);
+	}
+	bool sent = (journal && journal->accepts(path) && journal->record(packet, len)) || 
+		(tcp_client && tcp_client->send(packet, len));
+	if (id)
+		memcpy(packet, saved, OSC_INTERN_HEADER_LENGTH);
+	return sent;
+}
+
+// Print utilities:
+// ============================================================================
+void SubscriberTable::print_subscriber(char *description, Subscriber &sub) {
+	if (debug_serial)
+		debug_serial->printf("\n%24s: %s:%d %s %s\n", description, 
+			sub.addr.toString().c_str(), sub.port, transport_name(sub.transport), sub.filter);
+}
@@ -0,0 +1,143 @@
+/* SubscriberTable.h
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef SUBSCRIBERTABLE_H
+#define SUBSCRIBERTABLE_H
+
+#include <OSCMessage.h>
+#include "Arduino.h"
+#include "UDPClient.h"
+#include "TCPClient.h"
+#include "BlockPool.h"
+#include "OSCIntern.h"
+#include "Transport.h"
+#include "LinkMonitor.h"
+
+class EventJournal;
+
+#ifndef SUB_MAX_SUBSCRIBERS
+#define SUB_MAX_SUBSCRIBERS 4
+#endif
+#ifndef SUB_MAX_FILTER_LENGTH
+#define SUB_MAX_FILTER_LENGTH 32
+#endif
+#ifndef SUB_MAX_PATH_LENGTH
+#define SUB_MAX_PATH_LENGTH 64
+#endif
+
+enum class SubTransport {
+	Udp = 0,
+	Tcp, 			// Via the attached TCPClient (one subscriber at a time), 
+					// falling back on UDP while it is disconnected, and 
+					// events over UDP while the link monitor prefers it
+	Wired			// Via the attached point-to-point transport (e.g. SLIP 
+					// over serial); the address and port are unused
+};
+
+struct Subscriber {
+	IPAddress addr;
+	uint16_t port;
+	SubTransport transport;
+	char filter[SUB_MAX_FILTER_LENGTH];
+	uint32_t lease_ms;			// 0: never expires
+	uint32_t renewed_ms;
+	uint32_t num_sent;
+	bool active;
+};
+
+/* Destinations for outgoing messages, each with its own transport and OSC 
+   path filter. A filter matches its path and everything below it ("/stream" 
+   matches /stream and /stream/...); a trailing '*' matches any path with 
+   that prefix, and "/" matches everything. publish() serializes a message 
+   once and sends the same bytes to every matching subscriber. */
+class SubscriberTable {
+
+public:
+
+	SubscriberTable();
+	SubscriberTable(Stream *debug_serial);
+
+	// Transports, and a pool for the serialization buffer (else the heap)
+	void attach(UDPClient *udp, TCPClient *tcp) { udp_client = udp; tcp_client = tcp; }
+	void attach(BlockPool *pool) 				{ this->pool = pool; }
+	void attach(Transport *wired)				{ this->wired = wired; }
+
+	// Choose the TCP subscriber's link for events (MessageClass::Event) 
+	// from live measurements; without a monitor they go over TCP too. An 
+	// event the journal takes goes over UDP to the bridge as a copy of the 
+	// journaled event, and the bridge passes on whichever copy comes first, 
+	// so it arrives once, and still arrives if the datagram is lost.
+	void attach(LinkMonitor *links)				{ this->links = links; }
+
+	// Hand messages for the TCP subscriber under the journal's filter to 
+	// the journal, which delivers them (and keeps them until acknowledged)
+	void attach(EventJournal *journal)			{ this->journal = journal; }
+
+	// Send the TCP subscriber interned packets (OSCIntern.h), once it has 
+	// agreed to decode them; off by default and on every reconnect
+	void set_interning(bool interning)			{ this->interning = interning; }
+	bool get_interning()						{ return interning; }
+
+	// Add a subscriber, or renew the one at the same address and port. A TCP
+	// subscriber replaces any other. Return false if the table is full.
+	bool subscribe(IPAddress addr, uint16_t port, const char *filter, 
+		SubTransport transport, uint32_t lease_ms);
+	bool unsubscribe(IPAddress addr, uint16_t port);
+	void clear();
+
+	// Send msg to every matching subscriber; return the number sent to
+	int publish(OSCMessage &msg, MessageClass cls = MessageClass::State);
+
+	// Drop subscribers whose lease ran out (also done by publish())
+	void expire();
+
+	static bool matches(const char *filter, const char *path);
+	static const char *transport_name(SubTransport transport);
+
+	// Getters
+	int get_num_subscribers();
+	const Subscriber &get_subscriber(int idx) 	{ return subscribers[idx]; 	}
+	uint32_t get_num_published()				{ return num_published; 	}
+	uint32_t get_num_failed()					{ return num_failed; 		}
+
+protected:
+
+	int find(IPAddress addr, uint16_t port);
+	void send(Subscriber &sub, char *data, size_t len, const char *path, MessageClass cls);
+	bool send_tcp(char *data, size_t len, const char *path);
+
+	// Print utilities
+	void print_subscriber(char *description, Subscriber &sub);
+
+	Subscriber subscribers[SUB_MAX_SUBSCRIBERS];
+	UDPClient *udp_client;
+	TCPClient *tcp_client;
+	Transport *wired;
+	BlockPool *pool;
+	EventJournal *journal;
+	LinkMonitor *links;
+	Stream *debug_serial;
+	bool interning;
+
+	uint32_t num_published;
+	uint32_t num_failed;		// Messages that could not be serialized
+};
+
+#endif
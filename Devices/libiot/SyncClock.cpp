@@ -0,0 +1,191 @@
+/* SyncClock.cpp
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "SyncClock.h"
+
+// Seconds from the NTP epoch (1900) to the Unix epoch (1970)
+#define NTP_UNIX_OFFSET 2208988800ULL
+
+static void _s_clock_handle_sync_timer(void *arg) {
+	SyncClock *self = (SyncClock *)arg;
+	self->handle_sync_timer();
+}
+
+// Public:
+// ============================================================================
+SyncClock::SyncClock() : SyncClock(NULL) {
+
+}
+
+SyncClock::SyncClock(Stream *debug_serial) : tcp_client(NULL), sched(NULL), 
+debug_serial(debug_serial), interval_ms(CLOCK_SYNC_INTERVAL_MS), burst(CLOCK_BURST), 
+running(false), last_micros(0), micros_high(0), seq(0), round_seq(0), num_sent(0), 
+have_best(false), best_offset(0), best_us(0), best_rtt(0), synced(false), offset(0), 
+offset_us(0), first_offset(0), first_us(0), skew(0), rtt_us(0), num_samples(0), 
+num_timeouts(0), num_steps(0) {
+	sync_timer.set_handler(&_s_clock_handle_sync_timer, (void *)this);
+}
+
+void SyncClock::set_interval(uint32_t interval_ms, uint8_t burst) {
+	this->interval_ms = interval_ms;
+	this->burst = burst < 1 ? 1 : (burst > CLOCK_BURST ? CLOCK_BURST : burst);
+}
+
+void SyncClock::start() {
+	running = true;
+	num_sent = 0;
+	have_best = false;
+	if (sched) {
+		sched->cancel(&sync_timer);
+		sched->add(&sync_timer, 0);
+	}
+}
+
+void SyncClock::stop() {
+	running = false;
+	if (sched)
+		sched->cancel(&sync_timer);
+}
+
+bool SyncClock::handle_response(OSCMessage &msg) {
+
+	uint64_t t4 = local_us();
+	if (msg.size() < 5)
+		return false;
+	for (int i = 0; i < 5; i++) {
+		if (!msg.isInt(i))
+			return false;
+	}
+
+	// Only requests of the current round count
+	uint32_t n = (uint32_t)msg.getInt(0) - round_seq;
+	if (n >= num_sent)
+		return true;
+	uint64_t t1 = sent_us[n];
+	uint64_t t2 = timetag_to_us(((uint64_t)(uint32_t)msg.getInt(1) << 32) | (uint32_t)msg.getInt(2));
+	uint64_t t3 = timetag_to_us(((uint64_t)(uint32_t)msg.getInt(3) << 32) | (uint32_t)msg.getInt(4));
+
+	int64_t rtt = (int64_t)(t4 - t1) - (int64_t)(t3 - t2);
+	if (rtt < 0)
+		rtt = 0;
+	if (!have_best || rtt < best_rtt) {
+		have_best = true;
+		best_rtt = rtt;
+		best_offset = ((int64_t)(t2 - t1) + (int64_t)(t3 - t4)) / 2;
+		best_us = t4;
+	}
+	return true;
+}
+
+uint64_t SyncClock::local_us() {
+	uint32_t now = micros();
+	if (now < last_micros)
+		micros_high++;
+	last_micros = now;
+	return ((uint64_t)micros_high << 32) | now;
+}
+
+uint64_t SyncClock::to_host_us(uint64_t local) {
+	return local + offset_at(local);
+}
+
+uint64_t SyncClock::to_local_us(uint64_t host) {
+	uint64_t local = host - offset;
+	return host - offset_at(local);
+}
+
+uint64_t SyncClock::timetag_to_us(uint64_t timetag) {
+	return (timetag >> 32) * 1000000ULL + (((timetag & 0xFFFFFFFFULL) * 1000000ULL) >> 32);
+}
+
+uint64_t SyncClock::us_to_timetag(uint64_t us) {
+	// (Rounded up, so timetag_to_us() gives back the same time)
+	return ((us / 1000000ULL) << 32) | ((((us % 1000000ULL) << 32) + 999999ULL) / 1000000ULL);
+}
+
+void SyncClock::handle_sync_timer() {
+	if (!running || !sched)
+		return;
+	local_us();				// (Keeps the high word current)
+	if (num_sent < burst) {
+		send_request();
+		sched->add(&sync_timer, num_sent < burst ? CLOCK_BURST_SPACING_MS : CLOCK_RESPONSE_TIMEOUT_MS);
+		return;
+	}
+	finish_round();
+	sched->add(&sync_timer, interval_ms);
+}
+
+// Protected:
+// ============================================================================
+void SyncClock::send_request() {
+	if (num_sent == 0) {
+		round_seq = seq;
+		have_best = false;
+	}
+	OSCMessage msg(CLOCK_REQUEST_PATH);
+	msg.add((int)seq);
+	sent_us[num_sent++] = local_us();
+	seq++;
+	if (tcp_client)
+		tcp_client->send(msg);
+}
+
+void SyncClock::finish_round() {
+	num_sent = 0;
+	if (!have_best) {
+		num_timeouts++;
+		return;
+	}
+	have_best = false;
+	rtt_us = best_rtt;
+	apply(best_offset, best_us);
+}
+
+void SyncClock::apply(int64_t offset, uint64_t at) {
+
+	int64_t error = synced ? offset - offset_at(at) : 0;
+	if (!synced || error > CLOCK_STEP_US || error < -CLOCK_STEP_US) {
+		if (synced)
+			num_steps++;
+		synced = true;
+		first_offset = offset;
+		first_us = at;
+		skew = 0;
+	}
+	else if (at - first_us >= (uint64_t)CLOCK_SKEW_BASELINE_MS * 1000)
+		skew = (float)((double)(offset - first_offset) / (double)(at - first_us));
+	this->offset = offset;
+	offset_us = at;
+	num_samples++;
+	print_clock("Clock synced");
+}
+
+int64_t SyncClock::offset_at(uint64_t local) {
+	return offset + (int64_t)(skew * (float)(int64_t)(local - offset_us));
+}
+
+// Print utilities:
+// ============================================================================
+void SyncClock::print_clock(char *description) {
+	if (debug_serial)
+		debug_serial->printf("\n%24s: rtt %u us, skew %d ppb, %u samples\n", description, 
+			rtt_us, (int)(skew * 1e9f), num_samples);
+}
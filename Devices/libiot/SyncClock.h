@@ -0,0 +1,150 @@
+/* SyncClock.h
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+
+#ifndef SYNCCLOCK_H
+#define SYNCCLOCK_H
+
+#include <OSCMessage.h>
+#include "Arduino.h"
+#include "TCPClient.h"
+#include "Scheduler.h"
+
+#ifndef CLOCK_SYNC_INTERVAL_MS
+#define CLOCK_SYNC_INTERVAL_MS 5000
+#endif
+#ifndef CLOCK_BURST
+#define CLOCK_BURST 4
+#endif
+#ifndef CLOCK_BURST_SPACING_MS
+#define CLOCK_BURST_SPACING_MS 25
+#endif
+#ifndef CLOCK_RESPONSE_TIMEOUT_MS
+#define CLOCK_RESPONSE_TIMEOUT_MS 250
+#endif
+
+// Skew is estimated once samples span this long, and the clock starts over 
+// when a sample is further than CLOCK_STEP_US from the prediction (e.g. a 
+// different host)
+#define CLOCK_SKEW_BASELINE_MS 30000
+#define CLOCK_STEP_US 20000
+
+// /clock/req <seq>, answered with /clock/resp <seq> <t2_sec> <t2_frac> 
+// <t3_sec> <t3_frac>: NTP times the host received the request and replied
+#define CLOCK_REQUEST_PATH "/clock/req"
+#define CLOCK_RESPONSE_PATH "/clock/resp"
+
+/* Device clock synchronized to the host's (the bridge's) over TCP, for 
+   executing OSC bundles at their timetag. Every interval the clock sends a 
+   burst of requests and keeps the sample with the shortest round trip, 
+   whose offset error is bounded by half the round trip's asymmetry. Skew 
+   (crystal drift, tens of ppm) is estimated over the longest span of 
+   samples, so the clock stays close between rounds. Host times are in 
+   microseconds since the NTP epoch (1900), like OSC timetags. */
+class SyncClock {
+
+public:
+
+	SyncClock();
+	SyncClock(Stream *debug_serial);
+
+	void attach(TCPClient *tcp)			{ tcp_client = tcp; 	}
+	void attach(Scheduler *scheduler)	{ sched = scheduler; 	}
+	void set_interval(uint32_t interval_ms, uint8_t burst);
+
+	// Sync now and every interval (call once connected), or stop syncing 
+	// (the clock keeps running on its last estimate)
+	void start();
+	void stop();
+
+	// /clock/resp <seq> <t2_sec> <t2_frac> <t3_sec> <t3_frac>
+	bool handle_response(OSCMessage &msg);
+
+	// micros() extended to 64 bits (must be called at least every 71 
+	// minutes, which syncing does)
+	uint64_t local_us();
+
+	// Host time now, and conversions (valid once synced)
+	bool is_synced()					{ return synced; 			}
+	uint64_t host_us()					{ return to_host_us(local_us()); }
+	uint64_t to_host_us(uint64_t local);
+	uint64_t to_local_us(uint64_t host);
+
+	static uint64_t timetag_to_us(uint64_t timetag);
+	static uint64_t us_to_timetag(uint64_t us);
+
+	// Getters
+	uint32_t get_rtt_us()				{ return rtt_us; 			}
+	float get_skew_ppm()				{ return skew * 1e6f; 		}
+	uint32_t get_num_samples()			{ return num_samples; 		}
+	uint32_t get_num_timeouts()			{ return num_timeouts; 		}
+	uint32_t get_num_steps()			{ return num_steps; 		}
+
+	// Timer handler; must be public for the static handler
+	void handle_sync_timer();
+
+protected:
+
+	void send_request();
+	void finish_round();
+	void apply(int64_t offset, uint64_t at);
+	int64_t offset_at(uint64_t local);
+
+	// Print utilities
+	void print_clock(char *description);
+
+	TCPClient *tcp_client;
+	Scheduler *sched;
+	Timer sync_timer;
+	Stream *debug_serial;
+
+	uint32_t interval_ms;
+	uint8_t burst;
+	bool running;
+
+	// 64-bit micros()
+	uint32_t last_micros;
+	uint32_t micros_high;
+
+	// Current round
+	uint32_t seq;
+	uint32_t round_seq;			// First sequence number of the round
+	uint8_t num_sent;
+	uint64_t sent_us[CLOCK_BURST];
+	bool have_best;
+	int64_t best_offset;
+	uint64_t best_us;
+	uint32_t best_rtt;
+
+	// Estimate: host = local + offset + skew * (local - offset_us)
+	bool synced;
+	int64_t offset;
+	uint64_t offset_us;
+	int64_t first_offset;
+	uint64_t first_us;
+	float skew;
+
+	uint32_t rtt_us;
+	uint32_t num_samples;
+	uint32_t num_timeouts;
+	uint32_t num_steps;
+};
+
+#endif
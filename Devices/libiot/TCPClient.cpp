@@ -47,6 +47,29 @@ static void _s_tcpc_handle_timeout(void *arg, AsyncClient *client, uint32_t time
 	client_instance->handle_timeout(client, time);
 }
 
+static void _s_tcpc_handle_ack(void *arg, AsyncClient *client, size_t len, uint32_t time) {
+	TCPClient *client_instance = (TCPClient *)arg;
+	client_instance->handle_ack(client, len, time);
+}
+
+static void _s_tcpc_handle_packet(uint8_t *data, size_t len, void *arg) {
+	TCPClient *client_instance = (TCPClient *)arg;
+	client_instance->handle_packet(data, len);
+}
+
+static void _s_tcpc_handle_reconnect_timer(void *arg) {
+	TCPClient *client_instance = (TCPClient *)arg;
+	client_instance->handle_reconnect_timer();
+}
+
+static void _s_tcpc_handle_keepalive_timer(void *arg) {
+	TCPClient *client_instance = (TCPClient *)arg;
+	client_instance->handle_keepalive_timer();
+}
+
+// Serialized keepalive message ("/ka" with no arguments)
+static const uint8_t KEEPALIVE[8] = { '/', 'k', 'a', 0, ',', 0, 0, 0 };
+
 // Print utilities:
 // ============================================================================
 void TCPClient::print_tcp(char *description, const char *addr, uint16_t port) {
@@ -54,6 +77,11 @@ void TCPClient::print_tcp(char *description, const char *addr, uint16_t port) {
 		debug_serial->printf("\n%24s: %s:%d", description, addr, port);
 }
 
+void TCPClient::print_tcp(char *description, IPAddress addr, uint16_t port) {
+	if (debug_serial)
+		debug_serial->printf("\n%24s: %s:%d", description, addr.toString().c_str(), port);
+}
+
 void TCPClient::print_tcp_data(char *description, char *data, size_t len) {
 	if (debug_serial)
 		debug_serial->printf("\n%24s: %s\n", description, data);
@@ -61,88 +89,248 @@ void TCPClient::print_tcp_data(char *description, char *data, size_t len) {
 
 // Public:
 // ============================================================================
-TCPClient::TCPClient() {
-	TCPClient(NULL);
+TCPClient::TCPClient() : TCPClient(NULL) {
+	
 }
 
 TCPClient::TCPClient(Stream *debug_serial) : 
-debug_serial(debug_serial), 
-data_handler(NULL), user_data_d(NULL),
-connect_handler(NULL), user_data_c(NULL) {
-	client = new AsyncClient;
+client(&async_client), debug_serial(debug_serial), 
+connect_handler(NULL), user_data_c(NULL),
+sched(NULL), port(0), auto_reconnect(false),
+backoff_min_ms(0), backoff_max_ms(0), backoff_ms(0),
+keepalive_interval_ms(0), keepalive_timeout_ms(0), last_rx_ms(0),
+tx_unacked(0), tx_progress_ms(0),
+offline_policy(TCPOfflinePolicy::Drop), queue_len(0), queueing(false),
+num_reconnects(0), num_timeouts(0), num_dropped(0) {
+	host[0] = '\0';
+	reconnect_timer.set_handler(&_s_tcpc_handle_reconnect_timer, (void *)this);
+	keepalive_timer.set_handler(&_s_tcpc_handle_keepalive_timer, (void *)this);
 	client->onConnect(&_s_tcpc_handle_connect, (void *)this);
 	client->onData(&_s_tcpc_handle_data, (void *)this);
 	client->onDisconnect(&_s_tcpc_handle_disconnect, (void *)this);
 	client->onError(&_s_tcpc_handle_error, (void *)this);
 	client->onTimeout(&_s_tcpc_handle_timeout, (void *)this);
+	client->onAck(&_s_tcpc_handle_ack, (void *)this);
 }
 
 TCPClient::~TCPClient() {
-	if (client) {
-		disconnect();
-		delete(client);
-	}
+	disconnect();
 }
 
 void TCPClient::connect(const char *addr, uint16_t port) {
+	auto_reconnect = false;
 	if (client->connected())
 		client->close(true);
+	if (sched)
+		sched->cancel(&reconnect_timer);
+	strncpy(host, addr, TCP_MAX_HOST_LENGTH-1);
+	host[TCP_MAX_HOST_LENGTH-1] = '\0';
+	this->port = port;
+	backoff_ms = backoff_min_ms;
+	auto_reconnect = backoff_min_ms > 0;
 	print_tcp("Connecting to", addr, port);
-	client->connect(addr, port);
+	if (!client->connect(addr, port))
+		schedule_reconnect();
 }
 
-void TCPClient::send(OSCMessage &msg) {
-	if (client->space() > msg.bytes()) {
+bool TCPClient::send(OSCMessage &msg) {
+	if (!client->connected())
+		return count_send(msg.bytes(), enqueue(msg));
+	if (client->space() > OSC_STREAM_PREFIX_BYTES + msg.bytes()) {
 		print_tcp("OSC to TCP client", 
-			(char *)client->remoteIP().toString().c_str(), 
+			client->remoteIP(), 
 			client->remotePort());
+		add_prefix(msg.bytes());
 		msg.send(*this);
 		client->send();
+		return count_send(msg.bytes(), true);
 	}
+	num_dropped++;
+	return count_send(msg.bytes(), false);
 }
 
-void TCPClient::send(char *data, size_t len) {
-	if (client->space() > len) {
+bool TCPClient::send(char *data, size_t len) {
+	if (!client->connected())
+		return count_send(len, enqueue(data, len));
+	if (client->space() > OSC_STREAM_PREFIX_BYTES + len) {
 		print_tcp("Data to TCP client", 
-			(char *)client->remoteIP().toString().c_str(), 
+			client->remoteIP(), 
 			client->remotePort());
 		print_tcp_data("Data", data, len);
-		client->add(data, len);
+		add_prefix(len);
+		add(data, len);
 		client->send();
+		return count_send(len, true);
 	}
-	else 
-		print_tcp_data("Failed to send data", data, len);
+	print_tcp_data("Failed to send data", data, len);
+	num_dropped++;
+	return count_send(len, false);
 }
 
 void TCPClient::disconnect() {
+	auto_reconnect = false;
+	if (sched) {
+		sched->cancel(&reconnect_timer);
+		sched->cancel(&keepalive_timer);
+	}
 	if (client->connected())
 		client->close(true);
 }
 
 void TCPClient::stop() {
+	auto_reconnect = false;
 	if (client->connected())
 		client->stop();
 }
 
+void TCPClient::set_reconnect(uint32_t min_ms, uint32_t max_ms) {
+	backoff_min_ms = backoff_ms = min_ms;
+	backoff_max_ms = max_ms > min_ms ? max_ms : min_ms;
+	auto_reconnect = min_ms > 0 && port;
+}
+
+void TCPClient::set_keepalive(uint32_t interval_ms, uint32_t timeout_ms) {
+	keepalive_interval_ms = interval_ms;
+	keepalive_timeout_ms = timeout_ms;
+	if (sched && interval_ms && client->connected())
+		sched->add(&keepalive_timer, interval_ms);
+}
+
+// Reconnect, keepalive and offline queue:
+// ============================================================================
+void TCPClient::schedule_reconnect() {
+	if (!sched || !auto_reconnect || reconnect_timer.pending())
+		return;
+
+	// "Equal jitter": wait between half and all of the current backoff
+	uint32_t delay_ms = backoff_ms / 2 + random(backoff_ms / 2 + 1);
+	backoff_ms = backoff_ms * 2 < backoff_max_ms ? backoff_ms * 2 : backoff_max_ms;
+	sched->add(&reconnect_timer, delay_ms);
+	if (debug_serial)
+		debug_serial->printf("\n%24s: %u ms\n", "Reconnecting in", delay_ms);
+}
+
+void TCPClient::handle_reconnect_timer() {
+	if (!auto_reconnect || client->connected() || client->connecting())
+		return;
+	num_reconnects++;
+	print_tcp("Reconnecting to", host, port);
+	if (!client->connect(host, port))
+		schedule_reconnect();
+}
+
+void TCPClient::handle_keepalive_timer() {
+	if (!client->connected() || !keepalive_interval_ms)
+		return;
+
+	// Half-dead connection: close it, and the disconnect handler reconnects
+	if (keepalive_timeout_ms && millis() - last_rx_ms > keepalive_timeout_ms) {
+		num_timeouts++;
+		print_tcp("Keepalive timeout", host, port);
+		client->close(true);
+		return;
+	}
+	if (client->space() > OSC_STREAM_PREFIX_BYTES + sizeof(KEEPALIVE)) {
+		add_prefix(sizeof(KEEPALIVE));
+		add((const char *)KEEPALIVE, sizeof(KEEPALIVE));
+		client->send();
+	}
+	sched->add(&keepalive_timer, keepalive_interval_ms);
+}
+
+bool TCPClient::enqueue(OSCMessage &msg) {
+	if (!reserve(msg.bytes()))
+		return false;
+	queueing = true;
+	msg.send(*this);
+	queueing = false;
+	return true;
+}
+
+bool TCPClient::enqueue(const char *data, size_t len) {
+	if (!reserve(len))
+		return false;
+	memcpy(queue + queue_len, data, len);
+	queue_len += len;
+	return true;
+}
+
+bool TCPClient::reserve(size_t len) {
+
+	if (offline_policy != TCPOfflinePolicy::Queue || len + 2 > TCP_QUEUE_BYTES) {
+		num_dropped++;
+		return false;
+	}
+
+	// Make room by dropping the oldest messages
+	while (queue_len + len + 2 > TCP_QUEUE_BYTES) {
+		size_t oldest = 2 + ((queue[0] << 8) | queue[1]);
+		memmove(queue, queue + oldest, queue_len - oldest);
+		queue_len -= oldest;
+		num_dropped++;
+	}
+
+	queue[queue_len++] = len >> 8;
+	queue[queue_len++] = len & 0xFF;
+	return true;
+}
+
+void TCPClient::flush_queue() {
+	size_t idx = 0;
+	while (idx < queue_len) {
+		size_t len = (queue[idx] << 8) | queue[idx+1];
+		if (client->space() <= OSC_STREAM_PREFIX_BYTES + len)
+			break;
+		add_prefix(len);
+		add((const char *)queue + idx + 2, len);
+		idx += 2 + len;
+	}
+	if (idx) {
+		client->send();
+		memmove(queue, queue + idx, queue_len - idx);
+		queue_len -= idx;
+	}
+}
+
+size_t TCPClient::add(const char *data, size_t len) {
+	if (!tx_unacked)
+		tx_progress_ms = millis();
+	len = client->add(data, len);
+	tx_unacked += len;
+	return len;
+}
+
+void TCPClient::add_prefix(size_t len) {
+	uint8_t prefix[OSC_STREAM_PREFIX_BYTES];
+	OSCStream::put_prefix(prefix, len);
+	add((const char *)prefix, sizeof(prefix));
+}
+
 // Print overrides so we can send by passing this instance to OSCMessage.send()
 // ============================================================================
+// (While queueing, writes go to the offline queue instead)
+// ============================================================================
 inline size_t TCPClient::write(uint8_t byte) { 
-	client->add((char *)(&byte), (size_t)1);
-	return 1;
+	return write((const uint8_t *)&byte, 1);
 }
 
 size_t TCPClient::write(const char *str) {
-	client->add(str, strlen(str));
-	return strlen(str);
+	return write((const uint8_t *)str, strlen(str));
 }
 
 size_t TCPClient::write(uint8_t *buffer, size_t size) {
-	client->add((char *)buffer, size);
-	return size;
+	return write((const uint8_t *)buffer, size);
 }
 
 size_t TCPClient::write(const uint8_t *buffer, size_t size) { 
-	client->add((const char *)buffer, size);
+	if (queueing) {
+		if (queue_len + size > TCP_QUEUE_BYTES)
+			size = TCP_QUEUE_BYTES - queue_len;
+		memcpy(queue + queue_len, buffer, size);
+		queue_len += size;
+		return size;
+	}
+	add((const char *)buffer, size);
 	return size;
 }
 
@@ -150,35 +338,61 @@ size_t TCPClient::write(const uint8_t *buffer, size_t size) {
 // ============================================================================
 void TCPClient::handle_connect(AsyncClient *client) {
 	print_tcp("Connected to", 
-		(char *)client->remoteIP().toString().c_str(), 
+		client->remoteIP(), 
 		client->remotePort());
+	backoff_ms = backoff_min_ms;
+	last_rx_ms = millis();
+	tx_unacked = 0;
+	rx_stream.reset();
+	if (sched && keepalive_interval_ms)
+		sched->add(&keepalive_timer, keepalive_interval_ms);
 	if (connect_handler)
 		connect_handler(user_data_c);
+	flush_queue();
 }
  
 void TCPClient::handle_data(AsyncClient *client, void *data, size_t len) {
+	last_rx_ms = millis();
+	rx_stream.feed((uint8_t *)data, len, _s_tcpc_handle_packet, (void *)this);
+}
+
+/* One packet of the stream; keepalive echoes only refresh liveness */
+void TCPClient::handle_packet(uint8_t *data, size_t len) {
+	if (len == sizeof(KEEPALIVE) && !memcmp(data, KEEPALIVE, sizeof(KEEPALIVE)))
+		return;
 	print_tcp("Data from TCP client", 
-		(char *)client->remoteIP().toString().c_str(), 
+		client->remoteIP(), 
 		client->remotePort());
 	print_tcp_data("Data", (char *)data, len);
-	if (data_handler)
-		data_handler((uint8_t *)data, len, user_data_d);
+	deliver(data, len);
 }
 
 void TCPClient::handle_error(AsyncClient *client, int8_t error) {
-	print_tcp("Connection error", 
-		(char *)client->remoteIP().toString().c_str(), 
-		client->remotePort());
+	print_tcp("Connection error", host, port);
+	schedule_reconnect();
 }
 
 void TCPClient::handle_disconnect(AsyncClient *client) {
-	print_tcp("Disconnected", 
-		(char *)client->remoteIP().toString().c_str(), 
-		client->remotePort());
+	print_tcp("Disconnected", host, port);
+	if (sched)
+		sched->cancel(&keepalive_timer);
+	schedule_reconnect();
+}
+
+void TCPClient::handle_ack(AsyncClient *client, size_t len, uint32_t time) {
+	tx_unacked = len < tx_unacked ? tx_unacked - len : 0;
+	tx_progress_ms = millis();
 }
 
 void TCPClient::handle_timeout(AsyncClient *client, uint32_t time) {
 	print_tcp("ACK timeout", 
-		(char *)client->remoteIP().toString().c_str(), 
+		client->remoteIP(), 
 		client->remotePort());
+
+	// Unacknowledged data is a strong hint the link is dead; expire the 
+	// keepalive so the next check closes the connection
+	if (sched && keepalive_interval_ms && keepalive_timeout_ms) {
+		last_rx_ms = millis() - keepalive_timeout_ms - 1;
+		sched->add(&keepalive_timer, 0);
+	}
 }
\ No newline at end of file
@@ -24,8 +24,28 @@
 #include <OSCMessage.h>
 #include "Print.h"
 #include "Arduino.h"
+#include "Scheduler.h"
+#include "Transport.h"
+#include "OSCStream.h"
+
+#ifndef TCP_MAX_HOST_LENGTH
+#define TCP_MAX_HOST_LENGTH 32
+#endif
+#ifndef TCP_QUEUE_BYTES
+#define TCP_QUEUE_BYTES 512
+#endif
+
+// Keepalive message; the bridge echoes it back on the same connection
+#define TCP_KEEPALIVE_PATH "/ka"
+
+// What send() does with messages while the connection is down
+enum class TCPOfflinePolicy {
+	Drop = 0,       // Return false (the caller may fall back on UDP)
+	Queue           // Queue up to TCP_QUEUE_BYTES (dropping the oldest) and 
+					// send them in order on reconnect
+};
 
-class TCPClient : public Print {
+class TCPClient : public Print, public Transport {
 
 public:
 
@@ -33,11 +53,6 @@ public:
 	TCPClient(Stream *debug_serial);
 	~TCPClient();
 
-	void set_data_handler(void (*handler)(uint8_t *, size_t, void *), void *user_data) {
-		data_handler = handler;
-		this->user_data_d = user_data;
-	}
-
 	void set_connect_handler(void (*handler)(void *), void *user_data) {
 		connect_handler = handler;
 		this->user_data_c = user_data;
@@ -45,18 +60,41 @@ public:
 
 	void connect(const char *address, uint16_t port_num);
 
-	void send(OSCMessage &msg);
-	void send(char *data, size_t len);
+	// Return false if the message was neither sent nor queued
+	bool send(OSCMessage &msg);
+	bool send(char *data, size_t len);
+	virtual bool send(const uint8_t *data, size_t len) 	{ return send((char *)data, len); }
 
+	// Close the connection (no automatic reconnect until the next connect())
 	void disconnect();
 	void stop();
 
+	// Reconnect automatically after a disconnect or failed connect, with 
+	// exponential backoff from min_ms to max_ms (each delay jittered down to 
+	// half), and send keepalives every interval_ms, closing the connection 
+	// when nothing is received for timeout_ms (0 disables). Both run on the 
+	// scheduler's timers.
+	void attach(Scheduler *scheduler) { sched = scheduler; }
+	void set_reconnect(uint32_t min_ms, uint32_t max_ms);
+	void set_keepalive(uint32_t interval_ms, uint32_t timeout_ms);
+	void set_offline_policy(TCPOfflinePolicy policy) { offline_policy = policy; }
+
 	// Getters
-	bool connected() 			{ return client->connected(); 	}
+	virtual bool connected() 	{ return client->connected(); 	}
+	virtual const char *name() 	{ return "tcp"; 				}
 	IPAddress remote_addr() 	{ return client->remoteIP();	}
 	uint16_t remote_port()		{ return client->remotePort();	}
+	uint32_t get_num_reconnects() 	{ return num_reconnects; 	}
+	uint32_t get_num_timeouts() 	{ return num_timeouts; 		}
+	uint32_t get_num_dropped() 		{ return num_dropped; 		}
 
-	// Print overrides (so OSCMessages can print directly to a TCPClient)
+	// Bytes sent and not yet acknowledged, and how long since the peer last 
+	// acknowledged any of them (0 when all are): grows while TCP retransmits
+	size_t get_unacked_bytes()		{ return tx_unacked; 		}
+	uint32_t get_queue_delay_ms()	{ return tx_unacked ? millis() - tx_progress_ms : 0; }
+
+	// Print overrides, for send(OSCMessage); a message printed directly goes
+	// out without its length prefix, so use send()
 	virtual size_t write(uint8_t);
 	virtual size_t write(const char *str);
 	virtual size_t write(uint8_t *buffer, size_t size);
@@ -70,21 +108,63 @@ public:
 	void handle_error(AsyncClient *client, int8_t error);
 	void handle_disconnect(AsyncClient *client);
 	void handle_timeout(AsyncClient *client, uint32_t time);
+	void handle_ack(AsyncClient *client, size_t len, uint32_t time);
+	void handle_packet(uint8_t *data, size_t len);
+
+	// Timer handlers
+	void handle_reconnect_timer();
+	void handle_keepalive_timer();
 
 protected:
 
+	void schedule_reconnect();
+	bool enqueue(OSCMessage &msg);
+	bool enqueue(const char *data, size_t len);
+	bool reserve(size_t len);		// Append a queue entry header, dropping the oldest to fit
+	void flush_queue();
+	size_t add(const char *data, size_t len);	// To the connection, counted as unacknowledged
+	void add_prefix(size_t len);	// Stream framing ahead of each packet (OSCStream)
+
 	// Print utilities
 	void print_tcp(char *description, const char *addr, uint16_t port);
+	void print_tcp(char *description, IPAddress addr, uint16_t port);
 	void print_tcp_data(char *description, char *data, size_t len);
 
+	AsyncClient async_client;		// (Embedded; never heap-allocated)
 	AsyncClient *client;
 	Stream *debug_serial;
+	OSCStream rx_stream;			// Incoming packets, split from segments
 
 	void (*connect_handler)(void *);
 	void *user_data_c;
 
-	void (*data_handler)(uint8_t *, size_t, void *);
-	void *user_data_d;
+	// Reconnect and keepalive
+	Scheduler *sched;
+	Timer reconnect_timer;
+	Timer keepalive_timer;
+	char host[TCP_MAX_HOST_LENGTH];
+	uint16_t port;
+	bool auto_reconnect;
+	uint32_t backoff_min_ms;
+	uint32_t backoff_max_ms;
+	uint32_t backoff_ms;
+	uint32_t keepalive_interval_ms;
+	uint32_t keepalive_timeout_ms;
+	uint32_t last_rx_ms;
+
+	// Acknowledgement progress
+	size_t tx_unacked;
+	uint32_t tx_progress_ms;
+
+	// Messages held while offline ([2-byte length][message] ...)
+	TCPOfflinePolicy offline_policy;
+	uint8_t queue[TCP_QUEUE_BYTES];
+	size_t queue_len;
+	bool queueing;
+
+	uint32_t num_reconnects;
+	uint32_t num_timeouts;
+	uint32_t num_dropped;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,52 @@
+/* Transport.cpp
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "Transport.h"
+
+// Public:
+// ============================================================================
+bool Transport::send(OSCMessage &msg) {
+	uint8_t data[TRANSPORT_MAX_PACKET];
+	size_t len = msg.bytes();
+	if (len > sizeof(data))
+		return count_send(len, false);
+	BufferPrint buffer(data, sizeof(data));
+	msg.send(buffer);
+	return send(data, buffer.len);
+}
+
+// Protected:
+// ============================================================================
+bool Transport::count_send(size_t len, bool sent) {
+	if (sent) {
+		stats.packets_sent++;
+		stats.bytes_sent += len;
+	}
+	else
+		stats.send_failures++;
+	return sent;
+}
+
+void Transport::deliver(uint8_t *data, size_t len) {
+	stats.packets_received++;
+	stats.bytes_received += len;
+	if (data_handler)
+		data_handler(data, len, data_userdata);
+}
@@ -0,0 +1,115 @@
+/* Transport.h
+
+ 	Copyright (c) 2019 Jeff Gregorio. All rights reserved.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <OSCMessage.h>
+#include "Print.h"
+#include "Arduino.h"
+
+// Largest message Transport::send(OSCMessage &) serializes (on the stack)
+#ifndef TRANSPORT_MAX_PACKET
+#define TRANSPORT_MAX_PACKET 512
+#endif
+
+struct TransportStats {
+	uint32_t packets_sent;		// Sent or queued
+	uint32_t bytes_sent;
+	uint32_t send_failures;		// Neither sent nor queued
+	uint32_t packets_received;
+	uint32_t bytes_received;
+	uint32_t errors;			// Malformed or oversized incoming packets
+};
+
+/* A link that carries serialized OSC packets: send() takes one packet, and 
+   the data handler gets each packet received (UDP datagrams, TCP segments, 
+   SLIP frames). Transports that need polling do it in loop(); event-driven 
+   ones receive from their own callbacks. */
+class Transport {
+
+public:
+
+	Transport() : data_handler(NULL), data_userdata(NULL) {
+		memset(&stats, 0, sizeof(stats));
+	}
+	virtual ~Transport() {}
+
+	// Send a packet to the transport's peer; return false if it was neither 
+	// sent nor queued
+	virtual bool send(const uint8_t *data, size_t len) = 0;
+	bool send(OSCMessage &msg);
+
+	// Whether the peer can be reached now
+	virtual bool connected() = 0;
+
+	// Poll for incoming packets; return true if one was handled
+	virtual bool loop() { return false; }
+
+	virtual const char *name() = 0;
+
+	void set_data_handler(void (*handler)(uint8_t *, size_t, void *), void *userdata) {
+		data_handler = handler;
+		data_userdata = userdata;
+	}
+
+	const TransportStats &get_stats() 	{ return stats; }
+
+protected:
+
+	// Count a send; return sent
+	bool count_send(size_t len, bool sent);
+
+	// Count a packet and pass it to the data handler
+	void deliver(uint8_t *data, size_t len);
+
+	void (*data_handler)(uint8_t *, size_t, void *);
+	void *data_userdata;
+	TransportStats stats;
+};
+
+// Print adapter that serializes a message into a fixed buffer
+class BufferPrint : public Print {
+
+public:
+
+	BufferPrint(uint8_t *buffer, size_t size) : buffer(buffer), size(size), len(0) {}
+
+	virtual size_t write(uint8_t b) {
+		if (len >= size)
+			return 0;
+		buffer[len++] = b;
+		return 1;
+	}
+
+	virtual size_t write(const uint8_t *data, size_t n) {
+		if (n > size - len)
+			n = size - len;
+		memcpy(buffer + len, data, n);
+		len += n;
+		return n;
+	}
+
+	uint8_t *buffer;
+	size_t size;
+	size_t len;
+};
+
+#endif
@@ -22,13 +22,12 @@
 
 // Public:
 // ============================================================================
-UDPClient::UDPClient() {
-	UDPClient(NULL);
+UDPClient::UDPClient() : UDPClient(NULL) {
+
 }
 
 UDPClient::UDPClient(Stream *debug_serial) : 
-local_port(0), remote_port(0), data_handler(NULL), user_data(NULL), 
-debug_serial(debug_serial) {
+local_port(0), remote_port(0), debug_serial(debug_serial), pool(NULL) {
 	remote_addr = IPAddress();
 }
 
@@ -53,35 +52,39 @@ void UDPClient::connect(const char *addr, uint16_t port) {
 	remote_port = port;
 }
 
-void UDPClient::send(OSCMessage &msg) {
-	send(msg, remote_addr, remote_port);
+bool UDPClient::send(OSCMessage &msg) {
+	return send(msg, remote_addr, remote_port);
 }
 
-void UDPClient::send(OSCMessage &msg, IPAddress dest) {
-	send(msg, dest, remote_port);
+bool UDPClient::send(OSCMessage &msg, IPAddress dest) {
+	return send(msg, dest, remote_port);
 }
 
-void UDPClient::send(OSCMessage &msg, IPAddress dest, uint16_t port) {
-	print_udp("OSC to UDP Client", dest.toString().c_str(), port);
+bool UDPClient::send(OSCMessage &msg, IPAddress dest, uint16_t port) {
+	print_udp("OSC to UDP Client", dest, port);
 	udp_local.beginPacket(dest, port);
 	msg.send(udp_local);
-	udp_local.endPacket();
+	return count_send(msg.bytes(), udp_local.endPacket() == 1);
+}
+
+bool UDPClient::send(const uint8_t *data, size_t len) {
+	return send((char *)data, len, remote_addr, remote_port);
 }
 
-void UDPClient::send(char *data, size_t len) {
-	send(data, len, remote_addr);
+bool UDPClient::send(char *data, size_t len) {
+	return send(data, len, remote_addr);
 }
 
-void UDPClient::send(char *data, size_t len, IPAddress dest) {
-	send(data, len, dest, remote_port);
+bool UDPClient::send(char *data, size_t len, IPAddress dest) {
+	return send(data, len, dest, remote_port);
 }
 
-void UDPClient::send(char *data, size_t len, IPAddress dest, uint16_t port) {
-	print_udp("Data to UDP Client", dest.toString().c_str(), port);
+bool UDPClient::send(char *data, size_t len, IPAddress dest, uint16_t port) {
+	print_udp("Data to UDP Client", dest, port);
 	print_udp_data("Data", data, len);
 	udp_local.beginPacket(dest, port);
 	udp_local.write((uint8_t *)data, len);
-	udp_local.endPacket();
+	return count_send(len, udp_local.endPacket() == 1);
 }
 
 bool UDPClient::loop() {
@@ -91,26 +94,31 @@ bool UDPClient::loop() {
 
 	if (n_bytes) {
 
-		char *data = (char *)malloc(n_bytes * sizeof(char));
+		char *data = (char *)(pool ? pool->alloc(n_bytes, POOL_OWNER_UDP) : malloc(n_bytes));
+		if (!data)
+			return false;			// (Packet is discarded by the next parsePacket())
 		udp_local.read(data, n_bytes);
 
 		print_udp("Data from UDP Client", 
-			udp_local.remoteIP().toString().c_str(), 
+			udp_local.remoteIP(), 
 			udp_local.remotePort());
 		print_udp_data("Data", data, n_bytes);
 		
-		if (data_handler)
-			data_handler((uint8_t *)data, n_bytes, user_data);
-		free(data);
+		deliver((uint8_t *)data, n_bytes);
+		success = true;
+		if (pool)
+			pool->release(data);
+		else
+			free(data);
 	}
 	return success;
 }
 
 // Print utilities:
 // ============================================================================
-void UDPClient::print_udp(char *description, const char *addr, uint16_t port) {
+void UDPClient::print_udp(char *description, IPAddress addr, uint16_t port) {
 	if (debug_serial) 
-		debug_serial->printf("\n%24s: %s:%d", description, addr, port);
+		debug_serial->printf("\n%24s: %s:%d", description, addr.toString().c_str(), port);
 }
 
 void UDPClient::print_udp_data(char *description, char *data, size_t len) {
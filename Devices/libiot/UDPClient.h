@@ -22,8 +22,10 @@
 
 #include <WiFiUdp.h>
 #include <OSCMessage.h>
+#include "BlockPool.h"
+#include "Transport.h"
 
-class UDPClient {
+class UDPClient : public Transport {
 
 public:
 
@@ -31,11 +33,8 @@ public:
 	UDPClient(Stream *debug_serial);
 	~UDPClient();
 
-	// Set handler callback function for incoming data
-	void set_data_handler(void (*handler)(uint8_t *, size_t, void *), void *userdata) {
-		data_handler = handler;
-		this->user_data = userdata;
-	}
+	// Draw receive buffers from a block pool instead of the heap
+	void attach(BlockPool *pool) { this->pool = pool; }
 
 	// Start listening for incoming messages
 	bool open_port(uint16_t port);
@@ -45,27 +44,29 @@ public:
 	void connect(const char *addr, uint16_t port);
 
 	// OSC Message senders
-	void send(OSCMessage &msg);
-	void send(OSCMessage &msg, IPAddress dest);
-	void send(OSCMessage &msg, IPAddress dest, uint16_t port);
+	bool send(OSCMessage &msg);
+	bool send(OSCMessage &msg, IPAddress dest);
+	bool send(OSCMessage &msg, IPAddress dest, uint16_t port);
 
 	// Raw data senders
-	void send(char *data, size_t len);
-	void send(char *data, size_t len, IPAddress dest);
-	void send(char *data, size_t len, IPAddress dest, uint16_t port);
+	virtual bool send(const uint8_t *data, size_t len);
+	bool send(char *data, size_t len);
+	bool send(char *data, size_t len, IPAddress dest);
+	bool send(char *data, size_t len, IPAddress dest, uint16_t port);
 
 	// Loop (polls UDP port for incoming data) 
-	bool loop();
+	virtual bool loop();
 
 	// Getters
-	bool connected() 			{ return remote_addr.isSet(); 	 }
+	virtual bool connected() 	{ return remote_addr.isSet(); 	 }
+	virtual const char *name() 	{ return "udp"; 				 }
 	IPAddress get_remote_addr() { return udp_local.remoteIP();   }
 	uint16_t get_remote_port()  { return udp_local.remotePort(); }
 
 protected:
 
 	// Print utilities
-	void print_udp(char *description, const char *addr, uint16_t port);
+	void print_udp(char *description, IPAddress addr, uint16_t port);
 	void print_udp_data(char *description, char *data, size_t len);
 
 	WiFiUDP udp_local;
@@ -74,10 +75,8 @@ protected:
 	IPAddress remote_addr;
     uint16_t remote_port;
 
-	void (*data_handler)(uint8_t *, size_t, void *);
-	void *user_data;
-
 	Stream *debug_serial;
+	BlockPool *pool;
 };
 
 #endif
\ No newline at end of file
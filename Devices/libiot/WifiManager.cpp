@@ -20,21 +20,75 @@
 #include "WifiManager.h"
 #include "Arduino.h"
 
-WifiManager::WifiManager() {
-	WifiManager(NULL, NULL);
+// Status LED patterns
+static const LEDStep LED_CONNECTING[] = { {true, 500}, {false, 500} };
+static const LEDStep LED_CONNECTED[] = { {false, 200}, {true, 200} };
+
+// Copy an OSC string or int argument into buff as a string
+static bool osc_arg_string(OSCMessage &msg, int idx, char *buff, int len) {
+	if (msg.isString(idx)) {
+		if (msg.getDataLength(idx) > len)
+			return false;
+		msg.getString(idx, buff, len);
+		return true;
+	}
+	else if (msg.isInt(idx)) {
+		snprintf(buff, len, "%d", (int)msg.getInt(idx));
+		return true;
+	}
+	return false;
+}
+
+// Parse a comma-separated list of group numbers (0-30) into a group mask
+static bool parse_groups(const char *str, uint32_t *mask) {
+	uint32_t m = 0;
+	while (*str) {
+		char *end;
+		long g = strtol(str, &end, 10);
+		if (end == str || g < 0 || g > 30)
+			return false;
+		m |= (uint32_t)1 << g;
+		str = end;
+		if (*str == ',')
+			str++;
+		else if (*str)
+			return false;
+	}
+	*mask = m;
+	return true;
 }
 
-WifiManager::WifiManager(int status_led_pin) {
-	WifiManager(status_led_pin, NULL);
+// Format a group mask as a comma-separated list of group numbers
+static void format_groups(uint32_t mask, char *buff, int len) {
+	int idx = 0;
+	buff[0] = '\0';
+	for (int g = 0; g <= 30 && idx < len; g++) {
+		if (mask & ((uint32_t)1 << g))
+			idx += snprintf(buff+idx, len-idx, idx ? ",%d" : "%d", g);
+	}
+}
+
+WifiManager::WifiManager() : WifiManager(0, NULL) {
+
+}
+
+WifiManager::WifiManager(int status_led_pin) : WifiManager(status_led_pin, NULL) {
+
 }
 
 WifiManager::WifiManager(int status_led_pin, Stream *debug_serial) 
 : initialized(false),
   status_led_pin(status_led_pin), 
+  status_led(status_led_pin, STATUS_LED_BLINK_MS),
+  sched(NULL),
   debug_serial(debug_serial), 
   status(WifiStatus::Idle), 
   web_server(80), 
-  ap_address(192, 168, 4, 1) {
+  ap_address(192, 168, 4, 1),
+  connect_handler(NULL),
+  config_handler(NULL),
+  flash_handler(NULL),
+  reconnect_pending(false) {
 
 }
 
@@ -50,6 +104,7 @@ bool WifiManager::init() {
 }
 
 bool WifiManager::connect() {
+	PROFILE_SCOPE("wifi.connect");
 
 	// (Re-)Initialize
 	WiFi.disconnect();
@@ -66,18 +121,20 @@ bool WifiManager::connect() {
 
 	// Attempt to connect to the specified netowrk up to N times
 	int tries = 0;
-	bool led_on = true;
+	if (status_led_pin)
+		status_led.play(LED_CONNECTING, 2, LED_REPEAT_FOREVER, LED_PRIORITY_STATUS);
 	while (WiFi.status() != WL_CONNECTED) {
 		tries++;
 		if (tries > WIFI_CONNECT_NUM_ATTEMPTS) {
 			this->status = WifiStatus::Idle;
+			status_led.stop();
 		  	return false;
 		}
-		if (status_led_pin) {
-			digitalWrite(status_led_pin, led_on ? LOW : HIGH);
-			led_on = !led_on;
-		}
 		delay(500);
+		if (sched)
+			sched->run();
+		else
+			status_led.loop();
 	}
 
 	// Get IP address
@@ -87,11 +144,11 @@ bool WifiManager::connect() {
 		debug_serial->println(local_address.toString().c_str());
 	}
 
-  	// Victory dance
+  	// Victory dance (played from loop(), so it doesn't delay the handler)
 	this->status = WifiStatus::Connected;
   	if (status_led_pin) {
-  		blinks(status_led_pin, 8, 400);
-    	digitalWrite(status_led_pin, LOW);
+  		status_led.set(true);
+  		status_led.play(LED_CONNECTED, 2, 8, LED_PRIORITY_STATUS);
   	}
 
   	// Pass to user callback
@@ -101,7 +158,55 @@ bool WifiManager::connect() {
 	return true;
 }
 
+bool WifiManager::resume(const WifiResume &params, uint32_t timeout_ms) {
+	PROFILE_SCOPE("wifi.resume");
+
+	if (!params.valid)
+		return false;
+
+	// Same access point, channel and address as before (and nothing written
+	// to flash, as the SDK otherwise does on every begin())
+	WiFi.persistent(false);
+	WiFi.mode(WIFI_STA);
+	WiFi.config(IPAddress(params.local_ip), IPAddress(params.gateway),
+		IPAddress(params.subnet), IPAddress(params.dns));
+	WiFi.begin(config.ssid, config.pass, params.channel, params.bssid);
+
+	uint32_t start = millis();
+	while (WiFi.status() != WL_CONNECTED) {
+		if (millis() - start > timeout_ms) {
+			WiFi.config(IPAddress(), IPAddress(), IPAddress());
+			if (debug_serial)
+				debug_serial->println("Resume timed out");
+			return false;
+		}
+		delay(1);
+	}
+
+	local_address = WiFi.localIP();
+	this->status = WifiStatus::Connected;
+	if (debug_serial) {
+		debug_serial->printf("Resumed in %lu ms, Local IP: ", millis() - start);
+		debug_serial->println(local_address.toString().c_str());
+	}
+	return true;
+}
+
+void WifiManager::save_resume(WifiResume &params) {
+	memset(&params, 0, sizeof(params));
+	if (WiFi.status() != WL_CONNECTED)
+		return;
+	params.local_ip = (uint32_t)WiFi.localIP();
+	params.gateway = (uint32_t)WiFi.gatewayIP();
+	params.subnet = (uint32_t)WiFi.subnetMask();
+	params.dns = (uint32_t)WiFi.dnsIP();
+	memcpy(params.bssid, WiFi.BSSID(), sizeof(params.bssid));
+	params.channel = WiFi.channel();
+	params.valid = 1;
+}
+
 bool WifiManager::open_access_point() {
+	PROFILE_SCOPE("wifi.open_ap");
 
 	// Access point name
 	char ap_name[64];
@@ -132,8 +237,91 @@ bool WifiManager::open_access_point() {
 	web_server.begin();
 	this->status = WifiStatus::AccessPoint;
 
-  if (status_led_pin)
-    digitalWrite(status_led_pin, HIGH);
+  if (status_led_pin) {
+    status_led.stop();
+    status_led.set(false);
+  }
+}
+
+bool WifiManager::handle_config_set(OSCMessage &msg) {
+
+	if (!config_addressed(msg))
+		return false;
+
+	// Stage all changes and reject the whole message if any one is invalid
+	char name[USER_PARAM_MAX_LENGTH];
+	char value[USER_PARAM_MAX_LENGTH];
+	WifiConfig staged = config;
+	int n_args = msg.size();
+	if (n_args < 5 || (n_args - 3) % 2) 
+		return false;
+	for (int i = 3; i < n_args; i += 2) {
+		if (!osc_arg_string(msg, i, name, sizeof(name)) ||
+			!osc_arg_string(msg, i+1, value, sizeof(value)) ||
+			!set_config(staged, name, value)) {
+			if (debug_serial)
+				debug_serial->printf("Rejected /config/set (argument %d)\n", i);
+			return false;
+		}
+	}
+
+	uint8_t changed = 0;
+	if (strcmp(staged.ssid, config.ssid) || strcmp(staged.pass, config.pass))
+		changed |= CONFIG_CHANGED_WIFI;
+	if (strcmp(staged.dev_id, config.dev_id) || strcmp(staged.node_id, config.node_id))
+		changed |= CONFIG_CHANGED_ID;
+	if (strcmp(staged.iot_port, config.iot_port))
+		changed |= CONFIG_CHANGED_PORT;
+	if (strcmp(staged.config_key, config.config_key))
+		changed |= CONFIG_CHANGED_KEY;
+	if (staged.groups != config.groups)
+		changed |= CONFIG_CHANGED_GROUPS;
+	if (!changed)
+		return true;
+
+	// Commit
+	prev_config = config;
+	config = staged;
+	eeprom_save();
+	make_configuration_portal();
+	print_config();
+
+	// WiFi is restarted from loop() so the reply to this message can go out 
+	// first; everything else is up to the user callback
+	if (changed & CONFIG_CHANGED_WIFI)
+		reconnect_pending = true;
+	if (config_handler)
+		config_handler(changed, config_userdata);
+	return true;
+}
+
+bool WifiManager::handle_config_get(OSCMessage &msg, OSCMessage &reply) {
+
+	if (!config_addressed(msg))
+		return false;
+
+	reply.add(config.dev_id);
+	reply.add(config.node_id);
+
+	// Default to all parameters; never report the password or config key
+	static const char *all[] = { "SSID", "DevID", "NodeID", "IoTPort", "Groups" };
+	char name[USER_PARAM_MAX_LENGTH];
+	char value[USER_PARAM_MAX_LENGTH];
+	int n_names = msg.size() > 3 ? msg.size() - 3 : sizeof(all) / sizeof(all[0]);
+	for (int i = 0; i < n_names; i++) {
+		if (msg.size() > 3) {
+			if (!osc_arg_string(msg, i+3, name, sizeof(name)))
+				continue;
+		}
+		else 
+			strcpy(name, all[i]);
+		value[0] = '\0';
+		if (strcmp(name, "Pass"))
+			get_config(name, value);
+		reply.add(name);
+		reply.add(value);
+	}
+	return true;
 }
 
 void WifiManager::get_config(const char *param_name, char *param_value) {
@@ -147,6 +335,8 @@ void WifiManager::get_config(const char *param_name, char *param_value) {
         strcpy(param_value, config.node_id);
     else if (!strcmp(param_name, "IoTPort"))
         strcpy(param_value, config.iot_port);
+    else if (!strcmp(param_name, "Groups"))
+        format_groups(config.groups, param_value, USER_PARAM_MAX_LENGTH);
 }  
 
 void WifiManager::get_dev_id(char *buff) {
@@ -161,6 +351,86 @@ uint16_t WifiManager::get_iot_port() {
 	return atoi(config.iot_port);
 }
 
+bool WifiManager::set_config(WifiConfig &cfg, const char *param_name, const char *param_value) {
+	
+	char *field;
+	size_t field_len;
+	if (!strcmp(param_name, "SSID")) {
+		field = cfg.ssid;
+		field_len = sizeof(cfg.ssid);
+	}
+	else if (!strcmp(param_name, "Pass")) {
+		field = cfg.pass;
+		field_len = sizeof(cfg.pass);
+	}
+	else if (!strcmp(param_name, "DevID")) {
+		field = cfg.dev_id;
+		field_len = sizeof(cfg.dev_id);
+	}
+	else if (!strcmp(param_name, "NodeID")) {
+		field = cfg.node_id;
+		field_len = sizeof(cfg.node_id);
+	}
+	else if (!strcmp(param_name, "IoTPort")) {
+		long port = atol(param_value);
+		if (port <= 0 || port > 65535)
+			return false;
+		field = cfg.iot_port;
+		field_len = sizeof(cfg.iot_port);
+	}
+	else if (!strcmp(param_name, "Groups")) 
+		return parse_groups(param_value, &cfg.groups);
+	else if (!strcmp(param_name, "ConfigKey")) {
+		if (!strlen(param_value))
+			return false;
+		field = cfg.config_key;
+		field_len = sizeof(cfg.config_key);
+	}
+	else 
+		return false;
+
+	if (strlen(param_value) >= field_len)
+		return false;
+	strcpy(field, param_value);
+	return true;
+}
+
+bool WifiManager::config_addressed(OSCMessage &msg) {
+
+	char buff[CONFIG_KEY_MAX_LENGTH];
+	if (msg.size() < 3)
+		return false;
+
+	// Authenticate (never with an unset key)
+	if (!config.config_key[0] || 
+		!osc_arg_string(msg, 0, buff, sizeof(buff)) || strcmp(buff, config.config_key))
+		return false;
+
+	// Device and node ID filters
+	if (!osc_arg_string(msg, 1, buff, sizeof(buff)) || 
+		(strcmp(buff, "*") && strcmp(buff, config.dev_id)))
+		return false;
+	if (!osc_arg_string(msg, 2, buff, sizeof(buff)) || 
+		(strcmp(buff, "*") && strcmp(buff, config.node_id)))
+		return false;
+	return true;
+}
+
+void WifiManager::reconnect() {
+
+	if (connect())
+		return;
+
+	// New credentials failed; fall back on the previous configuration
+	if (debug_serial)
+		debug_serial->println("Reconnect failed; restoring previous configuration");
+	config = prev_config;
+	eeprom_save();
+	make_configuration_portal();
+	if (!connect())
+		open_access_point();
+}
+
 void WifiManager::make_configuration_portal() {
 	
 	int idx = 0;
@@ -210,6 +480,14 @@ void WifiManager::make_configuration_portal() {
 	idx += snprintf(portal_html+idx, CONFIG_PORTAL_HTML_LENGTH-idx,
 		"<div>UDP/TCP Port: <input type='text' name='IoTPort' size='%d' value='%s'><p></div>",
 		IOT_PORT_MAX_LENGTH, config.iot_port);
+	idx += snprintf(portal_html+idx, CONFIG_PORTAL_HTML_LENGTH-idx,
+		"<div>Config Key: <input type='password' name='ConfigKey' size='%d' placeholder='%s'><p></div>",
+		CONFIG_KEY_MAX_LENGTH, config.config_key[0] ? "(unchanged)" : "(not set)");
+	char groups[USER_PARAM_MAX_LENGTH];
+	format_groups(config.groups, groups, sizeof(groups));
+	idx += snprintf(portal_html+idx, CONFIG_PORTAL_HTML_LENGTH-idx,
+		"<div>Groups: <input type='text' name='Groups' size='%d' value='%s'><p></div>",
+		USER_PARAM_MAX_LENGTH, groups);
 
 	// Submit button and end tags
 	idx += snprintf(portal_html+idx, CONFIG_PORTAL_HTML_LENGTH-idx,
@@ -238,6 +516,12 @@ void WifiManager::handle_root() {
 		if (web_server.hasArg("IoTPort")) {
 		  sprintf(config.iot_port, "%s", web_server.arg("IoTPort").c_str());
 		} 
+		if (web_server.hasArg("Groups")) {
+		  parse_groups(web_server.arg("Groups").c_str(), &config.groups);
+		} 
+		if (web_server.hasArg("ConfigKey") && strlen(web_server.arg("ConfigKey").c_str())) {
+		  snprintf(config.config_key, sizeof(config.config_key), "%s", web_server.arg("ConfigKey").c_str());
+		} 
 	}
 	eeprom_save();
   	print_config();
@@ -249,10 +533,15 @@ void WifiManager::handle_root() {
 }
 
 void WifiManager::eeprom_save() {
+    PROFILE_SCOPE("wifi.eeprom_save");
     strcpy(config.valid, VALIDATION_STRING);
     // EEPROM.begin(sizeof(config));
     EEPROM.put(EEPROM_ADDRESS, config);
+    if (flash_handler)
+        flash_handler(true, flash_userdata);
     EEPROM.commit();
+    if (flash_handler)
+        flash_handler(false, flash_userdata);
     // EEPROM.end();
 }
 
@@ -274,10 +563,22 @@ bool WifiManager::eeprom_load() {
         strcpy(config.dev_id, DEFAULT_DEVICE_ID);
         strcpy(config.node_id, DEFAULT_NODE_ID);
         strcpy(config.iot_port, DEFAULT_IOT_PORT);
+        strcpy(config.config_key, DEFAULT_CONFIG_KEY);
+        config.groups = 0;
         success = false;
     }
     else if (debug_serial) 
         debug_serial->println("Configuration loaded:");
+
+    // Configurations saved before the config key was added have erased (or 
+    // unterminated) memory in its place; leave the key unset
+    if (!memchr(config.config_key, '\0', sizeof(config.config_key)) || 
+        (uint8_t)config.config_key[0] == 0xFF)
+        strcpy(config.config_key, DEFAULT_CONFIG_KEY);
+
+    // Likewise for groups, which only go up to 30
+    if (config.groups & 0x80000000)
+        config.groups = 0;
         
     print_config();
     // EEPROM.end();
@@ -296,15 +597,7 @@ void WifiManager::print_config() {
         debug_serial->println(config.node_id);
         debug_serial->print("IoTPort: ");
         debug_serial->println(config.iot_port);
+        debug_serial->print("Groups: ");
+        debug_serial->println((int)config.groups);
     }
 }
-  
-void WifiManager::blinks(int status_led_pin, int n, int dt_ms) {
-	digitalWrite(status_led_pin, HIGH);
-	for (int i = 0; i < n; i++) {
-		digitalWrite(status_led_pin, LOW);
-		delay(dt_ms/2);
-		digitalWrite(status_led_pin, HIGH);
-		delay(dt_ms/2);
-	}
-}
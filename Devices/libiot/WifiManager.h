@@ -24,6 +24,10 @@
 #include <ESP8266WebServer.h>
 #include <DNSServer.h>
 #include <EEPROM.h>
+#include <OSCMessage.h>
+#include "LEDPin.h"
+#include "Scheduler.h"
+#include "LoopProfiler.h"
 
 #define DEFAULT_SSID ""
 #define DEFAULT_PASS ""
@@ -31,6 +35,7 @@
 #define DEFAULT_NODE_ID "1"
 #define DEFAULT_IOT_PORT "8000"
 #define CONFIG_PORTAL_PASS "iotconfig"
+#define DEFAULT_CONFIG_KEY ""       // /config/set is refused until one is set
 
 const int WIFI_CONNECT_NUM_ATTEMPTS = 50;
 const int SSID_MAX_LENGTH = 32;
@@ -38,9 +43,11 @@ const int PASS_MAX_LENGTH = 32;
 const int DEV_ID_MAX_LENGTH = 32;
 const int NODE_ID_MAX_LENGTH = 32;
 const int IOT_PORT_MAX_LENGTH = 8;
+const int CONFIG_KEY_MAX_LENGTH = 32;
 const int USER_PARAMS_MAX_NUM = 8;
 const int USER_PARAM_MAX_LENGTH = 32;
 const int CONFIG_PORTAL_HTML_LENGTH = 4096;
+const int STATUS_LED_BLINK_MS = 20;
 const byte DNS_PORT = 53;
 const unsigned int EEPROM_ADDRESS = 0;
 const char VALIDATION_STRING[8] = "xyz123";
@@ -52,6 +59,27 @@ struct WifiConfig {
     char dev_id[DEV_ID_MAX_LENGTH];   
     char node_id[NODE_ID_MAX_LENGTH]; 
     char iot_port[8];
+    char config_key[CONFIG_KEY_MAX_LENGTH];
+    uint32_t groups;
+};
+
+// Subsystems affected by a configuration change (passed to config handler)
+const uint8_t CONFIG_CHANGED_WIFI = 0x01;   // SSID, Pass
+const uint8_t CONFIG_CHANGED_ID = 0x02;     // DevID, NodeID
+const uint8_t CONFIG_CHANGED_PORT = 0x04;   // IoTPort
+const uint8_t CONFIG_CHANGED_KEY = 0x08;    // ConfigKey
+const uint8_t CONFIG_CHANGED_GROUPS = 0x10; // Groups
+
+// Parameters of a connection, kept (e.g. in RTC memory across deep sleep) 
+// to rejoin the same access point without a scan or DHCP
+struct WifiResume {
+    uint32_t local_ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t valid;
 };
 
 enum class WifiStatus {
@@ -75,50 +103,105 @@ public:
     // Connect to network with credentials specified in configuration
     bool connect();
 
+    // Rejoin with the parameters of an earlier connection: the saved access 
+    // point and channel, and its address as a static IP. Doesn't play status 
+    // patterns or call the connect handler. Return false (with DHCP 
+    // restored for connect()) if not connected within timeout_ms
+    bool resume(const WifiResume &params, uint32_t timeout_ms);
+
+    // Save the current connection's parameters for resume()
+    void save_resume(WifiResume &params);
+
     // Set callback function for successful connect
     void set_connect_handler(void (*handler)(void *), void *userdata) {
         connect_handler = handler;
         connect_userdata = userdata;
     }
 
+    // Set callback function for configuration changes made over OSC. The 
+    // handler receives a mask of CONFIG_CHANGED_* flags and should restart 
+    // only the affected subsystems (WiFi is reconnected by the manager)
+    void set_config_handler(void (*handler)(uint8_t, void *), void *userdata) {
+        config_handler = handler;
+        config_userdata = userdata;
+    }
+
+    // Set callback function around flash writes (called with true before 
+    // and false after), e.g. to pause interrupts that read the ADC
+    void set_flash_handler(void (*handler)(bool, void *), void *userdata) {
+        flash_handler = handler;
+        flash_userdata = userdata;
+    }
+
     // Open access point for configuration
     bool open_access_point();
 
+    // In-band configuration over OSC; both messages begin with the config 
+    // key and device/node ID filters ("*" matches any):
+    //   /config/set <key> <DevID> <NodeID> <name> <value> [<name> <value> ...]
+    //   /config/get <key> <DevID> <NodeID> [<name> ...]
+    // Changes are validated as a whole and applied atomically. Return false 
+    // if the message is not addressed to this device or is rejected.
+    bool handle_config_set(OSCMessage &msg);
+    bool handle_config_get(OSCMessage &msg, OSCMessage &reply);
+
     // Main loop; return false if disconnected
     bool loop() {
+        status_led.loop();
+        if (reconnect_pending) {
+            reconnect_pending = false;
+            reconnect();
+        }
         if (this->status == WifiStatus::Connected)
             return true;
         else if (this->status == WifiStatus::AccessPoint) {
+            PROFILE_SCOPE("wifi.portal");
             dns_server.processNextRequest();
             web_server.handleClient();
             return true;
         }
-        digitalWrite(status_led_pin, HIGH);
+        if (status_led_pin)
+            status_led.set(false);
         return false;
     }
     
+    // Status LED, driven from loop(); may also be used for activity blinks
+    LEDPin &get_status_led()      { return status_led; }
+
+    // Drive the status LED from a scheduler, and keep the scheduler running 
+    // while connect() blocks
+    void attach(Scheduler *scheduler) {
+        sched = scheduler;
+        status_led.attach(scheduler);
+    }
+
     WifiStatus get_status()       { return this->status; }
     IPAddress get_local_address() { return this->local_address; }
 
     // Retrieve configuration parameter by name, includes:
-    // - Defaults: "SSID", "Pass", "DevID", "NodeID"
+    // - Defaults: "SSID", "Pass", "DevID", "NodeID", "IoTPort", "Groups"
     void get_config(const char *p_name, char *p_value);
     void get_dev_id(char *buff);
     void get_node_id(char *buff);
     uint16_t get_iot_port();
+    uint32_t get_groups() { return config.groups; }
 
 protected:
 
+    bool set_config(WifiConfig &cfg, const char *p_name, const char *p_value);
+    bool config_addressed(OSCMessage &msg);
+    void reconnect();
     void make_configuration_portal();
     void serve_configuration_portal();
     void handle_root();
     void eeprom_save();
     bool eeprom_load();
     void print_config();
-    void blinks(int status_led_pin, int n, int dt_ms);
 
     bool initialized;
     int status_led_pin;
+    LEDPin status_led;
+    Scheduler *sched;
     Stream *debug_serial;
 
     WifiConfig config;
@@ -135,5 +218,17 @@ protected:
     // Callback for successful connect
     void (*connect_handler)(void *);
     void *connect_userdata;
+
+    // Callback for configuration changes over OSC
+    void (*config_handler)(uint8_t, void *);
+    void *config_userdata;
+
+    // Callback around flash writes
+    void (*flash_handler)(bool, void *);
+    void *flash_userdata;
+
+    // WiFi credentials changed over OSC; reconnect from loop()
+    bool reconnect_pending;
+    WifiConfig prev_config;
 };
 #endif
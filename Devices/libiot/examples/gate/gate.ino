@@ -22,6 +22,18 @@
 #include <TCPClient.h>
 #include <OSCManager.h>
 #include <LEDPin.h>
+#include <Scheduler.h>
+#include <BlockPool.h>
+#include <SubscriberTable.h>
+#include <FlowControl.h>
+#include <EventJournal.h>
+#include <LoopProfiler.h>
+#include <SyncClock.h>
+#include <Actuators.h>
+#include <SLIPTransport.h>
+#include <LinkMonitor.h>
+#include <SleepManager.h>
+#include <AnalogStream.h>
 
 Stream *debug = NULL;       // Uncomment for deployment
 //Stream *debug = &Serial;    // Uncomment for testing/debugging
@@ -29,18 +41,104 @@ Stream *debug = NULL;       // Uncomment for deployment
 // Sensor pin
 const int PIN_SENSOR = D1;
 
+// Sensor edges queued by the pin interrupt and sent from loop()
+const uint8_t EDGE_QUEUE_LEN = 16;
+volatile uint8_t edge_states[EDGE_QUEUE_LEN];
+volatile uint8_t edge_head = 0;
+volatile uint8_t edge_tail = 0;
+bool edge_held = false;                 // Oldest edge held back by flow control
+
+// Actuator pins (e.g. a lock relay, a dimmable light and a solenoid)
+const int PIN_LOCK = D2;
+const int PIN_LIGHT = D5;
+const int PIN_SOLENOID = D6;
+
+// Analog stream (off until /stream/start)
+AnalogStream stream(A0, debug);
+
+// Scheduler
+// =========
+Scheduler scheduler;                    // Timers for deferred work (LED steps)
+const uint32_t MAX_SLEEP_MS = 1;        // Longest idle sleep between UDP polls
+
+// Loop profiler (off until /profile start); reports up to 4 sites per query
+LoopProfiler profiler(debug);
+const int PROFILE_REPORT_SITES = 4;
+
+// Receive buffers come from fixed-block pools rather than the heap
+BlockPool pool;
+
+// TCP reconnect backoff and keepalive (bounds dead-link detection to ~3 s)
+const uint32_t TCP_BACKOFF_MIN_MS = 250;
+const uint32_t TCP_BACKOFF_MAX_MS = 8000;
+const uint32_t TCP_KEEPALIVE_MS = 1000;
+const uint32_t TCP_KEEPALIVE_TIMEOUT_MS = 3000;
+
 // WiFi, UDP, and TCP
 // ==================
-LEDPin wifi_led(LED_BUILTIN, 20);       // WiFi Status and UDP/TCP I/O Indicator LED
 WifiManager wifi(LED_BUILTIN, debug);   // WiFi Manager
+LEDPin &wifi_led = wifi.get_status_led(); // WiFi Status and UDP/TCP I/O Indicator LED
 UDPClient udp_client(debug);            // UDP Client
 TCPClient tcp_client(debug);            // TCP Client
 
+// Wired link: SLIP-framed OSC over the USB serial port, for props that need 
+// low, steady latency. Set WIRED to true (debug output shares the port, so 
+// it must be off) and run the bridge with --serial. The wired host gets 
+// every message, alongside any network subscribers
+const bool WIRED = false;
+const uint32_t WIRED_BAUD = 921600;
+SLIPTransport wired;
+Transport *rx_transport = NULL;         // Transport of the packet being handled
+
 // OSC
 // ===
 OSCManager osc(debug);                // Open Sound Control Manager
 OSCMessage outgoing_msg("/gate");     // OSC Message
 
+// Subscribers: the /ping sender (TCP, falling back on UDP) and any others 
+// that sent /subscribe (UDP, leased)
+SubscriberTable subscribers(debug);
+const uint32_t SUB_DEFAULT_LEASE_S = 300;
+
+// Flow control: credits or rate caps granted by the host with /flow. While
+// throttled, sensor edges coalesce to the latest state and stream blocks are 
+// dropped
+FlowControl flow(debug);
+
+// /gate events sent over TCP are journaled until the bridge acknowledges 
+// them, and resent after a reconnect (up to a minute old), 20 ms apart in 
+// bundles of up to 8
+EventJournal journal(debug);
+const uint32_t JOURNAL_PACE_MS = 20;
+const uint8_t JOURNAL_EVENTS_PER_BUNDLE = 8;
+const uint32_t JOURNAL_MAX_AGE_MS = 60000;
+
+// Clock synchronized to the bridge's over TCP; timetagged bundles run at 
+// their time on it, and each run reports its error with /clock/error
+SyncClock sync_clock(debug);
+
+// Round trip, loss and queueing of TCP and UDP, probed while connected; 
+// sensor edges go over whichever has the lower tail latency, everything 
+// else over TCP
+LinkMonitor link_monitor(debug);
+
+// Actuator channels, set with /act <channel> <value> [<ramp_ms>]: 0 lock 
+// (digital), 1 light (PWM), 2 solenoid (pulse) and 3 the status LED (pulse, 
+// to identify the node). Only the latest command per channel is applied, 
+// once per loop()
+Actuators actuators(debug);
+
+// Battery operation: set SLEEP to true to deep-sleep between sensor edges. 
+// The sensor must pulse RST on each edge (e.g. through an RC edge detector; 
+// D0/GPIO16 to RST as well for timer wakes) and still drive PIN_SENSOR. A 
+// wake rejoins WiFi from the RTC snapshot and sends its edge over UDP, then 
+// sleeps once TCP has delivered it (journaled), or after SLEEP_AWAKE_MAX_MS
+const bool SLEEP = false;
+const uint32_t SLEEP_RESUME_TIMEOUT_MS = 500;   // Then a full connect
+const uint32_t SLEEP_AWAKE_MAX_MS = 1000;       // Resumed wakes only
+const uint32_t SLEEP_TIMER_MS = 0;              // 0: sensor wakes only
+SleepManager sleeper(debug);
+
 // EEPROM-Stored Destination IP
 // ============================
 const int EEPROM_DEST_IP_ADDR = 768;
@@ -61,42 +159,262 @@ void setup() {
   pinMode(PIN_SENSOR, INPUT);
   attachInterrupt(digitalPinToInterrupt(PIN_SENSOR), sensor_change, CHANGE); 
 
+  // Battery operation: resume from the RTC snapshot unless powered up, and 
+  // send the sensor state that woke the node like any other edge
+  bool woke = SLEEP && sleeper.resume();
+  if (SLEEP)
+    queue_edge(digitalRead(PIN_SENSOR));
+
   // Initialize EEPROM (used by WifiManager)
   EEPROM.begin(1024);
   
-  // Set callback function for successful wifi connection
+  // Set callback functions for successful wifi connection and in-band 
+  // configuration changes
+  wifi.attach(&scheduler);
   wifi.set_connect_handler(wifi_connected, NULL);
+  wifi.set_config_handler(wifi_config_changed, NULL);
+  wifi.set_flash_handler(flash_writing, NULL);
   
-  // Initilize and connect Wifi or open access point
-  if (!wifi.init() || !wifi.connect()) 
+  // Initilize and connect Wifi or open access point (woken from sleep, the 
+  // node rejoins at the end of setup() instead)
+  bool configured = wifi.init();
+  if (!configured || (!woke && !wifi.connect())) 
       wifi.open_access_point(); 
 
-  // Set OSC handlers
+  // Set OSC handlers and group membership for group-addressed packets
+  osc.set_groups(wifi.get_groups());
   osc.dispatch("/ping", osc_handle_ping);
+  osc.dispatch(OSC_INTERN_PATH, osc_handle_intern);
+  osc.dispatch("/sched/stats", osc_handle_sched_stats);
+  osc.dispatch("/transport/stats", osc_handle_transport_stats);
+  osc.dispatch("/profile", osc_handle_profile);
+  osc.dispatch("/profile/stats", osc_handle_profile_stats);
+  osc.dispatch("/heap/stats", osc_handle_heap_stats);
+  osc.dispatch("/subscribe", osc_handle_subscribe);
+  osc.dispatch("/unsubscribe", osc_handle_unsubscribe);
+  osc.dispatch("/subscribers", osc_handle_subscribers);
+  osc.dispatch("/flow", osc_handle_flow);
+  osc.dispatch("/flow/status", osc_handle_flow_status);
+  osc.dispatch(JOURNAL_ACK_PATH, osc_handle_journal_ack);
+  osc.dispatch("/journal/stats", osc_handle_journal_stats);
+  osc.dispatch("/stream/start", osc_handle_stream_start);
+  osc.dispatch("/stream/stop", osc_handle_stream_stop);
+  osc.dispatch("/config/set", osc_handle_config_set);
+  osc.dispatch("/config/get", osc_handle_config_get);
   osc.dispatch("/config", osc_handle_config);
+  osc.dispatch("/act", osc_handle_act);
+  osc.dispatch("/act/stats", osc_handle_act_stats);
+  osc.dispatch(CLOCK_RESPONSE_PATH, osc_handle_clock_response);
+  osc.dispatch("/clock/stats", osc_handle_clock_stats);
+  osc.dispatch(LINK_PROBE_PATH, osc_handle_link_probe);
+  osc.dispatch(LINK_PORT_PATH, osc_handle_link_port);
+  osc.dispatch("/link/stats", osc_handle_link_stats);
+  osc.dispatch("/sleep/stats", osc_handle_sleep_stats);
+
+  // Ship analog stream blocks like any other outgoing message
+  stream.set_block_handler(stream_handle_block, NULL);
+
+  // Every transport hands its packets to the OSC manager
+  udp_client.attach(&pool);
+  osc.attach(&pool);
+  udp_client.set_data_handler(transport_handle_data, &udp_client);
+
+  // Publish outgoing messages over both clients
+  subscribers.attach(&udp_client, &tcp_client);
+  subscribers.attach(&pool);
+  flow.set_throttle_handler(flow_throttled, NULL);
+  profiler.set_stall_handler(profile_stalled, NULL);
+
+  // Actuators (ramps and pulses run from timers)
+  actuators.attach(&scheduler);
+  actuators.add_digital(PIN_LOCK);
+  actuators.add_pwm(PIN_LIGHT);
+  actuators.add_pulse(PIN_SOLENOID);
+  actuators.add_led(&wifi_led, ActuatorMode::Pulse);
+
+  // Execute timetagged bundles on the synchronized clock
+  sync_clock.attach(&tcp_client);
+  sync_clock.attach(&scheduler);
+  osc.attach(&sync_clock);
+  osc.set_schedule_handler(bundle_executed, NULL);
+
+  // Pick the link for each sensor edge
+  link_monitor.attach(&udp_client, &tcp_client);
+  link_monitor.attach(&scheduler);
+  subscribers.attach(&link_monitor);
+
+  // Journal /gate events for the TCP subscriber
+#if JOURNAL_FLASH_SPILL
+  LittleFS.begin();
+#endif
+  journal.attach(&tcp_client);
+  journal.attach(&scheduler);
+  journal.set_filter("/gate");
+  journal.set_pacing(JOURNAL_PACE_MS, JOURNAL_EVENTS_PER_BUNDLE);
+  journal.set_max_age(JOURNAL_MAX_AGE_MS);
+  subscribers.attach(&journal);
+  if (woke)
+    journal.restore(sleeper.get_snapshot().journal_epoch, sleeper.get_snapshot().journal_seq);
 
-  // Set UDP client data handler
-  udp_client.set_data_handler(udp_handle_data, NULL);
+  // Wired host (announced with /pong, since it never sends a UDP /ping)
+  if (WIRED && !debug) {
+    Serial.begin(WIRED_BAUD);
+    wired.begin(&Serial);
+    wired.set_data_handler(transport_handle_data, &wired);
+    subscribers.attach(&wired);
+    subscribers.subscribe(IPAddress(), 0, "/", SubTransport::Wired, 0);
+    OSCMessage response = make_pong();
+    wired.send(response);
+  }
   
   // Set TCP client data and connection handlers
-  tcp_client.set_data_handler(tcp_handle_data, NULL);
+  tcp_client.set_data_handler(transport_handle_data, &tcp_client);
   tcp_client.set_connect_handler(tcp_handle_connect, NULL);
+
+  // Reconnect automatically and detect dead connections. While TCP is down,
+  // messages fall back on UDP (see osc_send())
+  tcp_client.attach(&scheduler);
+  tcp_client.set_reconnect(TCP_BACKOFF_MIN_MS, TCP_BACKOFF_MAX_MS);
+  tcp_client.set_keepalive(TCP_KEEPALIVE_MS, TCP_KEEPALIVE_TIMEOUT_MS);
+  tcp_client.set_offline_policy(TCPOfflinePolicy::Drop);
   // (TCP client connects when we receive /ping via UDP (broadcast)))
+
+  // Woken from sleep: rejoin and send the wake edge before anything else
+  if (configured && woke && !wake_resume()) {
+    sleeper.mark_fallback();
+    if (!wifi.connect())
+      wifi.open_access_point();
+  }
 }
 
 // Main Loop
 // =========
 void loop() {
+  profiler.loop();
   wifi.loop();
   udp_client.loop();
-  wifi_led.loop();
+  wired.loop();
+  flow.loop();
+  osc.run_scheduled();            // Bundles due within the spin window
+  actuators.loop();               // Latest command per channel
+  send_edges();
+  stream.loop();
+  pool.sample();                  // Track the free heap low-water mark
+  scheduler.loop(MAX_SLEEP_MS);   // Fire due timers; sleep briefly when idle
+  if (SLEEP && ready_to_sleep())
+    go_to_sleep();
 }
 
 // Sensor pin interrupt
 // ====================
+/* Queue the new state; sending (and allocating) is left to loop() */
 ICACHE_RAM_ATTR void sensor_change() {
-  outgoing_msg.set(1, digitalRead(PIN_SENSOR));
-  osc_send(outgoing_msg);
+  queue_edge(digitalRead(PIN_SENSOR));
+}
+
+ICACHE_RAM_ATTR void queue_edge(uint8_t state) {
+  uint8_t next = (edge_head + 1) % EDGE_QUEUE_LEN;
+  if (next != edge_tail) {
+    edge_states[edge_head] = state;
+    edge_head = next;
+  }
+}
+
+/* Send queued sensor edges in order. When flow control holds them back, 
+   only the latest state is kept for later */
+void send_edges() {
+  while (edge_tail != edge_head) {
+    if ((edge_held && !flow.ready(FlowPriority::Normal)) || !flow.admit(FlowPriority::Normal)) {
+      uint8_t head = edge_head;
+      uint8_t last = (head + EDGE_QUEUE_LEN - 1) % EDGE_QUEUE_LEN;
+      flow.coalesced((last + EDGE_QUEUE_LEN - edge_tail) % EDGE_QUEUE_LEN);
+      edge_tail = last;
+      edge_held = true;
+      return;
+    }
+    edge_held = false;
+    outgoing_msg.set(1, (int)edge_states[edge_tail]);
+    edge_tail = (edge_tail + 1) % EDGE_QUEUE_LEN;
+    osc_send_event(outgoing_msg);
+    if (SLEEP) {
+      sleeper.mark_sent();
+      save_snapshot();
+    }
+  }
+}
+
+// Sleep Mode:
+// ===========
+/* Rejoin with the snapshot's network parameters (no scan, DHCP or status 
+   patterns), send the wake edge (to the journal, and a copy over UDP to 
+   the bridge, as TCP isn't up yet), then connect TCP to deliver it. False 
+   to fall back on a full connect */
+bool wake_resume() {
+  SleepSnapshot &snap = sleeper.get_snapshot();
+  if (!snap.dest_addr || !wifi.resume(snap.net, SLEEP_RESUME_TIMEOUT_MS))
+    return false;
+  update_node_id();
+  IPAddress dest_addr(snap.dest_addr);
+  subscribers.subscribe(dest_addr, snap.dest_port, "/", SubTransport::Tcp, 0);
+  udp_client.connect(dest_addr, snap.dest_port);
+  link_monitor.set_probe_port(dest_addr, snap.probe_port);
+  send_edges();
+  udp_client.open_port(wifi.get_iot_port());
+  tcp_client.connect(dest_addr.toString().c_str(), snap.dest_port);
+  return true;
+}
+
+/* Sleep once every edge has been sent and TCP has delivered it (the bridge 
+   acknowledged the journal and all data), or when a resumed wake runs out 
+   of time (its edges went over UDP regardless). A cold boot stays up until 
+   it has delivered once, so the snapshot has a network and destination */
+bool ready_to_sleep() {
+  if (wifi.get_status() == WifiStatus::AccessPoint || edge_tail != edge_head || edge_held)
+    return false;
+  bool delivered = tcp_client.connected() && !journal.get_num_pending() && 
+    !tcp_client.get_unacked_bytes();
+  return delivered || (sleeper.is_resumed() && millis() > SLEEP_AWAKE_MAX_MS);
+}
+
+/* Keep what the next wake needs in RTC memory: the network, destination 
+   (and the bridge's UDP port) and journal sequence */
+void save_snapshot() {
+  SleepSnapshot &snap = sleeper.get_snapshot();
+  wifi.save_resume(snap.net);
+  if (tcp_client.connected()) {
+    snap.dest_addr = (uint32_t)tcp_client.remote_addr();
+    snap.dest_port = tcp_client.remote_port();
+    snap.probe_port = link_monitor.get_probe_port();
+  }
+  snap.journal_epoch = journal.get_epoch();
+  snap.journal_seq = journal.get_next_seq();
+  sleeper.save();
+}
+
+void go_to_sleep() {
+  save_snapshot();
+  sleeper.sleep(SLEEP_TIMER_MS);
+}
+
+/* /sleep/stats <node_id> <reason> <wakes> <cold> <fallbacks> <over_budget> 
+   <send_us> <max_send_us> <awake_ms> <total_awake_ms>: send_us is this 
+   boot's (0 if nothing sent yet), awake_ms the previous boot's */
+void send_sleep_stats() {
+  char node_id[32];
+  wifi.get_node_id(node_id);
+  const SleepStats &stats = sleeper.get_stats();
+  OSCMessage msg("/sleep/stats");
+  msg.add(atoi(node_id));
+  msg.add(SleepManager::reason_name(sleeper.get_wake_reason()));
+  msg.add((int)stats.num_wakes);
+  msg.add((int)stats.num_cold);
+  msg.add((int)stats.num_fallbacks);
+  msg.add((int)stats.num_over_budget);
+  msg.add((int)stats.send_us);
+  msg.add((int)stats.max_send_us);
+  msg.add((int)stats.awake_ms);
+  msg.add((int)stats.total_awake_ms);
+  osc_send(msg);
 }
 
 // WiFi Connect Handler
@@ -104,23 +422,114 @@ ICACHE_RAM_ATTR void sensor_change() {
 /* Connection handler; set outgoing node ID and open UDP port after connection.
    also attempt to connect via TCP to a previous destination address */
 void wifi_connected(void *userdata) { 
-  char node_id[32];
-  wifi.get_node_id(node_id);
-  outgoing_msg.set(0, atoi(node_id));
+  update_node_id();
   udp_client.open_port(wifi.get_iot_port());
   if (load_dest()) {
     connect_dest(dest.addr, wifi.get_iot_port());
   }
 }
 
+/* In-band configuration handler; restart only what the change affects. WiFi 
+   changes are handled by the WifiManager, which calls wifi_connected() */
+void wifi_config_changed(uint8_t changed, void *userdata) {
+  if (changed & CONFIG_CHANGED_ID)
+    update_node_id();
+  if (changed & CONFIG_CHANGED_GROUPS)
+    osc.set_groups(wifi.get_groups());
+  if (changed & CONFIG_CHANGED_WIFI)
+    return;
+  if (changed & CONFIG_CHANGED_PORT) {
+    udp_client.open_port(wifi.get_iot_port());
+    if (load_dest())
+      connect_dest(dest.addr, wifi.get_iot_port());
+  }
+}
+
+/* Set the node ID in outgoing messages */
+void update_node_id() {
+  char node_id[32];
+  wifi.get_node_id(node_id);
+  outgoing_msg.set(0, atoi(node_id));
+  stream.set_node_id(atoi(node_id));
+  osc.set_node_id(atoi(node_id));
+}
+
+/* Hold the stream's ISR (it reads the ADC) while flash is written */
+void flash_writing(bool writing, void *userdata) {
+  if (writing)
+    stream.pause();
+  else
+    stream.resume();
+}
+
+// Analog Stream Block Handler
+// ===========================
+void stream_handle_block(OSCMessage &msg, void *userdata) {
+  if (flow.admit(FlowPriority::Low))
+    osc_send(msg);
+}
+
+// Flow Control Throttle Handler
+// =============================
+/* Tell the host when messages start and stop being held back:
+   /flow/throttle <node_id> <1|0> <denied> <coalesced> */
+void flow_throttled(bool throttled, void *userdata) {
+  char node_id[32];
+  wifi.get_node_id(node_id);
+  OSCMessage msg("/flow/throttle");
+  msg.add(atoi(node_id));
+  msg.add((int)throttled);
+  msg.add((int)(flow.get_num_denied(FlowPriority::Normal) + flow.get_num_denied(FlowPriority::Low)));
+  msg.add((int)flow.get_num_coalesced());
+  osc_send(msg);
+}
+
+// Loop Profiler Stall Handler
+// ===========================
+/* Report the longest stall yet for a call site:
+   /profile/stall <node_id> <site> <us> <stalls> */
+void profile_stalled(const ProfileSite &site, uint32_t us, void *userdata) {
+  char node_id[32];
+  wifi.get_node_id(node_id);
+  OSCMessage msg("/profile/stall");
+  msg.add(atoi(node_id));
+  msg.add(site.name);
+  msg.add((int)us);
+  msg.add((int)site.stalls);
+  osc_send(msg);
+}
+
+// Scheduled Bundle Handler
+// ========================
+/* Report how far from its timetag a bundle ran:
+   /clock/error <node_id> <timetag_sec> <timetag_frac> <error_us> */
+void bundle_executed(uint64_t timetag, int32_t error_us, void *userdata) {
+  actuators.loop();               // (Act now rather than next iteration)
+  char node_id[32];
+  wifi.get_node_id(node_id);
+  OSCMessage msg("/clock/error");
+  msg.add(atoi(node_id));
+  msg.add((int)(timetag >> 32));
+  msg.add((int)(timetag & 0xFFFFFFFF));
+  msg.add((int)error_us);
+  osc_send(msg);
+}
+
 // Destination IP save/load/connect:
 // =================================
-/* Save the destination upon successful TCP connection */
+/* Save the destination upon successful TCP connection (unless it's the 
+   one already saved, as every discovery /ping brings it again) */
 void save_dest(const char *addr, uint16_t port) {
+  PROFILE_SCOPE("save_dest");
+  if (load_dest() && strcmp(dest.addr, addr) == 0)
+    return;
   strcpy(dest.valid, "xyz123");
-  strcpy(dest.addr, addr);
+  strncpy(dest.addr, addr, sizeof(dest.addr) - 1);
+  dest.addr[sizeof(dest.addr) - 1] = '\0';
   EEPROM.put(EEPROM_DEST_IP_ADDR, dest);
+  flash_writing(true, NULL);
   EEPROM.commit();
+  flash_writing(false, NULL);
 }
 
 /* Attempt to load a previous destination IP from EEPROM */
@@ -131,49 +540,76 @@ bool load_dest() {
   return success;
 }
 
-/* Connect UDP/TCP clients to destination address and port */
+/* Connect UDP/TCP clients to destination address and port, which becomes 
+   the TCP subscriber for all messages */
 void connect_dest(const char *addr, uint16_t port) {
+  IPAddress dest_addr;
+  dest_addr.fromString(addr);
+  subscribers.subscribe(dest_addr, port, "/", SubTransport::Tcp, 0);
   udp_client.connect(addr, port); 
   OSCMessage response = make_pong();
   udp_client.send(response);
   tcp_client.connect(addr, port);
 }
 
-// UDP Data Handler
-// ================
-/* Pass raw data to OSC manager for decoding/dispatching */
-void udp_handle_data(uint8_t *data, size_t len, void *userdata) {
+// Transport Data Handler
+// ======================
+/* Pass raw data from any transport (the userdata) to the OSC manager for 
+   decoding/dispatching */
+void transport_handle_data(uint8_t *data, size_t len, void *userdata) {
+  rx_transport = (Transport *)userdata;
   osc.handle_buffer(data, len);
+  rx_transport = NULL;
   wifi_led.blink();
 }
 
-// TCP Handlers:
-// =============
-/* Data handler; pass raw data to OSC manager for decoding/dispatching */
-void tcp_handle_data(uint8_t *data, size_t len, void *userdata) {
-  osc.handle_buffer(data, len);
-  wifi_led.blink();
+/* Address of the host that sent the packet being handled; false for the 
+   wired link (or a scheduled bundle), which has none */
+bool get_sender_addr(IPAddress &addr) {
+  if (rx_transport == &udp_client)
+    addr = udp_client.get_remote_addr();
+  else if (rx_transport == &tcp_client)
+    addr = tcp_client.remote_addr();
+  else
+    return false;
+  return true;
 }
 
-/* Connection handler */
+// TCP Handlers:
+// =============
+/* Connection handler; identify ourselves, resend journaled events, 
+   (re)sync the clock and probe the links. A sleeping node only reports its 
+   wakes, as it's gone again once the journal is delivered */
 void tcp_handle_connect(void *userdata) {
+  subscribers.set_interning(false);     // Until the host answers /intern
   OSCMessage response = make_pong();
   tcp_client.send(response);
+  journal.resume();
+  if (SLEEP) {
+    send_sleep_stats();
+    return;
+  }
+  sync_clock.start();
+  link_monitor.start();
   wifi_led.blink();
 }
 
 // OSC Output:
 // ===========
-/* Send TCP if connected; fall back on UDP */
+/* Send to matching subscribers (TCP if connected; UDP otherwise) */
 void osc_send(OSCMessage &msg) {
-  if (tcp_client.connected()) 
-      tcp_client.send(msg);
-  else
-      udp_client.send(msg, udp_client.get_remote_addr());
-  wifi_led.blink();
+  if (subscribers.publish(msg))
+    wifi_led.blink();
+}
+
+/* Send a latency-critical event (over UDP instead while TCP is slower) */
+void osc_send_event(OSCMessage &msg) {
+  if (subscribers.publish(msg, MessageClass::Event))
+    wifi_led.blink();
 }
 
-/* Make the '/ping' response message */
+/* Make the '/ping' response message: 
+   /pong <dev_id> <node_id> <addr> <intern_version> */
 OSCMessage make_pong() {
   char buff[32];
   OSCMessage response("/pong");
@@ -182,6 +618,7 @@ OSCMessage make_pong() {
   wifi.get_node_id(buff);
   response.add(atoi(buff));
   response.add(wifi.get_local_address().toString().c_str());
+  response.add(OSC_INTERN_VERSION);
   return response;
 }
 
@@ -191,12 +628,488 @@ OSCMessage make_pong() {
  * /ping
  *  
  * Connect TCP/UDP clients to remote IP. Wait for TCP connection to send /pong
+ * (over the wired link, just answer /pong)
  */
 void osc_handle_ping(OSCMessage &msg) {  
+  if (rx_transport == &wired) {
+    OSCMessage response = make_pong();
+    wired.send(response);
+    return;
+  }
   save_dest(udp_client.get_remote_addr().toString().c_str(), wifi.get_iot_port());
   connect_dest(udp_client.get_remote_addr().toString().c_str(), wifi.get_iot_port());
 }
 
+/*
+ * /intern <version>
+ * 
+ * The host (over TCP) decodes interned packets of this version; send it 
+ * interned packets until the next reconnect
+ */
+void osc_handle_intern(OSCMessage &msg) {
+  subscribers.set_interning(msg.isInt(0) && msg.getInt(0) == OSC_INTERN_VERSION);
+}
+
+/*
+ * /sched/stats
+ * 
+ * Reply with /sched/stats <node_id> <pending> <fired> <missed> <max_late_ms>
+ */
+void osc_handle_sched_stats(OSCMessage &msg) {
+  char node_id[32];
+  wifi.get_node_id(node_id);
+  OSCMessage reply("/sched/stats");
+  reply.add(atoi(node_id));
+  reply.add((int)scheduler.get_num_pending());
+  reply.add((int)scheduler.get_num_fired());
+  reply.add((int)scheduler.get_num_missed());
+  reply.add((int)scheduler.get_max_lateness());
+  osc_send(reply);
+}
+
+/*
+ * /transport/stats
+ * 
+ * Reply with /transport/stats <node_id> <name> <connected> <sent> 
+ * <bytes_sent> <failed> <received> <bytes_received> <errors> per transport
+ */
+void osc_handle_transport_stats(OSCMessage &msg) {
+  char node_id[32];
+  wifi.get_node_id(node_id);
+  Transport *transports[] = { &udp_client, &tcp_client, &wired };
+  for (int i = 0; i < 3; i++) {
+    const TransportStats &stats = transports[i]->get_stats();
+    OSCMessage reply("/transport/stats");
+    reply.add(atoi(node_id));
+    reply.add(transports[i]->name());
+    reply.add((int)transports[i]->connected());
+    reply.add((int)stats.packets_sent);
+    reply.add((int)stats.bytes_sent);
+    reply.add((int)stats.send_failures);
+    reply.add((int)stats.packets_received);
+    reply.add((int)stats.bytes_received);
+    reply.add((int)stats.errors);
+    osc_send(reply);
+  }
+}
+
+/*
+ * /profile start [<stall_ms>]
+ * /profile stop
+ * 
+ * Start profiling loop() (resetting the counters), reporting stalls of at 
+ * least stall_ms (20 ms by default), or stop
+ */
+void osc_handle_profile(OSCMessage &msg) {
+  char cmd[8];
+  if (!msg.isString(0))
+    return;
+  msg.getString(0, cmd, sizeof(cmd));
+  if (strcmp(cmd, "start") == 0)
+    profiler.begin(msg.isInt(1) ? msg.getInt(1) * 1000 : 0);
+  else if (strcmp(cmd, "stop") == 0)
+    profiler.end();
+}
+
+/*
+ * /profile/stats
+ * 
+ * Reply with /profile/stats <node_id> <running> <iterations> <stalls> 
+ * <max_us> <stall_us>, then /profile/hist <node_id> <n_128us> <n_256us> ... 
+ * (iterations per power-of-two bucket, the last one open-ended) and, for the 
+ * sites with the most stall time, /profile/site <node_id> <site> <calls> 
+ * <stalls> <max_us> <stall_ms>
+ */
+void osc_handle_profile_stats(OSCMessage &msg) {
+  char node_id[32];
+  wifi.get_node_id(node_id);
+  OSCMessage reply("/profile/stats");
+  reply.add(atoi(node_id));
+  reply.add((int)profiler.is_running());
+  reply.add((int)profiler.get_num_iterations());
+  reply.add((int)profiler.get_num_stalls());
+  reply.add((int)profiler.get_max_iteration_us());
+  reply.add((int)profiler.get_stall_threshold());
+  osc_send(reply);
+
+  OSCMessage hist("/profile/hist");
+  hist.add(atoi(node_id));
+  for (int i = 0; i < PROFILE_NUM_BUCKETS; i++)
+    hist.add((int)profiler.get_bucket(i));
+  osc_send(hist);
+
+  uint8_t worst[PROFILE_REPORT_SITES];
+  int n = profiler.get_worst_sites(worst, PROFILE_REPORT_SITES);
+  for (int i = 0; i < n; i++) {
+    const ProfileSite &site = profiler.get_site(worst[i]);
+    OSCMessage site_reply("/profile/site");
+    site_reply.add(atoi(node_id));
+    site_reply.add(site.name);
+    site_reply.add((int)site.calls);
+    site_reply.add((int)site.stalls);
+    site_reply.add((int)site.max_us);
+    site_reply.add((int)(site.stall_us / 1000));
+    osc_send(site_reply);
+  }
+}
+
+/*
+ * /heap/stats
+ * 
+ * Reply with /heap/stats <node_id> <free> <min_free> <max_block> <frag_pct>,
+ * then /heap/pool <node_id> <block_size> <blocks> <in_use> <peak> <fallbacks>
+ * per size class and /heap/owner <node_id> <name> <allocs> <frees> <bytes> 
+ * <peak_bytes> <failures> per component
+ */
+void osc_handle_heap_stats(OSCMessage &msg) {
+  char node_id[32];
+  wifi.get_node_id(node_id);
+  OSCMessage reply("/heap/stats");
+  reply.add(atoi(node_id));
+  reply.add((int)pool.get_free_heap());
+  reply.add((int)pool.get_min_free_heap());
+  reply.add((int)pool.get_max_free_block());
+  reply.add((int)pool.get_fragmentation());
+  osc_send(reply);
+
+  for (int i = 0; i < POOL_NUM_CLASSES; i++) {
+    const PoolClassStats &c = pool.get_class_stats(i);
+    OSCMessage pool_reply("/heap/pool");
+    pool_reply.add(atoi(node_id));
+    pool_reply.add((int)c.block_size);
+    pool_reply.add((int)c.num_blocks);
+    pool_reply.add((int)c.in_use);
+    pool_reply.add((int)c.peak);
+    pool_reply.add((int)c.fallbacks);
+    osc_send(pool_reply);
+  }
+  for (int i = 0; i < POOL_NUM_OWNERS; i++) {
+    const PoolOwnerStats &o = pool.get_owner_stats(i);
+    OSCMessage owner_reply("/heap/owner");
+    owner_reply.add(atoi(node_id));
+    owner_reply.add(BlockPool::owner_name(i));
+    owner_reply.add((int)o.allocs);
+    owner_reply.add((int)o.frees);
+    owner_reply.add((int)o.bytes);
+    owner_reply.add((int)o.peak_bytes);
+    owner_reply.add((int)o.failures);
+    osc_send(owner_reply);
+  }
+}
+
+/* The optional <addr> argument at idx, or else the sender's address */
+bool get_subscriber_addr(OSCMessage &msg, int idx, IPAddress &addr) {
+  char addr_str[32];
+  if (msg.size() <= idx)
+    return get_sender_addr(addr);
+  if (!msg.isString(idx))
+    return false;
+  msg.getString(idx, addr_str, sizeof(addr_str));
+  return addr.fromString(addr_str);
+}
+
+/*
+ * /subscribe <filter> <port> [<lease_s>] [<addr>]
+ * 
+ * Send messages under the OSC path filter to addr:port by UDP (addr defaults
+ * to the sender, and is required over the wired link) until the lease runs 
+ * out; subscribing again renews it
+ */
+void osc_handle_subscribe(OSCMessage &msg) {
+  char filter[SUB_MAX_FILTER_LENGTH];
+  IPAddress addr;
+  if (msg.size() < 2 || !msg.isString(0) || !msg.isInt(1) || 
+      (msg.size() > 2 && !msg.isInt(2)))
+    return;
+  int port = msg.getInt(1);
+  int lease_s = msg.size() > 2 ? msg.getInt(2) : SUB_DEFAULT_LEASE_S;
+  if (port <= 0 || port > 65535 || !get_subscriber_addr(msg, 3, addr))
+    return;
+  msg.getString(0, filter, sizeof(filter));
+  subscribers.subscribe(addr, port, filter, SubTransport::Udp, 
+    1000 * (lease_s > 0 ? lease_s : SUB_DEFAULT_LEASE_S));
+}
+
+/*
+ * /unsubscribe <port> [<addr>]
+ */
+void osc_handle_unsubscribe(OSCMessage &msg) {
+  IPAddress addr;
+  if (msg.size() < 1 || !msg.isInt(0) || !get_subscriber_addr(msg, 1, addr))
+    return;
+  subscribers.unsubscribe(addr, msg.getInt(0));
+}
+
+/*
+ * /subscribers
+ * 
+ * Reply with /subscribers <node_id> <addr> <port> <transport> <filter> 
+ * <lease_left_s> <sent> per subscriber (lease_left_s is -1 for no lease)
+ */
+void osc_handle_subscribers(OSCMessage &msg) {
+  char node_id[32];
+  wifi.get_node_id(node_id);
+  subscribers.expire();
+  for (int i = 0; i < SUB_MAX_SUBSCRIBERS; i++) {
+    const Subscriber &sub = subscribers.get_subscriber(i);
+    if (!sub.active)
+      continue;
+    OSCMessage reply("/subscribers");
+    reply.add(atoi(node_id));
+    reply.add(sub.addr.toString().c_str());
+    reply.add((int)sub.port);
+    reply.add(SubscriberTable::transport_name(sub.transport));
+    reply.add(sub.filter);
+    reply.add(sub.lease_ms ? (int)((sub.lease_ms - (millis() - sub.renewed_ms)) / 1000) : -1);
+    reply.add((int)sub.num_sent);
+    osc_send(reply);
+  }
+}
+
+/*
+ * /flow open
+ * /flow credits <n> [<ttl_ms>]
+ * /flow grant <n> [<ttl_ms>]
+ * /flow rate <msgs_per_s> [<burst>] [<ttl_ms>]
+ * 
+ * Limit outgoing messages (see FlowControl); limits lapse after the TTL 
+ * (10 s by default) unless renewed
+ */
+void osc_handle_flow(OSCMessage &msg) {
+  flow.handle_message(msg);
+}
+
+/*
+ * /flow/status
+ * 
+ * Reply with /flow/status <node_id> <mode> <credits> <rate> <tokens> 
+ * <throttled> <admitted> <denied_normal> <denied_low> <coalesced> <throttles>
+ */
+void osc_handle_flow_status(OSCMessage &msg) {
+  char node_id[32];
+  wifi.get_node_id(node_id);
+  flow.loop();
+  OSCMessage reply("/flow/status");
+  reply.add(atoi(node_id));
+  reply.add(FlowControl::mode_name(flow.get_mode()));
+  reply.add((int)flow.get_credits());
+  reply.add(flow.get_rate());
+  reply.add(flow.get_tokens());
+  reply.add((int)flow.is_throttled());
+  reply.add((int)(flow.get_num_admitted(FlowPriority::Normal) + flow.get_num_admitted(FlowPriority::Low)));
+  reply.add((int)flow.get_num_denied(FlowPriority::Normal));
+  reply.add((int)flow.get_num_denied(FlowPriority::Low));
+  reply.add((int)flow.get_num_coalesced());
+  reply.add((int)flow.get_num_throttles());
+  osc_send(reply);
+}
+
+/*
+ * /ev/ack <epoch> <seq>
+ * 
+ * The bridge received journaled events up to seq
+ */
+void osc_handle_journal_ack(OSCMessage &msg) {
+  journal.handle_ack(msg);
+}
+
+/*
+ * /journal/stats
+ * 
+ * Reply with /journal/stats <node_id> <pending> <recorded> <sent> <resent> 
+ * <dropped> <expired> <spilled>
+ */
+void osc_handle_journal_stats(OSCMessage &msg) {
+  char node_id[32];
+  wifi.get_node_id(node_id);
+  OSCMessage reply("/journal/stats");
+  reply.add(atoi(node_id));
+  reply.add((int)journal.get_num_pending());
+  reply.add((int)journal.get_num_recorded());
+  reply.add((int)journal.get_num_sent());
+  reply.add((int)journal.get_num_resent());
+  reply.add((int)journal.get_num_dropped());
+  reply.add((int)journal.get_num_expired());
+  reply.add((int)journal.get_num_spilled());
+  osc_send(reply);
+}
+
+/*
+ * /act <channel> <value> [<ramp_ms>]
+ * 
+ * Set an actuator channel: 0/1 (digital), a level from 0 to 1023 ramped to 
+ * over ramp_ms (PWM), or a pulse length in ms (pulse). The light (PWM) 
+ * ignores commands while A0 is streaming, as both need timer1
+ */
+void osc_handle_act(OSCMessage &msg) {
+  actuators.handle_message(msg);
+}
+
+/*
+ * /act/stats
+ * 
+ * Reply with /act/stats <node_id> <channel> <mode> <value> <commands> 
+ * <applied> <coalesced> per channel
+ */
+void osc_handle_act_stats(OSCMessage &msg) {
+  char node_id[32];
+  wifi.get_node_id(node_id);
+  for (int i = 0; i < actuators.get_num_channels(); i++) {
+    const ActuatorChannel &ch = actuators.get_channel(i);
+    OSCMessage reply("/act/stats");
+    reply.add(atoi(node_id));
+    reply.add(i);
+    reply.add(Actuators::mode_name(ch.mode));
+    reply.add((int)ch.value);
+    reply.add((int)ch.num_commands);
+    reply.add((int)ch.num_applied);
+    reply.add((int)ch.num_coalesced);
+    osc_send(reply);
+  }
+}
+
+/*
+ * /clock/resp <seq> <t2_sec> <t2_frac> <t3_sec> <t3_frac>
+ * 
+ * The bridge's answer to a clock sync request
+ */
+void osc_handle_clock_response(OSCMessage &msg) {
+  sync_clock.handle_response(msg);
+}
+
+/*
+ * /clock/stats
+ * 
+ * Reply with /clock/stats <node_id> <synced> <rtt_us> <skew_ppm> <samples> 
+ * <timeouts> <steps> <pending> <executed> <late> <dropped> <unsynced> 
+ * <last_error_us> <max_error_us>
+ */
+void osc_handle_clock_stats(OSCMessage &msg) {
+  char node_id[32];
+  wifi.get_node_id(node_id);
+  OSCMessage reply("/clock/stats");
+  reply.add(atoi(node_id));
+  reply.add((int)sync_clock.is_synced());
+  reply.add((int)sync_clock.get_rtt_us());
+  reply.add(sync_clock.get_skew_ppm());
+  reply.add((int)sync_clock.get_num_samples());
+  reply.add((int)sync_clock.get_num_timeouts());
+  reply.add((int)sync_clock.get_num_steps());
+  reply.add((int)osc.get_num_pending());
+  reply.add((int)osc.get_num_executed());
+  reply.add((int)osc.get_num_late());
+  reply.add((int)osc.get_num_dropped());
+  reply.add((int)osc.get_num_unsynced());
+  reply.add((int)osc.get_last_error_us());
+  reply.add((int)osc.get_max_error_us());
+  osc_send(reply);
+}
+
+/*
+ * /link/probe <seq> <link>
+ * 
+ * A link probe, echoed by the bridge
+ */
+void osc_handle_link_probe(OSCMessage &msg) {
+  link_monitor.handle_probe(msg);
+}
+
+/*
+ * /link/port <port>
+ * 
+ * The UDP port the bridge echoes probes on
+ */
+void osc_handle_link_port(OSCMessage &msg) {
+  link_monitor.handle_port(msg);
+}
+
+/*
+ * /link/stats
+ * 
+ * Reply with /link/stats <node_id> <link> <chosen> <score_us> <srtt_us> 
+ * <tail_us> <loss_permille> <queue_ms> <probes> <lost> <events> <switches> 
+ * per link
+ */
+void osc_handle_link_stats(OSCMessage &msg) {
+  char node_id[32];
+  wifi.get_node_id(node_id);
+  for (int i = 0; i < LINK_NUM_LINKS; i++) {
+    LinkId link = (LinkId)i;
+    const LinkStats &stats = link_monitor.get_stats(link);
+    OSCMessage reply("/link/stats");
+    reply.add(atoi(node_id));
+    reply.add(LinkMonitor::link_name(link));
+    reply.add((int)(link_monitor.get_choice() == link));
+    reply.add((int)link_monitor.score_us(link));
+    reply.add((int)stats.srtt_us);
+    reply.add((int)stats.tail_us);
+    reply.add((int)stats.loss_permille);
+    reply.add((int)(link == LinkId::Tcp ? tcp_client.get_queue_delay_ms() : 0));
+    reply.add((int)stats.probes_sent);
+    reply.add((int)stats.probes_lost);
+    reply.add((int)stats.num_events);
+    reply.add((int)stats.num_switches);
+    osc_send(reply);
+  }
+}
+
+/*
+ * /sleep/stats
+ * 
+ * Reply with /sleep/stats (see send_sleep_stats())
+ */
+void osc_handle_sleep_stats(OSCMessage &msg) {
+  send_sleep_stats();
+}
+
+/*
+ * /stream/start <rate_hz> <block_len> [<encoding>]
+ * 
+ * Stream A0 as /stream blocks (encoding 0: raw 16-bit, 1: delta/varint) at 
+ * up to ANALOG_STREAM_MAX_HZ. Refused while the light (PWM) is on, as both 
+ * need timer1
+ */
+void osc_handle_stream_start(OSCMessage &msg) {
+  if (msg.size() < 2 || !msg.isInt(0) || !msg.isInt(1) || 
+      (msg.size() > 2 && !msg.isInt(2)) || actuators.pwm_active())
+    return;
+  int rate_hz = msg.getInt(0);
+  int block_len = msg.getInt(1);
+  if (rate_hz <= 0 || block_len <= 0 || block_len > 0xFFFF)
+    return;
+  StreamEncoding enc = StreamEncoding::Raw16;
+  if (msg.size() > 2 && msg.getInt(2) == 1)
+    enc = StreamEncoding::DeltaVarint;
+  stream.start(rate_hz, block_len, enc);
+}
+
+/*
+ * /stream/stop
+ */
+void osc_handle_stream_stop(OSCMessage &msg) {
+  stream.stop();
+}
+
+/*
+ * /config/set <key> <dev_id|*> <node_id|*> <name> <value> [<name> <value> ...]
+ * 
+ * Change configuration parameters without leaving the network
+ */
+void osc_handle_config_set(OSCMessage &msg) {
+  wifi.handle_config_set(msg);
+}
+
+/*
+ * /config/get <key> <dev_id|*> <node_id|*> [<name> ...]
+ * 
+ * Reply with /config/value <dev_id> <node_id> <name> <value> ...
+ */
+void osc_handle_config_get(OSCMessage &msg) {
+  OSCMessage reply("/config/value");
+  if (wifi.handle_config_get(msg, reply))
+    osc_send(reply);
+}
+
 /*
  * /config
  * 